@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-3.0-only
+#
+# Generates the synthetic captures used by bench_target_detection. They're
+# written in the format of wl-kbptr's --dump-capture.
+
+import random
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = "wl-kbptr-capture v1"
+WL_SHM_FORMAT_XRGB8888 = 1
+WL_OUTPUT_TRANSFORM_NORMAL = 0
+WL_OUTPUT_TRANSFORM_270 = 3
+
+WHITE = 0xFFFFFF
+LIGHT = 0xE8E8E8
+GRAY = 0x808080
+DARK = 0x202020
+ACCENT = 0x3465A4
+
+
+class Image:
+    def __init__(self, width, height, color):
+        self.width = width
+        self.height = height
+        self.pixels = [color] * (width * height)
+
+    def fill(self, x, y, w, h, color):
+        for row in range(max(y, 0), min(y + h, self.height)):
+            start = row * self.width + max(x, 0)
+            end = row * self.width + min(x + w, self.width)
+            self.pixels[start:end] = [color] * (end - start)
+
+    def text(self, rng, x, y, w, size, color):
+        """Draws a line of glyph-like blocks."""
+        end = x + w
+        while x < end:
+            glyph_w = rng.randint(size // 3, size * 2 // 3)
+            glyph_h = rng.randint(size // 2, size)
+            self.fill(x, y + size - glyph_h, glyph_w, glyph_h, color)
+            x += glyph_w + rng.randint(1, size // 3)
+            if rng.random() < 0.15:
+                x += size
+
+    def write(self, path, transform, area):
+        header = (
+            f"{MAGIC} format=0x{WL_SHM_FORMAT_XRGB8888:08x} "
+            f"width={self.width} height={self.height} "
+            f"stride={self.width * 4} transform={transform} "
+            f"area={area[0]},{area[1]},{area[2]}x{area[3]}\n"
+        )
+        data = struct.pack(f"<{len(self.pixels)}I", *self.pixels)
+        path.write_bytes(header.encode() + data)
+
+
+def draw_window(img, rng, scale):
+    """Draws an application window with a toolbar, a sidebar and a form."""
+    s = scale
+    img.fill(0, 0, img.width, 36 * s, LIGHT)
+    x = 8 * s
+    for _ in range(8):
+        w = rng.randint(24, 80) * s
+        img.fill(x, 6 * s, w, 24 * s, GRAY)
+        img.fill(x + s, 7 * s, w - 2 * s, 22 * s, WHITE)
+        img.text(rng, x + 6 * s, 12 * s, w - 12 * s, 10 * s, DARK)
+        x += w + 6 * s
+
+    sidebar_w = img.width // 4
+    img.fill(0, 36 * s, sidebar_w, img.height - 36 * s, LIGHT)
+    for i, y in enumerate(range(44 * s, img.height - 24 * s, 26 * s)):
+        if i == 3:
+            img.fill(0, y - 3 * s, sidebar_w, 24 * s, ACCENT)
+        img.fill(10 * s, y + 2 * s, 14 * s, 14 * s, GRAY)
+        img.text(rng, 32 * s, y + 2 * s, sidebar_w // 2, 12 * s, DARK)
+
+    x0 = sidebar_w + 16 * s
+    y = 52 * s
+    while y < img.height - 48 * s:
+        img.text(rng, x0, y, rng.randint(60, 140) * s, 12 * s, DARK)
+        field_x = x0 + 150 * s
+        field_w = min(img.width - field_x - 16 * s, 240 * s)
+        if field_w > 40 * s:
+            img.fill(field_x, y - 4 * s, field_w, 22 * s, GRAY)
+            img.fill(field_x + s, y - 3 * s, field_w - 2 * s, 20 * s, WHITE)
+        y += 34 * s
+
+    img.fill(img.width - 100 * s, img.height - 40 * s, 84 * s, 28 * s, ACCENT)
+    img.text(rng, img.width - 90 * s, img.height - 32 * s, 60 * s, 12 * s, WHITE)
+
+
+def draw_text_page(img, rng):
+    """Draws a page of text with links, which has many small components."""
+    img.fill(0, 0, img.width, img.height, WHITE)
+    y = 16
+    while y < img.height - 20:
+        color = ACCENT if rng.random() < 0.2 else DARK
+        img.text(rng, 24, y, rng.randint(img.width // 2, img.width - 48), 11,
+                 color)
+        y += rng.choice((18, 18, 18, 30))
+
+
+def main():
+    out = Path(sys.argv[1] if len(sys.argv) > 1 else Path(__file__).parent)
+
+    img = Image(640, 400, WHITE)
+    draw_window(img, random.Random(1), 1)
+    img.write(out / "window.raw", WL_OUTPUT_TRANSFORM_NORMAL, (0, 0, 640, 400))
+
+    img = Image(640, 400, WHITE)
+    draw_text_page(img, random.Random(2))
+    img.write(out / "text.raw", WL_OUTPUT_TRANSFORM_NORMAL, (0, 0, 640, 400))
+
+    # A window on a portrait output with a scale of 2, drawn as it's displayed
+    # then rotated back to how the compositor would send it.
+    img = Image(400, 640, WHITE)
+    draw_window(img, random.Random(3), 2)
+    rotated = Image(640, 400, WHITE)
+    for y in range(img.height):
+        for x in range(img.width):
+            rotated.pixels[x * rotated.width + rotated.width - 1 - y] = \
+                img.pixels[y * img.width + x]
+    rotated.write(
+        out / "window-hidpi-270.raw", WL_OUTPUT_TRANSFORM_270, (0, 0, 200, 320)
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "area_grid.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Cells are at least this many pixels wide so that large areas don't end up
+// in too many of them.
+#define MIN_CELL_SIZE 16
+
+/**
+ * `clip_rect` stores the part of `rect` within `bounds` in `clipped`. Returns
+ * false if it's empty.
+ */
+static bool
+clip_rect(struct rect rect, struct rect bounds, struct rect *clipped) {
+    int x0 = max(rect.x, bounds.x);
+    int y0 = max(rect.y, bounds.y);
+    int x1 = min(rect.x + rect.w, bounds.x + bounds.w);
+    int y1 = min(rect.y + rect.h, bounds.y + bounds.h);
+
+    *clipped = (struct rect){x0, y0, x1 - x0, y1 - y0};
+    return x0 < x1 && y0 < y1;
+}
+
+static int cell_column(const struct area_grid *grid, int x) {
+    return min((x - grid->bounds.x) / grid->cell_size, grid->columns - 1);
+}
+
+static int cell_row(const struct area_grid *grid, int y) {
+    return min((y - grid->bounds.y) / grid->cell_size, grid->rows - 1);
+}
+
+/**
+ * `add_area` counts area `idx` in the cells it overlaps or, once they're
+ * counted, writes it in them.
+ */
+static void add_area(struct area_grid *grid, int idx, int *counts) {
+    struct rect area;
+    if (!clip_rect(grid->areas[idx], grid->bounds, &area)) {
+        return;
+    }
+
+    int end_row    = cell_row(grid, area.y + area.h - 1);
+    int end_column = cell_column(grid, area.x + area.w - 1);
+    for (int row = cell_row(grid, area.y); row <= end_row; row++) {
+        for (int col = cell_column(grid, area.x); col <= end_column; col++) {
+            int cell = row * grid->columns + col;
+            if (grid->indices == NULL) {
+                counts[cell]++;
+            } else {
+                grid->indices[grid->cell_starts[cell] + counts[cell]++] = idx;
+            }
+        }
+    }
+}
+
+int area_grid_init(
+    struct area_grid *grid, const struct rect *areas, int num_areas,
+    struct rect bounds
+) {
+    // About one area per cell when they're spread evenly.
+    int cell_size = sqrt((double)bounds.w * bounds.h / max(num_areas, 1));
+
+    *grid = (struct area_grid){
+        .areas     = areas,
+        .bounds    = bounds,
+        .cell_size = max(cell_size, MIN_CELL_SIZE),
+    };
+    grid->columns = max((bounds.w + grid->cell_size - 1) / grid->cell_size, 1);
+    grid->rows    = max((bounds.h + grid->cell_size - 1) / grid->cell_size, 1);
+
+    int  num_cells    = grid->columns * grid->rows;
+    int *counts       = calloc(num_cells, sizeof(int));
+    grid->cell_starts = malloc(sizeof(int) * (num_cells + 1));
+    if (counts == NULL || grid->cell_starts == NULL) {
+        goto error;
+    }
+
+    // Cells are filled in two passes: one counts their areas and the other
+    // writes them once the cells' offsets are known.
+    for (int i = 0; i < num_areas; i++) {
+        add_area(grid, i, counts);
+    }
+
+    grid->cell_starts[0] = 0;
+    for (int i = 0; i < num_cells; i++) {
+        grid->cell_starts[i + 1] = grid->cell_starts[i] + counts[i];
+        counts[i]                = 0;
+    }
+
+    grid->indices = malloc(sizeof(int) * max(grid->cell_starts[num_cells], 1));
+    if (grid->indices == NULL) {
+        goto error;
+    }
+
+    for (int i = 0; i < num_areas; i++) {
+        add_area(grid, i, counts);
+    }
+
+    free(counts);
+    return 0;
+
+error:
+    LOG_ERR("Could not allocate area grid.");
+    free(counts);
+    area_grid_finish(grid);
+    return 1;
+}
+
+void area_grid_query(
+    const struct area_grid *grid, struct rect rect, area_grid_visitor_t visit,
+    void *data
+) {
+    struct rect query;
+    if (!clip_rect(rect, grid->bounds, &query)) {
+        return;
+    }
+
+    int end_row    = cell_row(grid, query.y + query.h - 1);
+    int end_column = cell_column(grid, query.x + query.w - 1);
+    for (int row = cell_row(grid, query.y); row <= end_row; row++) {
+        for (int col = cell_column(grid, query.x); col <= end_column; col++) {
+            int cell = row * grid->columns + col;
+
+            for (int i = grid->cell_starts[cell];
+                 i < grid->cell_starts[cell + 1]; i++) {
+                int idx = grid->indices[i];
+
+                struct rect overlap;
+                if (!clip_rect(grid->areas[idx], query, &overlap)) {
+                    continue;
+                }
+
+                // Areas spanning several cells are only visited in the cell
+                // where their overlap with `rect` starts.
+                if (cell_row(grid, overlap.y) != row ||
+                    cell_column(grid, overlap.x) != col) {
+                    continue;
+                }
+
+                if (!visit(idx, data)) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+void area_grid_finish(struct area_grid *grid) {
+    free(grid->cell_starts);
+    free(grid->indices);
+    grid->cell_starts = NULL;
+    grid->indices     = NULL;
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __AREA_GRID_H_INCLUDED__
+#define __AREA_GRID_H_INCLUDED__
+
+#include "utils.h"
+
+#include <stdbool.h>
+
+/**
+ * An `area_grid` is a uniform grid over areas within `bounds`. Each cell lists
+ * the areas overlapping it so that the ones overlapping a rectangle are found
+ * without going through all of them. Parts of areas outside of `bounds` are
+ * ignored.
+ */
+struct area_grid {
+    const struct rect *areas;
+    struct rect        bounds;
+    int                cell_size;
+    int                columns;
+    int                rows;
+
+    // Areas of cell `i` are `indices[cell_starts[i]]` to
+    // `indices[cell_starts[i + 1] - 1]`.
+    int *cell_starts;
+    int *indices;
+};
+
+/**
+ * An `area_grid_visitor_t` is called with the index of each area found. It
+ * returns false to stop the search.
+ */
+typedef bool (*area_grid_visitor_t)(int idx, void *data);
+
+/**
+ * `area_grid_init` builds the grid of `areas` which must outlive it. Returns 0
+ * on success.
+ */
+int area_grid_init(
+    struct area_grid *grid, const struct rect *areas, int num_areas,
+    struct rect bounds
+);
+
+/**
+ * `area_grid_query` calls `visit` once for each area overlapping `rect`.
+ */
+void area_grid_query(
+    const struct area_grid *grid, struct rect rect, area_grid_visitor_t visit,
+    void *data
+);
+
+void area_grid_finish(struct area_grid *grid);
+
+#endif
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "area_input.h"
+
+#include "log.h"
+#include "rect_parse.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_SIZE (64 * 1024)
+
+// Reads done in one call to `area_input_read` at most.
+#define MAX_READS 16
+
+#define BATCH_HEADER_SIZE (AREA_INPUT_MAGIC_LEN + sizeof(uint32_t))
+#define BINARY_AREA_SIZE  (4 * sizeof(int32_t))
+
+void area_input_init(struct area_input *input, enum stdin_format format) {
+    *input = (struct area_input){
+        .format = format,
+    };
+}
+
+static int add_area(struct rect area, void *data) {
+    struct area_input *input = data;
+
+    if (input->num_areas >= input->areas_cap) {
+        int          cap   = max(input->areas_cap * 2, 256);
+        struct rect *areas = realloc(input->areas, sizeof(struct rect) * cap);
+        if (areas == NULL) {
+            LOG_ERR("Could not allocate areas.");
+            return 1;
+        }
+
+        input->areas     = areas;
+        input->areas_cap = cap;
+    }
+
+    input->areas[input->num_areas++] = area;
+    return 0;
+}
+
+/**
+ * `parse_batches` parses the binary areas of `data` and returns the length
+ * they took.
+ */
+static size_t
+parse_batches(struct area_input *input, const char *data, size_t len) {
+    size_t start = 0;
+
+    while (!input->failed) {
+        if (!input->in_batch) {
+            if (len - start < BATCH_HEADER_SIZE) {
+                break;
+            }
+
+            if (memcmp(data + start, AREA_INPUT_MAGIC, AREA_INPUT_MAGIC_LEN)) {
+                LOG_ERR("Invalid binary batch header. Ignoring the rest.");
+                input->failed = true;
+                break;
+            }
+
+            memcpy(
+                &input->batch_left, data + start + AREA_INPUT_MAGIC_LEN,
+                sizeof(uint32_t)
+            );
+            input->in_batch  = true;
+            start           += BATCH_HEADER_SIZE;
+        }
+
+        for (; input->batch_left > 0 && len - start >= BINARY_AREA_SIZE;
+             input->batch_left--) {
+            int32_t values[4];
+            memcpy(values, data + start, BINARY_AREA_SIZE);
+            start += BINARY_AREA_SIZE;
+
+            struct rect area = {values[0], values[1], values[2], values[3]};
+            if (add_area(area, input)) {
+                input->failed = true;
+                break;
+            }
+        }
+
+        if (input->batch_left > 0) {
+            break;
+        }
+        input->in_batch = false;
+    }
+
+    return input->failed ? len : start;
+}
+
+/**
+ * `parse` parses `data` and returns the length it took. Once the input is
+ * `complete`, all of it is.
+ */
+static size_t
+parse(struct area_input *input, const char *data, size_t len, bool complete) {
+    if (input->format == STDIN_FORMAT_TEXT) {
+        return rect_parse_lines(
+            data, len, complete, &input->line, add_area, input
+        );
+    }
+
+    size_t parsed = parse_batches(input, data, len);
+    if (complete && (parsed < len || input->in_batch)) {
+        LOG_ERR("Binary input ended in the middle of a batch.");
+    }
+
+    return complete ? len : parsed;
+}
+
+static void parse_pending(struct area_input *input, bool complete) {
+    size_t parsed = parse(input, input->pending, input->pending_len, complete);
+
+    input->pending_len -= parsed;
+    memmove(input->pending, input->pending + parsed, input->pending_len);
+}
+
+int area_input_read(struct area_input *input, int fd) {
+    for (int i = 0; i < MAX_READS; i++) {
+        if (input->pending_cap - input->pending_len < READ_SIZE) {
+            size_t cap     = input->pending_cap + READ_SIZE;
+            char  *pending = realloc(input->pending, cap);
+            if (pending == NULL) {
+                LOG_ERR("Could not allocate input buffer.");
+                return -1;
+            }
+
+            input->pending     = pending;
+            input->pending_cap = cap;
+        }
+
+        ssize_t len =
+            read(fd, input->pending + input->pending_len, READ_SIZE);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+
+            LOG_ERR("Could not read input: %s.", strerror(errno));
+            return -1;
+        }
+
+        if (len == 0) {
+            parse_pending(input, true);
+            return 0;
+        }
+
+        input->pending_len += len;
+        parse_pending(input, false);
+    }
+
+    return 1;
+}
+
+int area_input_read_all(struct area_input *input, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        lseek(fd, 0, SEEK_CUR) == 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            parse(input, data, st.st_size, true);
+            munmap(data, st.st_size);
+            return 0;
+        }
+    }
+
+    int ret;
+    while ((ret = area_input_read(input, fd)) > 0) {}
+    return ret;
+}
+
+void area_input_finish(struct area_input *input) {
+    free(input->pending);
+    free(input->areas);
+    input->pending = NULL;
+    input->areas   = NULL;
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __AREA_INPUT_H_INCLUDED__
+#define __AREA_INPUT_H_INCLUDED__
+
+#include "config.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary input is a sequence of batches. Each starts with this magic and the
+// number of areas as a 32-bit integer, followed by the areas as four 32-bit
+// integers each: x, y, width and height. Integers are in native byte order.
+#define AREA_INPUT_MAGIC     "wkpa"
+#define AREA_INPUT_MAGIC_LEN 4
+
+/**
+ * An `area_input` parses areas as the input comes so that they can be shown
+ * before it ends.
+ */
+struct area_input {
+    enum stdin_format format;
+
+    // Input not parsed yet: the end of a line or batch still to come.
+    char  *pending;
+    size_t pending_len;
+    size_t pending_cap;
+
+    struct rect *areas;
+    int          num_areas;
+    int          areas_cap;
+
+    // Number of text lines parsed.
+    int line;
+
+    // Areas left in the current binary batch.
+    bool     in_batch;
+    uint32_t batch_left;
+
+    // Set when binary input can't be parsed anymore.
+    bool failed;
+};
+
+void area_input_init(struct area_input *input, enum stdin_format format);
+
+/**
+ * `area_input_read` reads what's available from `fd` and parses it. It stops
+ * after a while so that the event loop isn't held up by a fast writer. Returns
+ * 1 if more input may come, 0 at the end of input and -1 on error.
+ */
+int area_input_read(struct area_input *input, int fd);
+
+/**
+ * `area_input_read_all` reads and parses `fd` until its end. Files are mapped
+ * rather than read. Returns 0 on success.
+ */
+int area_input_read_all(struct area_input *input, int fd);
+
+void area_input_finish(struct area_input *input);
+
+#endif
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "log.h"
+#include "rect_parse.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 10
+#define DEFAULT_NUM_RECTS  100000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * `generate_input` writes `num_rects` random rectangles of a 4K screen, one
+ * per line. Returns its length.
+ */
+static size_t generate_input(int num_rects, char **out) {
+    size_t cap = (size_t)num_rects * 24 + 1;
+    char  *buf = malloc(cap);
+    size_t len = 0;
+
+    srand(1);
+    for (int i = 0; i < num_rects; i++) {
+        len += snprintf(
+            buf + len, cap - len, "%dx%d+%d+%d\n", 1 + rand() % 400,
+            1 + rand() % 200, rand() % 3840, rand() % 2160
+        );
+    }
+
+    *out = buf;
+    return len;
+}
+
+static int count_rect(struct rect rect, void *data) {
+    (*(int *)data)++;
+    return 0;
+}
+
+static int parse_with_rect_parse(const char *data, size_t len) {
+    int num_rects = 0;
+    int line      = 0;
+    rect_parse_lines(data, len, true, &line, count_rect, &num_rects);
+    return num_rects;
+}
+
+/**
+ * `parse_with_sscanf` parses the input line by line with `sscanf`, as it used
+ * to be, for reference.
+ */
+static int parse_with_sscanf(const char *data, size_t len) {
+    int         num_rects = 0;
+    const char *s         = data;
+    const char *end       = data + len;
+    char        line[64];
+
+    while (s < end) {
+        const char *eol      = memchr(s, '\n', end - s);
+        size_t      line_len = (eol != NULL ? eol : end) - s;
+
+        // `sscanf` goes through the whole string first so lines are copied.
+        line_len = min(line_len, sizeof(line) - 1);
+        memcpy(line, s, line_len);
+        line[line_len] = '\0';
+
+        struct rect rect;
+        if (sscanf(line, "%dx%d+%d+%d", &rect.w, &rect.h, &rect.x, &rect.y) ==
+            4) {
+            num_rects++;
+        }
+
+        s = eol != NULL ? eol + 1 : end;
+    }
+
+    return num_rects;
+}
+
+static void bench(
+    const char *name, int (*parse)(const char *, size_t), const char *data,
+    size_t len, int iterations
+) {
+    double total_time = 0;
+    double min_time   = 0;
+    int    num_rects  = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        double start   = now();
+        num_rects      = parse(data, len);
+        double elapsed = now() - start;
+
+        total_time += elapsed;
+        if (i == 0 || elapsed < min_time) {
+            min_time = elapsed;
+        }
+    }
+
+    printf(
+        "%s: %d rectangles\n  total %.2f  min %.2f\n", name, num_rects,
+        total_time * 1000. / iterations, min_time * 1000.
+    );
+}
+
+static void print_usage(void) {
+    puts("Usage: bench_rect_parse [-n N] [-c COUNT]\n");
+    puts("Parses randomly generated rectangles in the wxh+x+y format, one per");
+    puts("line, and reports the time it takes in milliseconds.\n");
+    puts(" -n, --iterations=N  number of runs (default: 10)");
+    puts(" -c, --count=COUNT   number of rectangles (default: 100000)");
+    puts(" -h, --help          print this message and exit");
+}
+
+int main(int argc, char **argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    int num_rects  = DEFAULT_NUM_RECTS;
+
+    static struct option long_options[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"count", required_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:c:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = atoi(optarg);
+            if (iterations <= 0) {
+                LOG_ERR("Invalid number of iterations '%s'.", optarg);
+                return 1;
+            }
+            break;
+
+        case 'c':
+            num_rects = atoi(optarg);
+            if (num_rects <= 0) {
+                LOG_ERR("Invalid number of rectangles '%s'.", optarg);
+                return 1;
+            }
+            break;
+
+        case 'h':
+            print_usage();
+            return 0;
+
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+
+    char  *data;
+    size_t len = generate_input(num_rects, &data);
+
+    bench("rect_parse", parse_with_rect_parse, data, len, iterations);
+    bench("sscanf", parse_with_sscanf, data, len, iterations);
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "capture_file.h"
+#include "log.h"
+#include "target_detection.h"
+
+#include <cairo/cairo.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 10
+
+static target_detector_t parse_detector(const char *name) {
+#if OPENCV_ENABLED
+    if (strcmp(name, "opencv") == 0) {
+        return compute_target_from_img_buffer;
+    }
+#endif
+
+    if (strcmp(name, "native") == 0) {
+        return detect_targets_native;
+    }
+
+    return NULL;
+}
+
+static bool has_suffix(const char *str, const char *suffix) {
+    size_t str_len    = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return str_len >= suffix_len &&
+           strcmp(str + str_len - suffix_len, suffix) == 0;
+}
+
+/**
+ * `load_png` loads a PNG screenshot as a capture of a whole output with no
+ * transform.
+ */
+static int load_png(const char *path, struct capture_file *capture) {
+    cairo_surface_t *surface = cairo_image_surface_create_from_png(path);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        LOG_ERR("Could not load '%s'.", path);
+        cairo_surface_destroy(surface);
+        return 1;
+    }
+
+    switch (cairo_image_surface_get_format(surface)) {
+    case CAIRO_FORMAT_ARGB32:
+        capture->format = WL_SHM_FORMAT_ARGB8888;
+        break;
+    case CAIRO_FORMAT_RGB24:
+        capture->format = WL_SHM_FORMAT_XRGB8888;
+        break;
+    default:
+        LOG_ERR("Unsupported PNG format in '%s'.", path);
+        cairo_surface_destroy(surface);
+        return 1;
+    }
+
+    capture->width     = cairo_image_surface_get_width(surface);
+    capture->height    = cairo_image_surface_get_height(surface);
+    capture->stride    = cairo_image_surface_get_stride(surface);
+    capture->transform = WL_OUTPUT_TRANSFORM_NORMAL;
+    capture->area = (struct rect){0, 0, capture->width, capture->height};
+
+    size_t size   = (size_t)capture->stride * capture->height;
+    capture->data = malloc(size);
+    memcpy(capture->data, cairo_image_surface_get_data(surface), size);
+
+    cairo_surface_destroy(surface);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_stats(
+    struct target_detection_stats       *total,
+    const struct target_detection_stats *stats
+) {
+    total->gray += stats->gray;
+    total->resize += stats->resize;
+    total->canny += stats->canny;
+    total->dilate += stats->dilate;
+    total->contours += stats->contours;
+    total->filter += stats->filter;
+    total->num_bands = stats->num_bands;
+}
+
+static int bench_file(
+    const char *path, target_detector_t detector, int iterations,
+    uint64_t max_pixels
+) {
+    struct capture_file capture;
+    int err = has_suffix(path, ".png") ? load_png(path, &capture)
+                                       : capture_file_read(path, &capture);
+    if (err) {
+        return 1;
+    }
+
+    struct target_detection_stats total       = {0};
+    double                        total_time  = 0;
+    double                        min_time    = 0;
+    int                           num_targets = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        struct target_detection_stats stats;
+        struct rect                  *areas;
+
+        double start = now();
+        num_targets  = detector(
+            capture.data, capture.height, capture.width, capture.stride,
+            capture.format, capture.transform, capture.area, 0, max_pixels,
+            &areas, &stats
+        );
+        double elapsed = now() - start;
+        free(areas);
+
+        add_stats(&total, &stats);
+        total_time += elapsed;
+        if (i == 0 || elapsed < min_time) {
+            min_time = elapsed;
+        }
+    }
+
+    // Times are averages in milliseconds.
+    double f = 1000. / iterations;
+    printf(
+        "%s (%ux%u, %d bands): %d targets\n"
+        "  gray %.2f  resize %.2f  canny %.2f  dilate %.2f  contours %.2f"
+        "  filter %.2f\n"
+        "  total %.2f  min %.2f\n",
+        path, capture.width, capture.height, total.num_bands, num_targets,
+        total.gray * f, total.resize * f, total.canny * f, total.dilate * f,
+        total.contours * f, total.filter * f, total_time * f, min_time * 1000.
+    );
+
+    capture_file_free(&capture);
+    return 0;
+}
+
+static void print_usage(void) {
+    puts("Usage: bench_target_detection [-d DETECTOR] [-n N] [-p PIXELS] "
+         "FILE...\n");
+    puts("Runs the target detection on screen captures and reports the time");
+    puts("spent in each stage in milliseconds. FILE is either a PNG");
+    puts("screenshot or a capture dumped by wl-kbptr.\n");
+    puts(" -d, --detector=D    'opencv' or 'native' (default: opencv when");
+    puts("                     available)");
+    puts(" -n, --iterations=N  number of runs per file (default: 10)");
+    puts(" -p, --max-pixels=N  downsample captures to at most N pixels");
+    puts(" -h, --help          print this message and exit");
+}
+
+int main(int argc, char **argv) {
+    int      iterations = DEFAULT_ITERATIONS;
+    uint64_t max_pixels = 0;
+
+#if OPENCV_ENABLED
+    target_detector_t detector = compute_target_from_img_buffer;
+#else
+    target_detector_t detector = detect_targets_native;
+#endif
+
+    static struct option long_options[] = {
+        {"detector", required_argument, 0, 'd'},
+        {"iterations", required_argument, 0, 'n'},
+        {"max-pixels", required_argument, 0, 'p'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:n:p:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            detector = parse_detector(optarg);
+            if (detector == NULL) {
+                LOG_ERR("Invalid detector '%s'.", optarg);
+                return 1;
+            }
+            break;
+
+        case 'n':
+            iterations = atoi(optarg);
+            if (iterations <= 0) {
+                LOG_ERR("Invalid number of iterations '%s'.", optarg);
+                return 1;
+            }
+            break;
+
+        case 'p': {
+            char *end;
+            errno      = 0;
+            max_pixels = strtoull(optarg, &end, 10);
+            if (optarg[0] < '0' || optarg[0] > '9' || *end != '\0' ||
+                errno == ERANGE) {
+                LOG_ERR("Invalid maximum number of pixels '%s'.", optarg);
+                return 1;
+            }
+            break;
+        }
+
+        case 'h':
+            print_usage();
+            return 0;
+
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage();
+        return 1;
+    }
+
+    int err = 0;
+    for (int i = optind; i < argc; i++) {
+        err |= bench_file(argv[i], detector, iterations, max_pixels);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak RSS: %ld KiB\n", usage.ru_maxrss);
+
+    return err;
+}
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "capture_file.h"
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Captures larger than this are most likely corrupted headers.
+#define MAX_CAPTURE_SIZE (1024 * 1024 * 1024)
+
+/**
+ * `get_bytes_per_pixel` returns the size of a pixel for the formats the
+ * detectors can read, or 0 for other formats.
+ */
+static uint32_t get_bytes_per_pixel(enum wl_shm_format format) {
+    switch (format) {
+    case WL_SHM_FORMAT_RGB332:
+    case WL_SHM_FORMAT_BGR233:
+        return 1;
+    case WL_SHM_FORMAT_ARGB4444:
+    case WL_SHM_FORMAT_XRGB4444:
+    case WL_SHM_FORMAT_ABGR4444:
+    case WL_SHM_FORMAT_XBGR4444:
+    case WL_SHM_FORMAT_ARGB1555:
+    case WL_SHM_FORMAT_XRGB1555:
+    case WL_SHM_FORMAT_ABGR1555:
+    case WL_SHM_FORMAT_XBGR1555:
+    case WL_SHM_FORMAT_RGB565:
+    case WL_SHM_FORMAT_BGR565:
+        return 2;
+    case WL_SHM_FORMAT_RGB888:
+    case WL_SHM_FORMAT_BGR888:
+        return 3;
+    case WL_SHM_FORMAT_ARGB8888:
+    case WL_SHM_FORMAT_XRGB8888:
+    case WL_SHM_FORMAT_ABGR8888:
+    case WL_SHM_FORMAT_XBGR8888:
+    case WL_SHM_FORMAT_BGRA8888:
+    case WL_SHM_FORMAT_BGRX8888:
+    case WL_SHM_FORMAT_RGBA8888:
+    case WL_SHM_FORMAT_RGBX8888:
+    case WL_SHM_FORMAT_ARGB2101010:
+    case WL_SHM_FORMAT_ABGR2101010:
+    case WL_SHM_FORMAT_XRGB2101010:
+    case WL_SHM_FORMAT_XBGR2101010:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+int capture_file_write(const char *path, const struct capture_file *capture) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_ERR("Could not open '%s' for writing.", path);
+        return 1;
+    }
+
+    size_t size = (size_t)capture->stride * capture->height;
+
+    fprintf(
+        file,
+        CAPTURE_FILE_MAGIC
+        " format=0x%08x width=%u height=%u stride=%u transform=%d"
+        " area=%d,%d,%dx%d\n",
+        capture->format, capture->width, capture->height, capture->stride,
+        capture->transform, capture->area.x, capture->area.y, capture->area.w,
+        capture->area.h
+    );
+
+    if (fwrite(capture->data, 1, size, file) != size || fclose(file) != 0) {
+        LOG_ERR("Could not write capture to '%s'.", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+int capture_file_read(const char *path, struct capture_file *capture) {
+    memset(capture, 0, sizeof(*capture));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_ERR("Could not open '%s'.", path);
+        return 1;
+    }
+
+    const size_t magic_len = strlen(CAPTURE_FILE_MAGIC);
+
+    char     header[256];
+    unsigned format;
+    int      transform;
+    if (fgets(header, sizeof(header), file) == NULL ||
+        strncmp(header, CAPTURE_FILE_MAGIC, magic_len) ||
+        header[magic_len] != ' ') {
+        LOG_ERR("'%s' is not a capture file.", path);
+        goto error;
+    }
+
+    if (sscanf(
+            header + magic_len,
+            " format=%x width=%u height=%u stride=%u transform=%d"
+            " area=%d,%d,%dx%d",
+            &format, &capture->width, &capture->height, &capture->stride,
+            &transform, &capture->area.x, &capture->area.y, &capture->area.w,
+            &capture->area.h
+        ) != 9) {
+        LOG_ERR("Invalid capture file header in '%s'.", path);
+        goto error;
+    }
+
+    capture->format    = format;
+    capture->transform = transform;
+
+    const uint32_t bytes_per_pixel = get_bytes_per_pixel(capture->format);
+    if (bytes_per_pixel == 0) {
+        LOG_ERR("Unsupported capture format 0x%08x in '%s'.", format, path);
+        goto error;
+    }
+
+    if (transform < WL_OUTPUT_TRANSFORM_NORMAL ||
+        transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+        LOG_ERR("Invalid capture transform %d in '%s'.", transform, path);
+        goto error;
+    }
+
+    // Each row must hold the whole width, the detectors read it all.
+    if ((uint64_t)capture->width * bytes_per_pixel > capture->stride) {
+        LOG_ERR("Invalid capture stride in '%s'.", path);
+        goto error;
+    }
+
+    size_t size = (size_t)capture->stride * capture->height;
+    if (size == 0 || size > MAX_CAPTURE_SIZE || capture->width == 0 ||
+        capture->area.w <= 0 || capture->area.h <= 0) {
+        LOG_ERR("Invalid capture size in '%s'.", path);
+        goto error;
+    }
+
+    capture->data = malloc(size);
+    if (capture->data == NULL || fread(capture->data, 1, size, file) != size) {
+        LOG_ERR("Could not read capture data from '%s'.", path);
+        goto error;
+    }
+
+    fclose(file);
+    return 0;
+
+error:
+    fclose(file);
+    capture_file_free(capture);
+    return 1;
+}
+
+void capture_file_free(struct capture_file *capture) {
+    free(capture->data);
+    capture->data = NULL;
+}
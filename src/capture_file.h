@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __CAPTURE_FILE_H_INCLUDED__
+#define __CAPTURE_FILE_H_INCLUDED__
+
+#include "utils.h"
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+#define CAPTURE_FILE_MAGIC "wl-kbptr-capture v1"
+
+/**
+ * A `capture_file` is a raw screen capture with what's needed to run the
+ * target detection on it again. On disk, it's a single line header followed
+ * by `stride * height` bytes of pixel data.
+ */
+struct capture_file {
+    enum wl_shm_format       format;
+    uint32_t                 width;
+    uint32_t                 height;
+    uint32_t                 stride;
+    enum wl_output_transform transform;
+
+    // Area of the output the capture covers in logical coordinates.
+    struct rect area;
+
+    void *data;
+};
+
+/**
+ * `capture_file_write` writes `capture` to `path`. Returns 0 on success.
+ */
+int capture_file_write(const char *path, const struct capture_file *capture);
+
+/**
+ * `capture_file_read` loads the capture at `path`. The data must be released
+ * with `capture_file_free`. Returns 0 on success.
+ */
+int capture_file_read(const char *path, struct capture_file *capture);
+
+void capture_file_free(struct capture_file *capture);
+
+#endif
@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "components.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Label of the unset pixels connected to the frame's edges. They surround the
+// top-level components.
+#define LABEL_OUTER 0
+
+/**
+ * `label_set` holds the provisional labels given during the scan. Labels of
+ * the same component are merged with union-find, the smallest label being the
+ * root. Each label has the extents of the pixels it was given to, the
+ * horizontal position of the first one and the label of the pixel above it.
+ */
+struct label_set {
+    int32_t *parents;
+    int32_t *aboves;
+    int32_t *first_x;
+    int32_t *min_x;
+    int32_t *min_y;
+    int32_t *max_x;
+    int32_t *max_y;
+    int32_t  len;
+    int32_t  cap;
+};
+
+static int label_set_grow(struct label_set *set) {
+    int32_t cap = set->cap == 0 ? 1024 : set->cap * 2;
+
+    int32_t **arrays[] = {
+        &set->parents, &set->aboves, &set->first_x, &set->min_x,
+        &set->min_y,   &set->max_x,  &set->max_y,
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        int32_t *array = realloc(*arrays[i], sizeof(int32_t) * cap);
+        if (array == NULL) {
+            return 1;
+        }
+        *arrays[i] = array;
+    }
+
+    set->cap = cap;
+    return 0;
+}
+
+static void label_set_free(struct label_set *set) {
+    free(set->parents);
+    free(set->aboves);
+    free(set->first_x);
+    free(set->min_x);
+    free(set->min_y);
+    free(set->max_x);
+    free(set->max_y);
+}
+
+static int32_t new_label(struct label_set *set, int x, int y, int32_t above) {
+    if (set->len == set->cap && label_set_grow(set)) {
+        return -1;
+    }
+
+    int32_t label       = set->len++;
+    set->parents[label] = label;
+    set->aboves[label]  = above;
+    set->first_x[label] = x;
+    set->min_x[label]   = x;
+    set->min_y[label]   = y;
+    set->max_x[label]   = x;
+    set->max_y[label]   = y;
+    return label;
+}
+
+static int32_t find_root(struct label_set *set, int32_t label) {
+    while (set->parents[label] != label) {
+        set->parents[label] = set->parents[set->parents[label]];
+        label               = set->parents[label];
+    }
+
+    return label;
+}
+
+static int32_t merge(struct label_set *set, int32_t a, int32_t b) {
+    a = find_root(set, a);
+    b = find_root(set, b);
+
+    if (a < b) {
+        set->parents[b] = a;
+        return a;
+    }
+
+    set->parents[a] = b;
+    return b;
+}
+
+static void extend(struct label_set *set, int32_t label, int x, int y) {
+    if (x < set->min_x[label]) {
+        set->min_x[label] = x;
+    }
+    if (x > set->max_x[label]) {
+        set->max_x[label] = x;
+    }
+    set->max_y[label] = y;
+}
+
+/**
+ * `label_pixel` gives a label to the pixel at `x`, `y` from the labels of its
+ * previous neighbors. `prev` and `curr` are the labels of the previous and
+ * current rows. Returns -1 on error.
+ */
+static int32_t label_pixel(
+    struct label_set *set, const uint8_t *mask_prev, const uint8_t *mask_curr,
+    const int32_t *prev, const int32_t *curr, int x, int y, int width,
+    int height
+) {
+    const bool set_px = mask_curr[x] != 0;
+    int32_t    label  = -1;
+
+#define CONNECT(cond, neighbor)                                        \
+    if (cond) {                                                        \
+        label = label < 0 ? find_root(set, neighbor)                   \
+                          : merge(set, label, neighbor);               \
+    }
+
+    CONNECT(x > 0 && (mask_curr[x - 1] != 0) == set_px, curr[x - 1]);
+    if (y > 0) {
+        CONNECT((mask_prev[x] != 0) == set_px, prev[x]);
+        if (set_px) {
+            CONNECT(x > 0 && mask_prev[x - 1] != 0, prev[x - 1]);
+            CONNECT(x < width - 1 && mask_prev[x + 1] != 0, prev[x + 1]);
+        }
+    }
+
+    // Unset pixels on the frame's edges are connected to the outside.
+    if (!set_px && (x == 0 || y == 0 || x == width - 1 || y == height - 1)) {
+        CONNECT(true, LABEL_OUTER);
+    }
+
+#undef CONNECT
+
+    if (label < 0) {
+        return new_label(set, x, y, y > 0 ? prev[x] : LABEL_OUTER);
+    }
+
+    extend(set, label, x, y);
+    return label;
+}
+
+int find_components(
+    const uint8_t *mask, int width, int height, int stride,
+    struct component **components
+) {
+    *components = NULL;
+
+    struct label_set set    = {0};
+    int32_t         *prev   = malloc(sizeof(int32_t) * width);
+    int32_t         *curr   = malloc(sizeof(int32_t) * width);
+    int32_t         *ids    = NULL;
+    int              count  = 0;
+    bool             failed = prev == NULL || curr == NULL ||
+                  new_label(&set, 0, 0, LABEL_OUTER) != LABEL_OUTER;
+
+    // Only the labels of the previous row are needed while scanning. The
+    // extents are gathered on the way and merged with the roots afterwards.
+    for (int y = 0; y < height && !failed; y++) {
+        const uint8_t *mask_prev = y > 0 ? mask + (y - 1) * stride : NULL;
+        const uint8_t *mask_curr = mask + y * stride;
+
+        for (int x = 0; x < width; x++) {
+            curr[x] = label_pixel(
+                &set, mask_prev, mask_curr, prev, curr, x, y, width, height
+            );
+            if (curr[x] < 0) {
+                failed = true;
+                break;
+            }
+        }
+
+        int32_t *tmp = prev;
+        prev         = curr;
+        curr         = tmp;
+    }
+
+    if (!failed) {
+        ids    = malloc(sizeof(int32_t) * set.len);
+        failed = ids == NULL;
+    }
+
+    // Roots are the first labels of their components. Going through them in
+    // order puts each component after the one around it, whose first pixel
+    // is above its own.
+    for (int32_t label = 1; label < set.len && !failed; label++) {
+        int32_t root = find_root(&set, label);
+        if (root != label) {
+            ids[label] = -1;
+
+            if (set.min_x[label] < set.min_x[root]) {
+                set.min_x[root] = set.min_x[label];
+            }
+            if (set.max_x[label] > set.max_x[root]) {
+                set.max_x[root] = set.max_x[label];
+            }
+            if (set.max_y[label] > set.max_y[root]) {
+                set.max_y[root] = set.max_y[label];
+            }
+            continue;
+        }
+
+        ids[label] = count++;
+    }
+
+    if (!failed) {
+        *components = malloc(sizeof(struct component) * max(count, 1));
+        failed      = *components == NULL;
+    }
+
+    for (int32_t label = 1; label < set.len && !failed; label++) {
+        if (ids[label] < 0) {
+            continue;
+        }
+
+        struct component *comp = &(*components)[ids[label]];
+        int32_t           y    = set.min_y[label];
+        int32_t           root = find_root(&set, set.aboves[label]);
+
+        comp->hole   = mask[y * stride + set.first_x[label]] == 0;
+        comp->parent = root == LABEL_OUTER ? -1 : ids[root];
+        comp->box.x  = set.min_x[label];
+        comp->box.y  = y;
+        comp->box.w  = set.max_x[label] - set.min_x[label] + 1;
+        comp->box.h  = set.max_y[label] - y + 1;
+
+        // Like contours, holes are bounded by the set pixels around them.
+        if (comp->hole) {
+            comp->box.x -= 1;
+            comp->box.y -= 1;
+            comp->box.w += 2;
+            comp->box.h += 2;
+        }
+    }
+
+    free(prev);
+    free(curr);
+    free(ids);
+    label_set_free(&set);
+
+    if (failed) {
+        LOG_ERR("Could not allocate components.");
+        free(*components);
+        *components = NULL;
+        return -1;
+    }
+
+    return count;
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __COMPONENTS_H_INCLUDED__
+#define __COMPONENTS_H_INCLUDED__
+
+#ifdef __cplusplus
+#define EXTERNC extern "C"
+#else
+#define EXTERNC
+#endif
+
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A `component` is either a region of set pixels (8-connected) or a hole: a
+ * region of unset pixels (4-connected) enclosed by set pixels. They are what
+ * OpenCV's `findContours` finds with `RETR_TREE`: a hole's parent is the
+ * region around it and a region's parent is the hole it's in, if any.
+ */
+struct component {
+    struct rect box;
+    int         parent;
+    bool        hole;
+};
+
+/**
+ * `find_components` finds the components of `mask`, where non-zero pixels are
+ * set, and stores them in `components`. Parents come before their children.
+ * Only their extents are tracked, in a single scan with union-find. Returns
+ * the number of components or -1 on error.
+ */
+EXTERNC int find_components(
+    const uint8_t *mask, int width, int height, int stride,
+    struct component **components
+);
+
+#undef EXTERNC
+
+#endif
@@ -98,6 +98,32 @@ static int parse_uint8(void *dest, char *value) {
     return 0;
 }
 
+static int parse_bool(void *dest, char *value) {
+    if (strcmp(value, "true") == 0) {
+        *((bool *)dest) = true;
+    } else if (strcmp(value, "false") == 0) {
+        *((bool *)dest) = false;
+    } else {
+        LOG_ERR("Invalid value '%s'. Should be 'true' or 'false'.", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_surface_buffers(void *dest, char *value) {
+    int decoded = atoi(value);
+    if (decoded < 2 || decoded > MAX_SURFACE_BUFFERS) {
+        LOG_ERR(
+            "Value should be between 2 and %d (included).", MAX_SURFACE_BUFFERS
+        );
+        return 1;
+    }
+
+    *((uint8_t *)dest) = (uint8_t)decoded;
+    return 0;
+}
+
 static int parse_relative_font_size(void *dest, char *value) {
     struct relative_font_size *rfs = dest;
 
@@ -262,17 +288,120 @@ static int parse_floating_mode_source_value(void *dest, char *value) {
     if (strcmp(value, "stdin") == 0) {
         *out = FLOATING_MODE_SOURCE_STDIN;
     } else if (strcmp(value, "detect") == 0) {
-#if OPENCV_ENABLED
         *out = FLOATING_MODE_SOURCE_DETECT;
+    } else {
+        LOG_ERR("Invalid source '%s'. Should be 'stdin' or 'detect'.", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_stdin_format(void *dest, char *value) {
+    enum stdin_format *out = dest;
+    if (strcmp(value, "text") == 0) {
+        *out = STDIN_FORMAT_TEXT;
+    } else if (strcmp(value, "binary") == 0) {
+        *out = STDIN_FORMAT_BINARY;
+    } else {
+        LOG_ERR(
+            "Invalid stdin format '%s'. Should be 'text' or 'binary'.", value
+        );
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_floating_label_order(void *dest, char *value) {
+    enum floating_label_order *out = dest;
+    if (strcmp(value, "input") == 0) {
+        *out = FLOATING_LABEL_ORDER_INPUT;
+    } else if (strcmp(value, "hilbert") == 0) {
+        *out = FLOATING_LABEL_ORDER_HILBERT;
+    } else if (strcmp(value, "center") == 0) {
+        *out = FLOATING_LABEL_ORDER_CENTER;
+    } else {
+        LOG_ERR(
+            "Invalid label order '%s'. Should be 'input', 'hilbert' or "
+            "'center'.",
+            value
+        );
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_target_detector(void *dest, char *value) {
+    enum target_detector *out = dest;
+    if (strcmp(value, "opencv") == 0) {
+#if OPENCV_ENABLED
+        *out = TARGET_DETECTOR_OPENCV;
 #else
-        LOG_ERR("Binary not build with OpenCV. 'detect' source not supported.");
+        LOG_ERR("Binary not built with OpenCV support.");
         return 2;
 #endif
+    } else if (strcmp(value, "native") == 0) {
+        *out = TARGET_DETECTOR_NATIVE;
     } else {
-        LOG_ERR("Invalid source '%s'. Should be 'stdin' or 'detect'.", value);
+        LOG_ERR(
+            "Invalid detector '%s'. Should be 'opencv' or 'native'.", value
+        );
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_capture_buffer_type(void *dest, char *value) {
+    enum capture_buffer_type *out = dest;
+    if (strcmp(value, "auto") == 0) {
+        *out = CAPTURE_BUFFER_AUTO;
+    } else if (strcmp(value, "shm") == 0) {
+        *out = CAPTURE_BUFFER_SHM;
+    } else if (strcmp(value, "dmabuf") == 0) {
+        *out = CAPTURE_BUFFER_DMABUF;
+    } else {
+        LOG_ERR(
+            "Invalid capture buffer '%s'. Should be 'auto', 'shm' or 'dmabuf'.",
+            value
+        );
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_detect_resolution(void *dest, char *value) {
+    struct detect_resolution *out = dest;
+    out->max_pixels               = 0;
+
+    if (strcmp(value, "native") == 0) {
+        out->type = DETECT_RESOLUTION_NATIVE;
+        return 0;
+    }
+
+    if (strcmp(value, "logical") == 0) {
+        out->type = DETECT_RESOLUTION_LOGICAL;
+        return 0;
+    }
+
+    char              *end;
+    errno                      = 0;
+    unsigned long long decoded = strtoull(value, &end, 10);
+    if (value[0] < '0' || value[0] > '9' || *end != '\0' || decoded == 0 ||
+        errno == ERANGE) {
+        LOG_ERR(
+            "Invalid detect resolution '%s'. Should be 'native', 'logical' or "
+            "a maximum number of pixels.",
+            value
+        );
         return 1;
     }
 
+    out->type       = DETECT_RESOLUTION_MAX_PIXELS;
+    out->max_pixels = decoded;
     return 0;
 }
 
@@ -340,6 +469,12 @@ struct section_def {
         #name, offsetof(type, name), default_value, parse, free \
     }
 
+#if OPENCV_ENABLED
+#define DEFAULT_DETECTOR "opencv"
+#else
+#define DEFAULT_DETECTOR "native"
+#endif
+
 #define G_FIELD(name, default_value, parse, free) \
     FIELD(struct general_config, name, default_value, parse, free)
 #define MT_FIELD(name, default_value, parse, free) \
@@ -362,7 +497,8 @@ static struct section_def section_defs[] = {
         general,
         G_FIELD(home_row_keys, "", parse_home_row_keys, free_home_row_keys),
         G_FIELD(modes, "tile,bisect", parse_str, free_str),
-        G_FIELD(cancellation_status_code, "0", parse_uint8, noop)
+        G_FIELD(cancellation_status_code, "0", parse_uint8, noop),
+        G_FIELD(surface_buffers, "3", parse_surface_buffers, noop)
     ),
     SECTION(
         mode_tile, MT_FIELD(label_color, "#fffd", parse_color, noop),
@@ -379,6 +515,11 @@ static struct section_def section_defs[] = {
     SECTION(
         mode_floating,
         MF_FIELD(source, "stdin", parse_floating_mode_source_value, noop),
+        MF_FIELD(stdin_format, "text", parse_stdin_format, noop),
+        MF_FIELD(stdin_stream, "false", parse_bool, noop),
+        MF_FIELD(detector, DEFAULT_DETECTOR, parse_target_detector, noop),
+        MF_FIELD(capture_buffer, "auto", parse_capture_buffer_type, noop),
+        MF_FIELD(detect_resolution, "native", parse_detect_resolution, noop),
         MF_FIELD(label_color, "#fffd", parse_color, noop),
         MF_FIELD(label_select_color, "#fd0d", parse_color, noop),
         MF_FIELD(unselectable_bg_color, "#2226", parse_color, noop),
@@ -388,7 +529,8 @@ static struct section_def section_defs[] = {
         MF_FIELD(label_font_size, "12 50% 100", parse_relative_font_size, noop),
         MF_FIELD(
             label_symbols, "abcdefghijklmnopqrstuvwxyz", parse_str, free_str
-        )
+        ),
+        MF_FIELD(label_order, "input", parse_floating_label_order, noop)
     ),
     SECTION(
         mode_bisect, MB_FIELD(label_color, "#fffd", parse_color, noop),
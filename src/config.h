@@ -5,12 +5,14 @@
 
 #include "utils.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 struct general_config {
     char  **home_row_keys;
     char   *modes;
     uint8_t cancellation_status_code;
+    uint8_t surface_buffers;
 };
 
 struct relative_font_size {
@@ -35,8 +37,53 @@ enum floating_mode_source {
     FLOATING_MODE_SOURCE_DETECT,
 };
 
+// Format of the areas given on the standard input, see `area_input.h`.
+enum stdin_format {
+    STDIN_FORMAT_TEXT,
+    STDIN_FORMAT_BINARY,
+};
+
+// Order in which floating mode areas get their labels, the first ones getting
+// the shortest.
+enum floating_label_order {
+    FLOATING_LABEL_ORDER_INPUT,
+    FLOATING_LABEL_ORDER_HILBERT,
+    FLOATING_LABEL_ORDER_CENTER,
+};
+
+enum target_detector {
+    TARGET_DETECTOR_OPENCV,
+    TARGET_DETECTOR_NATIVE,
+};
+
+// Type of buffer the screen is captured into. `auto` prefers a dmabuf when
+// the compositor and the kernel support it.
+enum capture_buffer_type {
+    CAPTURE_BUFFER_AUTO,
+    CAPTURE_BUFFER_SHM,
+    CAPTURE_BUFFER_DMABUF,
+};
+
+enum detect_resolution_type {
+    DETECT_RESOLUTION_NATIVE,
+    DETECT_RESOLUTION_LOGICAL,
+    DETECT_RESOLUTION_MAX_PIXELS,
+};
+
+// Resolution the target detection runs at. Captures with more pixels are
+// downsampled first.
+struct detect_resolution {
+    enum detect_resolution_type type;
+    uint64_t                    max_pixels;
+};
+
 struct mode_floating_config {
     enum floating_mode_source source;
+    enum stdin_format         stdin_format;
+    bool                      stdin_stream;
+    enum target_detector      detector;
+    enum capture_buffer_type  capture_buffer;
+    struct detect_resolution  detect_resolution;
     uint32_t                  label_color;
     uint32_t                  label_select_color;
     uint32_t                  unselectable_bg_color;
@@ -45,6 +92,7 @@ struct mode_floating_config {
     char                     *label_font_family;
     struct relative_font_size label_font_size;
     char                     *label_symbols;
+    enum floating_label_order label_order;
 };
 
 struct mode_bisect_config {
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "daemon.h"
+
+#include "log.h"
+#include "rect_parse.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define REQUEST_BUF_LEN  1024
+#define RESPONSE_BUF_LEN (DAEMON_MAX_RESULT_LEN + 16)
+
+// Clients that don't send their request within this delay are dropped so that
+// they can't block the daemon.
+#define CLIENT_TIMEOUT_SEC 1
+
+static volatile sig_atomic_t should_stop = 0;
+
+static void handle_stop_signal(int signal) {
+    should_stop = 1;
+}
+
+void daemon_handle_signals(void) {
+    struct sigaction action = {.sa_handler = handle_stop_signal};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+}
+
+bool daemon_should_stop(void) {
+    return should_stop;
+}
+
+void daemon_request_free(struct daemon_request *request) {
+    free(request->output_name);
+    request->output_name = NULL;
+}
+
+/**
+ * `get_socket_address` sets the socket path. There is one socket per Wayland
+ * display: `$XDG_RUNTIME_DIR/wl-kbptr-$WAYLAND_DISPLAY.sock`.
+ */
+static int get_socket_address(struct sockaddr_un *addr) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL) {
+        LOG_ERR("XDG_RUNTIME_DIR is not set.");
+        return 1;
+    }
+
+    const char *display = getenv("WAYLAND_DISPLAY");
+    if (display == NULL) {
+        display = "wayland-0";
+    }
+
+    const char *display_basename = strrchr(display, '/');
+    if (display_basename != NULL) {
+        display = display_basename + 1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int len          = snprintf(
+        addr->sun_path, sizeof(addr->sun_path), "%s/wl-kbptr-%s.sock",
+        runtime_dir, display
+    );
+    if (len < 0 || len >= sizeof(addr->sun_path)) {
+        LOG_ERR("Socket path is too long.");
+        return 1;
+    }
+
+    return 0;
+}
+
+int daemon_listen(void) {
+    struct sockaddr_un addr;
+    if (get_socket_address(&addr)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERR("Could not create socket.");
+        return -1;
+    }
+
+    // A left over socket either belongs to a running daemon or to one that
+    // didn't exit properly.
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        LOG_ERR("A daemon is already listening on '%s'.", addr.sun_path);
+        close(fd);
+        return -1;
+    }
+    unlink(addr.sun_path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        LOG_ERR("Could not bind socket '%s'.", addr.sun_path);
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, 4) != 0) {
+        LOG_ERR("Could not listen on socket '%s'.", addr.sun_path);
+        close(fd);
+        unlink(addr.sun_path);
+        return -1;
+    }
+
+    LOG_INFO("Listening on '%s'.", addr.sun_path);
+    return fd;
+}
+
+void daemon_close(int listen_fd) {
+    struct sockaddr_un addr;
+    if (get_socket_address(&addr) == 0) {
+        unlink(addr.sun_path);
+    }
+
+    close(listen_fd);
+}
+
+static int parse_request_line(struct daemon_request *request, char *line) {
+    char *value = strchr(line, '=');
+    if (value != NULL) {
+        *(value++) = '\0';
+    }
+
+    if (strcmp(line, "only-print") == 0) {
+        request->only_print = true;
+    } else if (value == NULL) {
+        LOG_ERR("Invalid request line '%s'.", line);
+        return 1;
+    } else if (strcmp(line, "restrict") == 0) {
+        if (rect_parse_str(value, &request->initial_area)) {
+            LOG_ERR("Invalid area '%s' in request.", value);
+            return 1;
+        }
+    } else if (strcmp(line, "output") == 0) {
+        free(request->output_name);
+        request->output_name = strdup(value);
+    } else {
+        LOG_ERR("Unknown request field '%s'.", line);
+        return 1;
+    }
+
+    return 0;
+}
+
+int daemon_accept_request(int listen_fd, struct daemon_request *request) {
+    *request = (struct daemon_request){
+        .initial_area = (struct rect){-1, -1, -1, -1},
+        .output_name  = NULL,
+        .only_print   = false,
+    };
+
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERR("Could not accept connection.");
+        return -1;
+    }
+
+    struct timeval timeout = {.tv_sec = CLIENT_TIMEOUT_SEC};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // The request is a list of `key=value` lines. The client shuts down its
+    // writing side once it's sent.
+    char    buf[REQUEST_BUF_LEN];
+    size_t  len = 0;
+    ssize_t n;
+    while (len < sizeof(buf) - 1 &&
+           (n = read(fd, buf + len, sizeof(buf) - 1 - len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG_ERR("Could not read request.");
+            close(fd);
+            return -1;
+        }
+
+        len += n;
+    }
+    buf[len] = '\0';
+
+    char *strtok_p;
+    for (char *line = strtok_r(buf, "\n", &strtok_p); line != NULL;
+         line       = strtok_r(NULL, "\n", &strtok_p)) {
+        if (parse_request_line(request, line)) {
+            daemon_send_response(fd, 1, "");
+            daemon_request_free(request);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+void daemon_send_response(int client_fd, int status, const char *result) {
+    char buf[RESPONSE_BUF_LEN];
+    int  len = snprintf(buf, sizeof(buf), "%d\n%s", status, result);
+
+    if (write_all(client_fd, buf, min(len, sizeof(buf) - 1))) {
+        LOG_WARN("Could not send response to client.");
+    }
+
+    close(client_fd);
+}
+
+int daemon_trigger(struct daemon_request *request) {
+    struct sockaddr_un addr;
+    if (get_socket_address(&addr)) {
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERR("Could not create socket.");
+        return 1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        LOG_ERR("Could not connect to daemon on '%s'.", addr.sun_path);
+        close(fd);
+        return 1;
+    }
+
+    char  *buf = NULL;
+    size_t len = 0;
+    FILE  *f   = open_memstream(&buf, &len);
+    if (request->initial_area.w != -1) {
+        fprintf(
+            f, "restrict=%dx%d+%d+%d\n", request->initial_area.w,
+            request->initial_area.h, request->initial_area.x,
+            request->initial_area.y
+        );
+    }
+    if (request->output_name != NULL) {
+        fprintf(f, "output=%s\n", request->output_name);
+    }
+    if (request->only_print) {
+        fputs("only-print\n", f);
+    }
+    fclose(f);
+
+    if (len >= REQUEST_BUF_LEN) {
+        LOG_ERR("Request is too long.");
+        free(buf);
+        close(fd);
+        return 1;
+    }
+
+    int err = write_all(fd, buf, len);
+    free(buf);
+    if (err) {
+        LOG_ERR("Could not send request to daemon.");
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // The daemon replies once the selection is done which can take as long as
+    // the user wants.
+    char    response[RESPONSE_BUF_LEN];
+    size_t  response_len = 0;
+    ssize_t n;
+    while (response_len < sizeof(response) - 1 &&
+           (n = read(
+                fd, response + response_len,
+                sizeof(response) - 1 - response_len
+            )) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG_ERR("Could not read response from daemon.");
+            close(fd);
+            return 1;
+        }
+
+        response_len += n;
+    }
+    response[response_len] = '\0';
+    close(fd);
+
+    char *result;
+    long  status = strtol(response, &result, 10);
+    if (result == response || *result != '\n') {
+        LOG_ERR("Invalid response from daemon.");
+        return 1;
+    }
+
+    fputs(result + 1, stdout);
+    return status;
+}
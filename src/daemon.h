@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __DAEMON_H_INCLUDED__
+#define __DAEMON_H_INCLUDED__
+
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DAEMON_MAX_RESULT_LEN 128
+
+/**
+ * A `daemon_request` holds the per-invocation parameters sent by
+ * `wl-kbptr --trigger` to the daemon.
+ */
+struct daemon_request {
+    struct rect initial_area; // `w` is -1 when not restricted.
+    char       *output_name;  // NULL when not set.
+    bool        only_print;
+};
+
+void daemon_request_free(struct daemon_request *request);
+
+/**
+ * `daemon_listen` creates the daemon's control socket. Returns the listening
+ * socket or -1 upon error.
+ */
+int daemon_listen(void);
+
+/**
+ * `daemon_close` closes the listening socket and removes it from the file
+ * system.
+ */
+void daemon_close(int listen_fd);
+
+/**
+ * `daemon_accept_request` accepts a client connection and reads its request.
+ * Returns the client socket or -1 upon error.
+ */
+int daemon_accept_request(int listen_fd, struct daemon_request *request);
+
+/**
+ * `daemon_send_response` sends the status code and the result line (which can
+ * be empty) to the client and closes the connection.
+ */
+void daemon_send_response(int client_fd, int status, const char *result);
+
+/**
+ * `daemon_trigger` sends the request to the running daemon, prints the result
+ * and returns the status code to exit with.
+ */
+int daemon_trigger(struct daemon_request *request);
+
+/**
+ * `daemon_handle_signals` makes SIGINT and SIGTERM stop the daemon gracefully.
+ */
+void daemon_handle_signals(void);
+
+bool daemon_should_stop(void);
+
+#endif
@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "detection_cache.h"
+
+#include "grayscale.h"
+#include "log.h"
+#include "target_filter.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tiles are about this many logical pixels high. Smaller tiles are re-detected
+// more precisely but their margins are processed more times.
+#define TILE_HEIGHT 256
+
+// Targets are at most 50 logical pixels high. They must fit in the margins
+// around tiles to be found the same way as when the whole frame is processed.
+#define TILE_MARGIN 52
+
+// Bytes per pixel of the formats read directly. Other formats are only split
+// in whole rows.
+#define BYTES_PER_PIXEL 4
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+static uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static uint64_t hash_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= hash_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * `hash64` is XXH64. Chaining calls through `seed` hashes discontiguous data.
+ */
+static uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p   = data;
+    const uint8_t *end = p + len;
+    uint64_t       h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        for (; p + 32 <= end; p += 32) {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+        }
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge_round(h, v1);
+        h = hash_merge_round(h, v2);
+        h = hash_merge_round(h, v3);
+        h = hash_merge_round(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void clear_tiles(struct detection_cache *cache) {
+    for (int i = 0; i < cache->num_tiles; i++) {
+        free(cache->tiles[i].targets);
+    }
+
+    free(cache->tiles);
+    cache->tiles     = NULL;
+    cache->num_tiles = 0;
+}
+
+/**
+ * A `tile` is a band of the capture. Targets are searched between `ext_start`
+ * and `ext_end` but only the ones starting between `start` and `end` belong to
+ * the tile. These are in logical pixels from the top of the area.
+ */
+struct tile {
+    int start;
+    int end;
+    int ext_start;
+    int ext_end;
+};
+
+/**
+ * A `tile_buffer` is the part of the capture a tile is detected on. `start`
+ * and `end` are its bounds in the buffer along the displayed vertical axis.
+ */
+struct tile_buffer {
+    uint32_t    start;
+    uint32_t    end;
+    uint8_t    *data;
+    uint32_t    width;
+    uint32_t    height;
+    struct rect area;
+    uint32_t    cut_edges;
+};
+
+// Whether the displayed vertical axis goes backward in the buffer.
+static bool is_transform_reversed(enum wl_output_transform transform) {
+    return transform & WL_OUTPUT_TRANSFORM_180;
+}
+
+static struct tile_buffer get_tile_buffer(
+    const struct detection_cache *cache, uint8_t *data, const struct tile *tile
+) {
+    const bool     rotated = is_transform_rotated(cache->transform);
+    const uint32_t len     = rotated ? cache->width : cache->height;
+    const double   scale   = (double)len / cache->area.h;
+
+    uint32_t start = fmin(round(tile->ext_start * scale), len);
+    uint32_t end   = fmin(round(tile->ext_end * scale), len);
+    if (is_transform_reversed(cache->transform)) {
+        uint32_t tmp = start;
+        start        = len - end;
+        end          = len - tmp;
+    }
+
+    struct tile_buffer buf = {
+        .start  = start,
+        .end    = end,
+        .data   = data,
+        .width  = cache->width,
+        .height = cache->height,
+        .area   = cache->area,
+    };
+    buf.area.y += tile->ext_start;
+    buf.area.h = tile->ext_end - tile->ext_start;
+
+    if (rotated) {
+        buf.data += start * BYTES_PER_PIXEL;
+        buf.width = end - start;
+        buf.cut_edges |= start > 0 ? DETECTION_EDGE_LEFT : 0;
+        buf.cut_edges |= end < len ? DETECTION_EDGE_RIGHT : 0;
+    } else {
+        buf.data += (size_t)start * cache->stride;
+        buf.height = end - start;
+        buf.cut_edges |= start > 0 ? DETECTION_EDGE_TOP : 0;
+        buf.cut_edges |= end < len ? DETECTION_EDGE_BOTTOM : 0;
+    }
+
+    return buf;
+}
+
+static uint64_t hash_tile_buffer(
+    const struct detection_cache *cache, const struct tile_buffer *buf
+) {
+    if (!is_transform_rotated(cache->transform)) {
+        return hash64(buf->data, (size_t)buf->height * cache->stride, 0);
+    }
+
+    uint64_t h = 0;
+    for (uint32_t y = 0; y < buf->height; y++) {
+        h = hash64(
+            buf->data + (size_t)y * cache->stride,
+            buf->width * BYTES_PER_PIXEL, h
+        );
+    }
+
+    return h;
+}
+
+static bool is_tile_damaged(
+    const struct detection_cache *cache, const struct tile_buffer *buf
+) {
+    const bool rotated = is_transform_rotated(cache->transform);
+
+    for (int i = 0; i < cache->num_damage; i++) {
+        const struct rect *damage = &cache->damage[i];
+        const int start = rotated ? damage->x : damage->y;
+        const int end   = start + (rotated ? damage->w : damage->h);
+
+        if (start < (int)buf->end && end > (int)buf->start) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void clear_damage(struct detection_cache *cache) {
+    free(cache->damage);
+    cache->damage     = NULL;
+    cache->num_damage = 0;
+    cache->has_damage = false;
+}
+
+/**
+ * `detect_tile` runs the detector on a tile and keeps the targets that belong
+ * to it. Components cut by the tile's margins are partial and left out by the
+ * detector. The full ones are found by the neighboring tiles.
+ */
+static void detect_tile(
+    const struct detection_cache *cache, const struct tile *tile,
+    const struct tile_buffer *buf, struct detection_cache_tile *cached
+) {
+    struct rect *areas     = NULL;
+    int          num_areas = cache->detector(
+        buf->data, buf->height, buf->width, cache->stride, cache->format,
+        cache->transform, buf->area, buf->cut_edges, 0, &areas, NULL
+    );
+
+    const int top = cache->area.y;
+
+    cached->targets     = malloc(sizeof(struct rect) * max(num_areas, 1));
+    cached->num_targets = 0;
+    for (int i = 0; i < num_areas; i++) {
+        const struct rect *area  = &areas[i];
+        const int          start = area->y - top;
+
+        if (start >= tile->start && start < tile->end) {
+            cached->targets[cached->num_targets++] = *area;
+        }
+    }
+
+    free(areas);
+}
+
+static bool has_same_parameters(
+    const struct detection_cache *cache, target_detector_t detector,
+    uint32_t height, uint32_t width, uint32_t stride, enum wl_shm_format format,
+    enum wl_output_transform transform, struct rect area, uint64_t max_pixels
+) {
+    return cache->detector == detector && cache->height == height &&
+           cache->width == width && cache->stride == stride &&
+           cache->format == format && cache->transform == transform &&
+           cache->area.x == area.x && cache->area.y == area.y &&
+           cache->area.w == area.w && cache->area.h == area.h &&
+           cache->max_pixels == max_pixels;
+}
+
+int detection_cache_detect(
+    struct detection_cache *cache, target_detector_t detector, void *data,
+    uint32_t height, uint32_t width, uint32_t stride, enum wl_shm_format format,
+    enum wl_output_transform transform, struct rect area, uint64_t max_pixels,
+    struct rect **areas
+) {
+    if (!has_same_parameters(
+            cache, detector, height, width, stride, format, transform, area,
+            max_pixels
+        )) {
+        clear_tiles(cache);
+        cache->detector   = detector;
+        cache->height     = height;
+        cache->width      = width;
+        cache->stride     = stride;
+        cache->format     = format;
+        cache->transform  = transform;
+        cache->area       = area;
+        cache->max_pixels = max_pixels;
+    }
+
+    // Downsampling depends on how the pixel blocks fall on the capture which
+    // would change once it's cut in tiles.
+    if (max_pixels != 0 && (uint64_t)width * height > max_pixels) {
+        clear_tiles(cache);
+        clear_damage(cache);
+        return detector(
+            data, height, width, stride, format, transform, area, 0,
+            max_pixels, areas, NULL
+        );
+    }
+
+    // Columns of a rotated buffer can only be cut with a known pixel size.
+    int num_tiles = max(area.h / TILE_HEIGHT, 1);
+    if (is_transform_rotated(transform) &&
+        !grayscale_is_format_supported(format)) {
+        num_tiles = 1;
+    }
+
+    if (cache->tiles == NULL) {
+        cache->tiles     = calloc(num_tiles, sizeof(*cache->tiles));
+        cache->num_tiles = num_tiles;
+    }
+
+    int num_detected = 0;
+    int num_areas    = 0;
+    for (int i = 0; i < num_tiles; i++) {
+        struct tile tile = {
+            .start = (int64_t)area.h * i / num_tiles,
+            .end   = (int64_t)area.h * (i + 1) / num_tiles,
+        };
+        tile.ext_start = max(tile.start - TILE_MARGIN, 0);
+        tile.ext_end   = min(tile.end + TILE_MARGIN, area.h);
+
+        struct tile_buffer buf    = get_tile_buffer(cache, data, &tile);
+        struct detection_cache_tile *cached = &cache->tiles[i];
+
+        // Undamaged tiles have the same content and hash as before.
+        if (cached->targets != NULL && cache->has_damage &&
+            !is_tile_damaged(cache, &buf)) {
+            num_areas += cached->num_targets;
+            continue;
+        }
+
+        uint64_t hash = hash_tile_buffer(cache, &buf);
+        if (cached->targets == NULL || cached->hash != hash) {
+            free(cached->targets);
+            detect_tile(cache, &tile, &buf, cached);
+            cached->hash = hash;
+            num_detected++;
+        }
+
+        num_areas += cached->num_targets;
+    }
+
+    LOG_DEBUG("Detected targets in %d of %d tiles.", num_detected, num_tiles);
+    clear_damage(cache);
+
+    *areas   = malloc(sizeof(struct rect) * max(num_areas, 1));
+    int next = 0;
+    for (int i = 0; i < num_tiles; i++) {
+        struct detection_cache_tile *cached = &cache->tiles[i];
+        memcpy(
+            *areas + next, cached->targets,
+            sizeof(struct rect) * cached->num_targets
+        );
+        next += cached->num_targets;
+    }
+
+    return num_areas;
+}
+
+void detection_cache_set_damage(
+    struct detection_cache *cache, const struct rect *damage, int num_damage
+) {
+    clear_damage(cache);
+
+    // Without the damage, all tiles are hashed.
+    cache->damage = malloc(sizeof(struct rect) * max(num_damage, 1));
+    if (cache->damage == NULL) {
+        LOG_ERR("Could not allocate damage.");
+        return;
+    }
+
+    memcpy(cache->damage, damage, sizeof(struct rect) * num_damage);
+    cache->num_damage = num_damage;
+    cache->has_damage = true;
+}
+
+void detection_cache_finish(struct detection_cache *cache) {
+    clear_tiles(cache);
+    clear_damage(cache);
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __DETECTION_CACHE_H_INCLUDED__
+#define __DETECTION_CACHE_H_INCLUDED__
+
+#include "target_detection.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct detection_cache_tile {
+    uint64_t     hash;
+    struct rect *targets;
+    int          num_targets;
+};
+
+/**
+ * A `detection_cache` keeps the targets found in each tile of the last
+ * capture along with a hash of the tile's content. The tiles are bands along
+ * the displayed vertical axis.
+ */
+struct detection_cache {
+    // What the tiles were detected with. Any change invalidates them.
+    target_detector_t        detector;
+    enum wl_shm_format       format;
+    enum wl_output_transform transform;
+    uint32_t                 width;
+    uint32_t                 height;
+    uint32_t                 stride;
+    struct rect              area;
+    uint64_t                 max_pixels;
+
+    struct detection_cache_tile *tiles;
+    int                          num_tiles;
+
+    // Parts of the next capture that may differ from the previous one, if
+    // known. See `detection_cache_set_damage`.
+    struct rect *damage;
+    int          num_damage;
+    bool         has_damage;
+};
+
+/**
+ * `detection_cache_detect` finds the targets in a capture like `detector`
+ * does but only runs it on the tiles whose content changed since the previous
+ * call. Captures that are downsampled are always detected as a whole.
+ * Returns the number of targets stored in `areas`.
+ */
+int detection_cache_detect(
+    struct detection_cache *cache, target_detector_t detector, void *data,
+    uint32_t height, uint32_t width, uint32_t stride, enum wl_shm_format format,
+    enum wl_output_transform transform, struct rect area, uint64_t max_pixels,
+    struct rect **areas
+);
+
+/**
+ * `detection_cache_set_damage` tells which regions of the next capture, in
+ * buffer coordinates, may have changed since the previous one. Tiles outside
+ * of them are reused without being hashed. This only applies to the next call
+ * to `detection_cache_detect`.
+ */
+void detection_cache_set_damage(
+    struct detection_cache *cache, const struct rect *damage, int num_damage
+);
+
+void detection_cache_finish(struct detection_cache *cache);
+
+#endif
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "detection_watch.h"
+
+#include "event_loop.h"
+#include "log.h"
+#include "state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Minimum time between the end of a detection and the next capture.
+#define CAPTURE_INTERVAL_MS 250
+
+static void request_capture(struct detection_watch *watch);
+
+int detection_watch_init(
+    struct detection_watch *watch, struct state *state,
+    struct detection_cache *cache
+) {
+    *watch = (struct detection_watch){
+        .state    = state,
+        .cache    = cache,
+        .done_fds = {-1, -1},
+    };
+
+    watch->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (watch->timer_fd < 0) {
+        LOG_ERR("Could not create detection watch timer.");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void set_targets(
+    struct detection_watch *watch, struct rect *targets, int num_targets
+) {
+    free(watch->targets);
+    watch->targets     = targets;
+    watch->num_targets = num_targets;
+}
+
+void detection_watch_set(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels
+) {
+    watch->output     = output;
+    watch->region     = region;
+    watch->detector   = detector;
+    watch->max_pixels = max_pixels;
+    watch->fresh      = false;
+    set_targets(watch, NULL, 0);
+}
+
+static void handle_timer(struct state *state, int fd, void *data) {
+    struct detection_watch *watch = data;
+
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {
+    }
+
+    event_loop_remove_fd(state, fd);
+    watch->timer_armed = false;
+    request_capture(watch);
+}
+
+static void arm_timer(struct detection_watch *watch) {
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec  = CAPTURE_INTERVAL_MS / 1000,
+            .tv_nsec = CAPTURE_INTERVAL_MS % 1000 * 1000000,
+        },
+    };
+
+    if (timerfd_settime(watch->timer_fd, 0, &spec, NULL) != 0 ||
+        event_loop_add_fd(watch->state, watch->timer_fd, handle_timer, watch)) {
+        LOG_WARN("Could not delay capture, capturing right away.");
+        request_capture(watch);
+        return;
+    }
+
+    watch->timer_armed = true;
+}
+
+static void disarm_timer(struct detection_watch *watch) {
+    if (!watch->timer_armed) {
+        return;
+    }
+
+    struct itimerspec spec = {0};
+    timerfd_settime(watch->timer_fd, 0, &spec, NULL);
+    event_loop_remove_fd(watch->state, watch->timer_fd);
+    watch->timer_armed = false;
+}
+
+static void *run_detection(void *data) {
+    struct detection_watch *watch  = data;
+    struct scrcpy_buffer   *buffer = watch->buffer;
+
+    watch->detected     = NULL;
+    watch->num_detected = detection_cache_detect(
+        watch->cache, watch->detector, buffer->data, buffer->height,
+        buffer->width, buffer->stride, buffer->format, watch->transform,
+        watch->region, watch->max_pixels, &watch->detected
+    );
+
+    char c = 0;
+    while (write(watch->done_fds[1], &c, 1) < 0 && errno == EINTR) {}
+
+    return NULL;
+}
+
+/**
+ * `finish_detection` waits for the detection to be done and releases what it
+ * used.
+ */
+static void finish_detection(struct detection_watch *watch) {
+    event_loop_remove_fd(watch->state, watch->done_fds[0]);
+    if (watch->threaded) {
+        pthread_join(watch->thread, NULL);
+    }
+
+    close(watch->done_fds[0]);
+    close(watch->done_fds[1]);
+    watch->done_fds[0] = -1;
+    watch->done_fds[1] = -1;
+
+    destroy_scrcpy_buffer(watch->buffer);
+    watch->buffer    = NULL;
+    watch->detecting = false;
+}
+
+static void handle_detection_done(struct state *state, int fd, void *data) {
+    struct detection_watch *watch = data;
+
+    finish_detection(watch);
+    set_targets(watch, watch->detected, watch->num_detected);
+    watch->targets_transform = watch->transform;
+    watch->detected          = NULL;
+
+    arm_timer(watch);
+}
+
+static void handle_capture_done(
+    struct state *state, struct scrcpy_buffer *buffer, void *data
+) {
+    struct detection_watch *watch = data;
+    watch->capture                = NULL;
+    watch->fresh                  = false;
+
+    if (buffer == NULL) {
+        LOG_WARN("Could not capture watched region, stopped watching it.");
+        return;
+    }
+
+    LOG_DEBUG("Watched region damaged in %d places.", buffer->num_damage);
+
+    if (pipe2(watch->done_fds, O_CLOEXEC) != 0) {
+        LOG_ERR("Could not create detection pipe.");
+        destroy_scrcpy_buffer(buffer);
+        return;
+    }
+
+    detection_cache_set_damage(
+        watch->cache, buffer->damage, buffer->num_damage
+    );
+
+    watch->buffer    = buffer;
+    watch->transform = watch->output->transform;
+    watch->detecting = true;
+    watch->threaded =
+        pthread_create(&watch->thread, NULL, run_detection, watch) == 0;
+    if (!watch->threaded) {
+        run_detection(watch);
+    }
+
+    if (event_loop_add_fd(
+            state, watch->done_fds[0], handle_detection_done, watch
+        )) {
+        LOG_ERR("Could not wait for detection, stopped watching region.");
+
+        // Nothing would ever pick up the targets nor request the next capture.
+        finish_detection(watch);
+        free(watch->detected);
+        watch->detected = NULL;
+    }
+}
+
+static void request_capture(struct detection_watch *watch) {
+    watch->capture = request_screenshot_on_damage(
+        watch->state, watch->output, watch->region
+    );
+    if (watch->capture == NULL) {
+        LOG_WARN("Could not capture watched region, stopped watching it.");
+        watch->fresh = false;
+        return;
+    }
+
+    scrcpy_request_set_handler(watch->capture, handle_capture_done, watch);
+
+    // The region hasn't changed since the last capture as long as the
+    // compositor has nothing to copy, give or take a frame.
+    watch->fresh = watch->targets != NULL;
+}
+
+void detection_watch_start(struct detection_watch *watch) {
+    if (watch->output == NULL || watch->capture != NULL ||
+        watch->detecting || watch->timer_armed) {
+        return;
+    }
+
+    request_capture(watch);
+}
+
+void detection_watch_stop(struct detection_watch *watch) {
+    if (watch->capture != NULL) {
+        cancel_screenshot(watch->capture);
+        watch->capture = NULL;
+    } else {
+        watch->fresh = false;
+    }
+
+    disarm_timer(watch);
+
+    // The detection can't be interrupted. Its targets may already be stale
+    // but they still save the next detection some work through the cache.
+    if (watch->detecting) {
+        finish_detection(watch);
+        set_targets(watch, watch->detected, watch->num_detected);
+        watch->targets_transform = watch->transform;
+        watch->detected          = NULL;
+    }
+}
+
+bool detection_watch_has_targets(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels
+) {
+    return watch->fresh && watch->output == output &&
+           watch->detector == detector && watch->max_pixels == max_pixels &&
+           watch->targets_transform == output->transform &&
+           memcmp(&watch->region, &region, sizeof(region)) == 0;
+}
+
+int detection_watch_get_targets(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels, struct rect **areas
+) {
+    if (!detection_watch_has_targets(
+            watch, output, region, detector, max_pixels
+        )) {
+        return -1;
+    }
+
+    *areas = malloc(sizeof(struct rect) * max(watch->num_targets, 1));
+    memcpy(*areas, watch->targets, sizeof(struct rect) * watch->num_targets);
+    return watch->num_targets;
+}
+
+void detection_watch_remove_output(
+    struct detection_watch *watch, struct output *output
+) {
+    if (watch->output != output) {
+        return;
+    }
+
+    detection_watch_stop(watch);
+    detection_watch_set(watch, NULL, (struct rect){0}, NULL, 0);
+}
+
+void detection_watch_finish(struct detection_watch *watch) {
+    detection_watch_stop(watch);
+    set_targets(watch, NULL, 0);
+    close(watch->timer_fd);
+}
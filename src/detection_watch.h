@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __DETECTION_WATCH_H_INCLUDED__
+#define __DETECTION_WATCH_H_INCLUDED__
+
+#include "detection_cache.h"
+#include "screencopy.h"
+#include "target_detection.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct state;
+struct output;
+
+/**
+ * A `detection_watch` keeps the targets of a captured region up to date while
+ * the daemon waits for triggers. The region is captured again whenever the
+ * compositor reports damage on it and only the damaged tiles of the detection
+ * cache are detected again. Watching stops while a selection is shown since
+ * the overlay damages the screen itself.
+ */
+struct detection_watch {
+    struct state           *state;
+    struct detection_cache *cache;
+
+    // What is watched, as last detected by the floating mode.
+    struct output    *output;
+    struct rect       region;
+    target_detector_t detector;
+    uint64_t          max_pixels;
+
+    // The next capture, which is only done once the region is damaged.
+    struct scrcpy_request *capture;
+
+    // Captures are delayed after a detection so that constantly changing
+    // content doesn't keep the detection running.
+    int  timer_fd;
+    bool timer_armed;
+
+    // Detection of the last damaged capture, run on a worker thread.
+    struct scrcpy_buffer    *buffer;
+    enum wl_output_transform transform;
+    pthread_t                thread;
+    bool                     threaded;
+    bool                     detecting;
+    int                      done_fds[2];
+    struct rect             *detected;
+    int                      num_detected;
+
+    // Targets of the last capture. They are `fresh` while a capture waits for
+    // damage: the region hasn't changed since.
+    struct rect             *targets;
+    int                      num_targets;
+    enum wl_output_transform targets_transform;
+    bool                     fresh;
+};
+
+/**
+ * `detection_watch_init` prepares a watch that doesn't watch anything yet.
+ * Returns 0 on success.
+ */
+int detection_watch_init(
+    struct detection_watch *watch, struct state *state,
+    struct detection_cache *cache
+);
+
+/**
+ * `detection_watch_set` sets the region to watch once started.
+ */
+void detection_watch_set(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels
+);
+
+/**
+ * `detection_watch_start` waits for the watched region to be damaged, if any.
+ */
+void detection_watch_start(struct detection_watch *watch);
+
+/**
+ * `detection_watch_stop` stops watching. Targets stay fresh if nothing was
+ * damaged since they were detected.
+ */
+void detection_watch_stop(struct detection_watch *watch);
+
+/**
+ * `detection_watch_has_targets` tells whether the targets are fresh and were
+ * detected the same way as asked.
+ */
+bool detection_watch_has_targets(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels
+);
+
+/**
+ * `detection_watch_get_targets` copies the targets to `areas` if
+ * `detection_watch_has_targets`. Returns their number or -1.
+ */
+int detection_watch_get_targets(
+    struct detection_watch *watch, struct output *output, struct rect region,
+    target_detector_t detector, uint64_t max_pixels, struct rect **areas
+);
+
+/**
+ * `detection_watch_remove_output` stops watching `output` as it's gone.
+ */
+void detection_watch_remove_output(
+    struct detection_watch *watch, struct output *output
+);
+
+void detection_watch_finish(struct detection_watch *watch);
+
+#endif
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "event_loop.h"
+
+#include "log.h"
+#include "state.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <wayland-client.h>
+
+int event_loop_add_fd(
+    struct state *state, int fd, fd_watch_handler_t handler, void *data
+) {
+    if (state->num_fd_watches >= MAX_FD_WATCHES) {
+        LOG_ERR("Too many file descriptors to watch.");
+        return 1;
+    }
+
+    state->fd_watches[state->num_fd_watches++] = (struct fd_watch){
+        .fd      = fd,
+        .handler = handler,
+        .data    = data,
+    };
+
+    return 0;
+}
+
+void event_loop_remove_fd(struct state *state, int fd) {
+    for (int i = 0; i < state->num_fd_watches; i++) {
+        if (state->fd_watches[i].fd == fd) {
+            state->num_fd_watches--;
+            memmove(
+                &state->fd_watches[i], &state->fd_watches[i + 1],
+                (state->num_fd_watches - i) * sizeof(struct fd_watch)
+            );
+            return;
+        }
+    }
+}
+
+// A previous handler may have removed the watch in the same iteration.
+static bool is_watched(struct state *state, struct fd_watch *watch) {
+    for (int i = 0; i < state->num_fd_watches; i++) {
+        if (state->fd_watches[i].fd == watch->fd &&
+            state->fd_watches[i].handler == watch->handler) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int event_loop_dispatch(struct state *state) {
+    struct wl_display *wl_display = state->wl_display;
+
+    while (wl_display_prepare_read(wl_display) != 0) {
+        if (wl_display_dispatch_pending(wl_display) < 0) {
+            return -1;
+        }
+    }
+
+    while (wl_display_flush(wl_display) < 0) {
+        if (errno != EAGAIN) {
+            wl_display_cancel_read(wl_display);
+            return -1;
+        }
+
+        // The compositor is not reading fast enough. We wait for the socket
+        // to be writable again.
+        struct pollfd pfd = {
+            .fd     = wl_display_get_fd(wl_display),
+            .events = POLLOUT,
+        };
+        poll(&pfd, 1, -1);
+    }
+
+    // Handlers can add or remove watches so we work on a copy.
+    int             num_watches = state->num_fd_watches;
+    struct fd_watch watches[MAX_FD_WATCHES];
+    memcpy(watches, state->fd_watches, num_watches * sizeof(struct fd_watch));
+
+    struct pollfd fds[MAX_FD_WATCHES + 1];
+    fds[0] = (struct pollfd){
+        .fd     = wl_display_get_fd(wl_display),
+        .events = POLLIN,
+    };
+    for (int i = 0; i < num_watches; i++) {
+        fds[i + 1] = (struct pollfd){
+            .fd     = watches[i].fd,
+            .events = POLLIN,
+        };
+    }
+
+    if (poll(fds, num_watches + 1, -1) < 0) {
+        wl_display_cancel_read(wl_display);
+        return errno == EINTR ? 0 : -1;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+        if (wl_display_read_events(wl_display) < 0) {
+            return -1;
+        }
+    } else {
+        wl_display_cancel_read(wl_display);
+    }
+
+    if (wl_display_dispatch_pending(wl_display) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < num_watches; i++) {
+        if ((fds[i + 1].revents & (POLLIN | POLLERR | POLLHUP)) &&
+            is_watched(state, &watches[i])) {
+            watches[i].handler(state, watches[i].fd, watches[i].data);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __EVENT_LOOP_H_INCLUDED__
+#define __EVENT_LOOP_H_INCLUDED__
+
+#define MAX_FD_WATCHES 8
+
+struct state;
+
+typedef void (*fd_watch_handler_t)(struct state *, int fd, void *data);
+
+struct fd_watch {
+    int                fd;
+    fd_watch_handler_t handler;
+    void              *data;
+};
+
+/**
+ * `event_loop_add_fd` watches `fd` for input alongside the Wayland connection.
+ * `handler` is called from `event_loop_dispatch` when `fd` is readable.
+ * Returns 0 on success.
+ */
+int event_loop_add_fd(
+    struct state *state, int fd, fd_watch_handler_t handler, void *data
+);
+
+/**
+ * `event_loop_remove_fd` stops watching `fd`. This can be called from a
+ * handler.
+ */
+void event_loop_remove_fd(struct state *state, int fd);
+
+/**
+ * `event_loop_dispatch` waits for Wayland events or watched file descriptors
+ * to be ready and dispatches them. Returns -1 on error. It also returns (with
+ * 0) when interrupted by a signal.
+ */
+int event_loop_dispatch(struct state *state);
+
+#endif
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "glyph_atlas.h"
+
+#include "log.h"
+#include "utils_cairo.h"
+
+#include <cairo/cairo.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Floating mode labels have a font size relative to their target's height.
+// Font sizes are rounded to whole pixels so that the number of sizes stays
+// small, and the least recently added ones are dropped past this number.
+#define MAX_GLYPH_SETS 64
+
+struct glyph {
+    cairo_surface_t *mask; // NULL for blank symbols.
+
+    // Position of the mask relative to the pen position in buffer pixels.
+    int x_off;
+    int y_off;
+
+    // Ink extents and advance in buffer pixels.
+    double top;
+    double bottom;
+    double x_advance;
+};
+
+struct glyph_set {
+    int              pixel_size;
+    cairo_surface_t *surface; // All the symbols' masks side by side.
+    struct glyph    *glyphs;  // Indexed by symbol.
+};
+
+struct glyph_atlas {
+    label_symbols_t   *label_symbols;
+    cairo_font_face_t *font_face;
+    struct glyph_set   sets[MAX_GLYPH_SETS];
+    int                num_sets;
+    int                next_evicted;
+    struct glyph_set  *last_used;
+};
+
+struct glyph_atlas *
+glyph_atlas_new(label_symbols_t *label_symbols, cairo_font_face_t *font_face) {
+    struct glyph_atlas *atlas = calloc(1, sizeof(*atlas));
+    atlas->label_symbols      = label_symbols;
+    atlas->font_face          = cairo_font_face_reference(font_face);
+    return atlas;
+}
+
+static void glyph_set_free(struct glyph_set *set, int num_symbols) {
+    for (int i = 0; i < num_symbols; i++) {
+        if (set->glyphs[i].mask != NULL) {
+            cairo_surface_destroy(set->glyphs[i].mask);
+        }
+    }
+
+    if (set->surface != NULL) {
+        cairo_surface_destroy(set->surface);
+    }
+
+    free(set->glyphs);
+    memset(set, 0, sizeof(*set));
+}
+
+void glyph_atlas_free(struct glyph_atlas *atlas) {
+    for (int i = 0; i < atlas->num_sets; i++) {
+        glyph_set_free(&atlas->sets[i], atlas->label_symbols->num_symbols);
+    }
+
+    cairo_font_face_destroy(atlas->font_face);
+    free(atlas);
+}
+
+static void
+glyph_set_init(struct glyph_atlas *atlas, struct glyph_set *set, int size) {
+    label_symbols_t *label_symbols = atlas->label_symbols;
+    int              num_symbols   = label_symbols->num_symbols;
+
+    set->pixel_size = size;
+    set->glyphs     = calloc(num_symbols, sizeof(struct glyph));
+
+    // The symbols are measured first to lay out their masks side by side.
+    cairo_surface_t *scratch =
+        cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cairo = cairo_create(scratch);
+    cairo_set_font_face(cairo, atlas->font_face);
+    cairo_set_font_size(cairo, size);
+
+    int mask_x[num_symbols], mask_w[num_symbols];
+    int surface_width  = 0;
+    int surface_height = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        cairo_text_extents_t te;
+        cairo_text_extents(
+            cairo, label_symbols_idx_to_ptr(label_symbols, i), &te
+        );
+
+        struct glyph *glyph = &set->glyphs[i];
+        glyph->top          = te.y_bearing;
+        glyph->bottom       = te.y_bearing + te.height;
+        glyph->x_advance    = te.x_advance;
+
+        // Masks get a pixel of margin for antialiasing.
+        glyph->x_off = floor(te.x_bearing) - 1;
+        glyph->y_off = floor(te.y_bearing) - 1;
+        mask_x[i]    = surface_width;
+        mask_w[i]    = te.width > 0 ? ceil(te.x_bearing + te.width) + 1 -
+                                       glyph->x_off
+                                    : 0;
+
+        surface_width  += mask_w[i];
+        surface_height  = max(
+            surface_height,
+            te.height > 0 ? ceil(glyph->bottom) + 1 - glyph->y_off : 0
+        );
+    }
+
+    cairo_destroy(cairo);
+    cairo_surface_destroy(scratch);
+
+    if (surface_width == 0 || surface_height == 0) {
+        return;
+    }
+
+    set->surface = cairo_image_surface_create(
+        CAIRO_FORMAT_A8, surface_width, surface_height
+    );
+    cairo = cairo_create(set->surface);
+    cairo_set_font_face(cairo, atlas->font_face);
+    cairo_set_font_size(cairo, size);
+    cairo_set_source_rgba(cairo, 0, 0, 0, 1);
+
+    for (int i = 0; i < num_symbols; i++) {
+        struct glyph *glyph = &set->glyphs[i];
+        if (mask_w[i] == 0) {
+            continue;
+        }
+
+        cairo_move_to(cairo, mask_x[i] - glyph->x_off, -glyph->y_off);
+        cairo_show_text(cairo, label_symbols_idx_to_ptr(label_symbols, i));
+
+        glyph->mask = cairo_surface_create_for_rectangle(
+            set->surface, mask_x[i], 0, mask_w[i], surface_height
+        );
+    }
+
+    cairo_destroy(cairo);
+    cairo_surface_flush(set->surface);
+}
+
+static struct glyph_set *
+get_glyph_set(struct glyph_atlas *atlas, int pixel_size) {
+    struct glyph_set *last_used = atlas->last_used;
+    if (last_used != NULL && last_used->pixel_size == pixel_size) {
+        return last_used;
+    }
+
+    for (int i = 0; i < atlas->num_sets; i++) {
+        if (atlas->sets[i].pixel_size == pixel_size) {
+            atlas->last_used = &atlas->sets[i];
+            return atlas->last_used;
+        }
+    }
+
+    struct glyph_set *set;
+    if (atlas->num_sets < MAX_GLYPH_SETS) {
+        set = &atlas->sets[atlas->num_sets++];
+    } else {
+        LOG_DEBUG("Glyph atlas full, dropping a font size.");
+        set                 = &atlas->sets[atlas->next_evicted];
+        atlas->next_evicted = (atlas->next_evicted + 1) % MAX_GLYPH_SETS;
+        glyph_set_free(set, atlas->label_symbols->num_symbols);
+    }
+
+    glyph_set_init(atlas, set, pixel_size);
+    atlas->last_used = set;
+    return set;
+}
+
+void glyph_atlas_draw_label(
+    struct glyph_atlas *atlas, cairo_t *cairo, double font_size,
+    struct rect area, label_selection_t *label, int cut,
+    uint32_t selected_color, uint32_t color
+) {
+    if (label->next == 0) {
+        return;
+    }
+
+    // Glyphs are drawn in buffer pixels so that the masks are pixel aligned.
+    cairo_matrix_t matrix;
+    cairo_get_matrix(cairo, &matrix);
+
+    int pixel_size = round(font_size * matrix.yy);
+    if (pixel_size <= 0) {
+        return;
+    }
+
+    struct glyph_set *set = get_glyph_set(atlas, pixel_size);
+
+    double advance = 0;
+    double top     = set->glyphs[label->input[0]].top;
+    double bottom  = set->glyphs[label->input[0]].bottom;
+    for (int i = 0; i < label->next; i++) {
+        struct glyph *glyph  = &set->glyphs[label->input[i]];
+        advance             += glyph->x_advance;
+        top                  = fmin(top, glyph->top);
+        bottom               = fmax(bottom, glyph->bottom);
+    }
+
+    // Centers the label.
+    double x = area.x + (area.w - advance / matrix.xx) / 2;
+    double y = area.y + (int)((area.h + (bottom - top) / matrix.yy) / 2);
+    cairo_user_to_device(cairo, &x, &y);
+
+    cairo_identity_matrix(cairo);
+
+    double pen_x = round(x);
+    int    pen_y = round(y);
+    for (int i = 0; i < label->next; i++) {
+        if (i == 0 || i == cut) {
+            cairo_set_source_u32(cairo, i < cut ? selected_color : color);
+        }
+
+        struct glyph *glyph = &set->glyphs[label->input[i]];
+        if (glyph->mask != NULL) {
+            cairo_mask_surface(
+                cairo, glyph->mask, round(pen_x) + glyph->x_off,
+                pen_y + glyph->y_off
+            );
+        }
+
+        pen_x += glyph->x_advance;
+    }
+
+    cairo_set_matrix(cairo, &matrix);
+}
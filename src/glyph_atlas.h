@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __GLYPH_ATLAS_H_INCLUDED__
+#define __GLYPH_ATLAS_H_INCLUDED__
+
+#include "label.h"
+#include "utils.h"
+
+#include <cairo/cairo.h>
+#include <stdint.h>
+
+/**
+ * A `glyph_atlas` holds the label symbols rasterized as alpha masks, once per
+ * font size in buffer pixels. Labels are drawn by masking a solid color with
+ * them instead of laying out text with cairo on every frame.
+ */
+struct glyph_atlas;
+
+struct glyph_atlas *
+glyph_atlas_new(label_symbols_t *label_symbols, cairo_font_face_t *font_face);
+
+void glyph_atlas_free(struct glyph_atlas *atlas);
+
+/**
+ * `glyph_atlas_draw_label` draws `label` centered in `area` with the given font
+ * size in surface coordinates. The first `cut` symbols are drawn with
+ * `selected_color` and the rest with `color`.
+ */
+void glyph_atlas_draw_label(
+    struct glyph_atlas *atlas, cairo_t *cairo, double font_size,
+    struct rect area, label_selection_t *label, int cut,
+    uint32_t selected_color, uint32_t color
+);
+
+#endif
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "grayscale.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define GRAYSCALE_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define GRAYSCALE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// BT.601 luma weights in fixed point. These are the ones OpenCV uses so that
+// the results are identical to `cv::cvtColor`.
+#define SHIFT    14
+#define ROUNDING (1 << (SHIFT - 1))
+#define WEIGHT_R 4899
+#define WEIGHT_G 9617
+#define WEIGHT_B 1868
+
+/**
+ * A `pixel_layout` gives the weight of each byte of a 32-bit pixel in memory
+ * order. The alpha or padding byte has a weight of 0.
+ */
+struct pixel_layout {
+    int16_t weights[4];
+};
+
+static bool get_pixel_layout(
+    enum wl_shm_format format, struct pixel_layout *layout
+) {
+    // Formats are little-endian, e.g. XRGB8888 is stored as B, G, R, X.
+    switch (format) {
+    case WL_SHM_FORMAT_ARGB8888:
+    case WL_SHM_FORMAT_XRGB8888:
+        *layout = (struct pixel_layout){{WEIGHT_B, WEIGHT_G, WEIGHT_R, 0}};
+        return true;
+
+    case WL_SHM_FORMAT_ABGR8888:
+    case WL_SHM_FORMAT_XBGR8888:
+        *layout = (struct pixel_layout){{WEIGHT_R, WEIGHT_G, WEIGHT_B, 0}};
+        return true;
+
+    case WL_SHM_FORMAT_BGRA8888:
+    case WL_SHM_FORMAT_BGRX8888:
+        *layout = (struct pixel_layout){{0, WEIGHT_R, WEIGHT_G, WEIGHT_B}};
+        return true;
+
+    case WL_SHM_FORMAT_RGBA8888:
+    case WL_SHM_FORMAT_RGBX8888:
+        *layout = (struct pixel_layout){{0, WEIGHT_B, WEIGHT_G, WEIGHT_R}};
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool grayscale_is_format_supported(enum wl_shm_format format) {
+    struct pixel_layout layout;
+    return get_pixel_layout(format, &layout);
+}
+
+typedef void (*convert_row_t)(
+    const uint8_t *src, uint8_t *dst, uint32_t width,
+    const struct pixel_layout *layout
+);
+
+static void convert_row_scalar(
+    const uint8_t *src, uint8_t *dst, uint32_t width,
+    const struct pixel_layout *layout
+) {
+    const int16_t *w = layout->weights;
+    for (uint32_t x = 0; x < width; x++, src += 4) {
+        dst[x] = (src[0] * w[0] + src[1] * w[1] + src[2] * w[2] +
+                  src[3] * w[3] + ROUNDING) >>
+                 SHIFT;
+    }
+}
+
+#if GRAYSCALE_X86
+
+// `sse2_luma4` computes the luma of 4 pixels as 32-bit integers. The bytes are
+// widened to 16 bits so that `_mm_madd_epi16` can sum two weighted channels
+// at once.
+static inline __m128i sse2_luma4(__m128i pixels, __m128i weights) {
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+
+    // Each pixel has its two partial sums next to each other.
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+
+    __m128i sum = _mm_unpacklo_epi64(lo, hi);
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(ROUNDING)), SHIFT);
+}
+
+static void convert_row_sse2(
+    const uint8_t *src, uint8_t *dst, uint32_t width,
+    const struct pixel_layout *layout
+) {
+    const int16_t *w       = layout->weights;
+    const __m128i  weights = _mm_set_epi16(
+        w[3], w[2], w[1], w[0], w[3], w[2], w[1], w[0]
+    );
+
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *in = (const __m128i *)(src + x * 4);
+
+        __m128i y0 = sse2_luma4(_mm_loadu_si128(in), weights);
+        __m128i y1 = sse2_luma4(_mm_loadu_si128(in + 1), weights);
+        __m128i y2 = sse2_luma4(_mm_loadu_si128(in + 2), weights);
+        __m128i y3 = sse2_luma4(_mm_loadu_si128(in + 3), weights);
+
+        _mm_storeu_si128(
+            (__m128i *)(dst + x),
+            _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3))
+        );
+    }
+
+    convert_row_scalar(src + x * 4, dst + x, width - x, layout);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+avx2_luma8(__m256i pixels, __m256i weights) {
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), weights);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), weights);
+
+    lo = _mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32));
+    hi = _mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32));
+    lo = _mm256_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+    hi = _mm256_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+
+    __m256i sum = _mm256_unpacklo_epi64(lo, hi);
+    return _mm256_srli_epi32(
+        _mm256_add_epi32(sum, _mm256_set1_epi32(ROUNDING)), SHIFT
+    );
+}
+
+__attribute__((target("avx2"))) static void convert_row_avx2(
+    const uint8_t *src, uint8_t *dst, uint32_t width,
+    const struct pixel_layout *layout
+) {
+    const int16_t *w       = layout->weights;
+    const __m256i  weights = _mm256_set_epi16(
+        w[3], w[2], w[1], w[0], w[3], w[2], w[1], w[0], w[3], w[2], w[1], w[0],
+        w[3], w[2], w[1], w[0]
+    );
+
+    // Packing works within 128-bit lanes so groups of 4 pixels end up
+    // interleaved between the lanes.
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i *in = (const __m256i *)(src + x * 4);
+
+        __m256i y0 = avx2_luma8(_mm256_loadu_si256(in), weights);
+        __m256i y1 = avx2_luma8(_mm256_loadu_si256(in + 1), weights);
+        __m256i y2 = avx2_luma8(_mm256_loadu_si256(in + 2), weights);
+        __m256i y3 = avx2_luma8(_mm256_loadu_si256(in + 3), weights);
+
+        __m256i y = _mm256_packus_epi16(
+            _mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3)
+        );
+        _mm256_storeu_si256(
+            (__m256i *)(dst + x), _mm256_permutevar8x32_epi32(y, order)
+        );
+    }
+
+    convert_row_sse2(src + x * 4, dst + x, width - x, layout);
+}
+
+#endif
+
+#if GRAYSCALE_NEON
+
+static inline uint8x8_t
+neon_luma8(const uint16x8_t channels[4], const int16_t *weights) {
+    uint32x4_t lo = vmull_n_u16(vget_low_u16(channels[0]), weights[0]);
+    uint32x4_t hi = vmull_n_u16(vget_high_u16(channels[0]), weights[0]);
+    for (int i = 1; i < 4; i++) {
+        lo = vmlal_n_u16(lo, vget_low_u16(channels[i]), weights[i]);
+        hi = vmlal_n_u16(hi, vget_high_u16(channels[i]), weights[i]);
+    }
+
+    // The rounding shift adds `ROUNDING` before shifting.
+    return vmovn_u16(
+        vcombine_u16(vrshrn_n_u32(lo, SHIFT), vrshrn_n_u32(hi, SHIFT))
+    );
+}
+
+static void convert_row_neon(
+    const uint8_t *src, uint8_t *dst, uint32_t width,
+    const struct pixel_layout *layout
+) {
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // Loads 16 pixels with one vector per byte position.
+        uint8x16x4_t pixels = vld4q_u8(src + x * 4);
+
+        uint16x8_t lo[4], hi[4];
+        for (int i = 0; i < 4; i++) {
+            lo[i] = vmovl_u8(vget_low_u8(pixels.val[i]));
+            hi[i] = vmovl_u8(vget_high_u8(pixels.val[i]));
+        }
+
+        vst1q_u8(
+            dst + x, vcombine_u8(
+                         neon_luma8(lo, layout->weights),
+                         neon_luma8(hi, layout->weights)
+                     )
+        );
+    }
+
+    convert_row_scalar(src + x * 4, dst + x, width - x, layout);
+}
+
+#endif
+
+static convert_row_t get_convert_row(void) {
+#if GRAYSCALE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return convert_row_avx2;
+    }
+
+    return convert_row_sse2;
+#elif GRAYSCALE_NEON
+    return convert_row_neon;
+#else
+    return convert_row_scalar;
+#endif
+}
+
+int grayscale_convert(
+    const void *data, uint32_t width, uint32_t height, uint32_t stride,
+    enum wl_shm_format format, uint8_t *out, uint32_t out_stride
+) {
+    struct pixel_layout layout;
+    if (!get_pixel_layout(format, &layout)) {
+        return 1;
+    }
+
+    convert_row_t convert_row = get_convert_row();
+
+    const uint8_t *src = data;
+    for (uint32_t y = 0; y < height; y++) {
+        convert_row(
+            src + (size_t)y * stride, out + (size_t)y * out_stride, width,
+            &layout
+        );
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __GRAYSCALE_H_INCLUDED__
+#define __GRAYSCALE_H_INCLUDED__
+
+#ifdef __cplusplus
+#define EXTERNC extern "C"
+#else
+#define EXTERNC
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+/**
+ * `grayscale_is_format_supported` tells whether `grayscale_convert` can read
+ * the format directly. Other formats need to be converted to ARGB8888 first.
+ */
+EXTERNC bool grayscale_is_format_supported(enum wl_shm_format format);
+
+/**
+ * `grayscale_convert` computes the luma (BT.601) of each pixel of `data` and
+ * writes it to `out` in a single pass. Returns 0 on success.
+ */
+EXTERNC int grayscale_convert(
+    const void *data, uint32_t width, uint32_t height, uint32_t stride,
+    enum wl_shm_format format, uint8_t *out, uint32_t out_stride
+);
+
+#undef EXTERNC
+
+#endif
@@ -9,6 +9,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+static unsigned int rune_slot(uint32_t rune) {
+    // Fibonacci hashing spreads consecutive runes over the table.
+    return (rune * 2654435761u) >> (32 - LABEL_SYMBOLS_TABLE_BITS);
+}
+
 label_symbols_t *label_symbols_from_str(char *s) {
     char *c = s;
 
@@ -43,6 +48,9 @@ label_symbols_t *label_symbols_from_str(char *s) {
     }
 
     label_symbols_t *label_symbols = malloc(len);
+    memset(
+        label_symbols->rune_indices, 0, sizeof(label_symbols->rune_indices)
+    );
 
     label_symbols->num_symbols = num_symbols;
     unsigned char *indices     = (unsigned char *)label_symbols->data;
@@ -58,6 +66,17 @@ label_symbols_t *label_symbols_from_str(char *s) {
 
         str_offset += c_len + 1;
         c          += c_len;
+
+        // A repeated symbol is only found at its first index.
+        unsigned int slot = rune_slot(r);
+        while (label_symbols->rune_indices[slot] != 0 &&
+               label_symbols->runes[slot] != r) {
+            slot = (slot + 1) & (LABEL_SYMBOLS_TABLE_SIZE - 1);
+        }
+        if (label_symbols->rune_indices[slot] == 0) {
+            label_symbols->runes[slot]        = r;
+            label_symbols->rune_indices[slot] = i + 1;
+        }
     }
 
     return label_symbols;
@@ -78,10 +97,26 @@ char *label_symbols_idx_to_ptr(label_symbols_t *label_symbols, int idx) {
 }
 
 int label_symbols_find_idx(label_symbols_t *label_symbols, char *s) {
-    for (int i = 0; i < label_symbols->num_symbols; i++) {
-        if (strcmp(label_symbols_idx_to_ptr(label_symbols, i), s) == 0) {
-            return i;
+    uint32_t rune;
+    int      len = str_to_rune(s, &rune);
+
+    // Symbols are single characters.
+    if (len <= 0 || s[len] != '\0') {
+        return -1;
+    }
+
+    return label_symbols_find_rune(label_symbols, rune);
+}
+
+int label_symbols_find_rune(label_symbols_t *label_symbols, uint32_t rune) {
+    unsigned int slot = rune_slot(rune);
+
+    while (label_symbols->rune_indices[slot] != 0) {
+        if (label_symbols->runes[slot] == rune) {
+            return label_symbols->rune_indices[slot] - 1;
         }
+
+        slot = (slot + 1) & (LABEL_SYMBOLS_TABLE_SIZE - 1);
     }
 
     return -1;
@@ -92,6 +127,7 @@ label_selection_new(label_symbols_t *label_symbols, int num_labels) {
     label_selection_t *l = malloc(sizeof(*l) + label_symbols->num_symbols);
 
     l->num_labels = num_labels;
+    l->num_short  = 0;
 
     l->len = 0;
     while (num_labels > 0) {
@@ -104,21 +140,129 @@ label_selection_new(label_symbols_t *label_symbols, int num_labels) {
     return l;
 }
 
-void label_selection_clear(label_selection_t *label_selection) {
-    label_selection->next = 0;
+void label_selection_shorten(label_selection_t *label_selection) {
+    int num_symbols = label_selection->label_symbols->num_symbols;
+
+    int64_t num_codes = 1;
+    for (int i = 0; i < label_selection->len; i++) {
+        num_codes *= num_symbols;
+    }
+
+    // Labels can be a symbol shorter when their number is a power of the
+    // number of symbols.
+    if (label_selection->len > 1 &&
+        num_codes / num_symbols >= label_selection->num_labels) {
+        label_selection->len--;
+        return;
+    }
+
+    if (label_selection->len < 2) {
+        return;
+    }
+
+    // A shorter label takes the place of `num_symbols` longer ones.
+    label_selection->num_short =
+        (num_codes - label_selection->num_labels) / (num_symbols - 1);
 }
 
-static int label_selection_to_partial_idx(label_selection_t *label_selection) {
-    int idx         = 0;
-    int factor      = 1;
+/**
+ * A `label_layout` tells where labels are depending on their length. Short
+ * labels are the first ones and their symbols are their index's digits. Longer
+ * labels come in blocks of `block_len` sharing their last symbol, the block's
+ * number. Their other symbols, their prefix, are the digits of a number from
+ * `num_short` to `num_prefixes` excluded so that they don't start like a short
+ * label.
+ */
+struct label_layout {
+    int64_t num_short;
+    int64_t num_prefixes;
+    int64_t block_len;
+};
+
+static struct label_layout get_layout(label_selection_t *label_selection) {
     int num_symbols = label_selection->label_symbols->num_symbols;
 
-    for (int i = 0; i < label_selection->next; i++) {
-        idx    += label_selection->input[i] * factor;
-        factor *= num_symbols;
+    struct label_layout layout = {
+        .num_short    = label_selection->num_short,
+        .num_prefixes = 1,
+    };
+    for (int i = 1; i < label_selection->len; i++) {
+        layout.num_prefixes *= num_symbols;
+    }
+    layout.block_len = layout.num_prefixes - layout.num_short;
+
+    return layout;
+}
+
+/**
+ * `align_up` returns the lowest number from `from` that is equal to `value`
+ * modulo `modulo`.
+ */
+static int64_t align_up(int64_t from, int64_t value, int64_t modulo) {
+    return from + ((value - from) % modulo + modulo) % modulo;
+}
+
+/**
+ * `find_match` returns the index of the first label from `from` starting with
+ * the selection or -1.
+ */
+static int find_match(label_selection_t *label_selection, int64_t from) {
+    int num_symbols = label_selection->label_symbols->num_symbols;
+    int len         = label_selection->len;
+
+    if (label_selection->num_labels == 0 || label_selection->next > len) {
+        return -1;
+    }
+
+    struct label_layout layout = get_layout(label_selection);
+
+    // The typed symbols of the prefix are its lowest digits so matching
+    // prefixes are those equal to them modulo `modulo`.
+    int64_t prefix = 0;
+    int64_t modulo = 1;
+    for (int i = 0; i < min(label_selection->next, len - 1); i++) {
+        prefix += label_selection->input[i] * modulo;
+        modulo *= num_symbols;
+    }
+
+    if (from < layout.num_short) {
+        if (label_selection->next < len) {
+            int64_t idx = align_up(from, prefix, modulo);
+            if (idx < layout.num_short) {
+                return idx;
+            }
+        }
+        from = layout.num_short;
+    }
+
+    int64_t idx;
+    if (label_selection->next == len) {
+        if (prefix < layout.num_short) {
+            return -1;
+        }
+
+        idx = prefix + label_selection->input[len - 1] * layout.block_len;
+        if (idx < from) {
+            return -1;
+        }
+    } else {
+        int64_t block = (from - layout.num_short) / layout.block_len;
+        idx = align_up(from - block * layout.block_len, prefix, modulo);
+        if (idx >= layout.num_prefixes) {
+            block++;
+            idx = align_up(layout.num_short, prefix, modulo);
+            if (idx >= layout.num_prefixes) {
+                return -1;
+            }
+        }
+        idx += block * layout.block_len;
     }
 
-    return idx;
+    return idx < label_selection->num_labels ? idx : -1;
+}
+
+void label_selection_clear(label_selection_t *label_selection) {
+    label_selection->next = 0;
 }
 
 enum label_selection_append_ret
@@ -129,8 +273,7 @@ label_selection_append(label_selection_t *label_selection, int idx) {
 
     label_selection->input[label_selection->next++] = idx;
 
-    if (label_selection_to_partial_idx(label_selection) >=
-        label_selection->num_labels) {
+    if (find_match(label_selection, 0) < 0) {
         label_selection->next--;
         return LABEL_SELECTION_APPEND_IDX_OVERFLOW;
     }
@@ -165,24 +308,48 @@ bool label_selection_is_included(
 }
 
 int label_selection_to_idx(label_selection_t *label_selection) {
-    if (label_selection->next != label_selection->len) {
+    int idx = find_match(label_selection, 0);
+    if (idx < 0) {
         return -1;
     }
 
-    return label_selection_to_partial_idx(label_selection);
+    // Labels don't start like shorter ones so the selection is complete if
+    // the first match has its length.
+    int len = label_selection->len - (idx < label_selection->num_short);
+    return label_selection->next == len ? idx : -1;
+}
+
+int label_selection_first_match(label_selection_t *label_selection) {
+    return find_match(label_selection, 0);
+}
+
+int label_selection_next_match(label_selection_t *label_selection, int idx) {
+    return find_match(label_selection, (int64_t)idx + 1);
 }
 
 int label_selection_set_from_idx(label_selection_t *label_selection, int idx) {
     int num_symbols = label_selection->label_symbols->num_symbols;
+    int len         = label_selection->len;
+
+    struct label_layout layout = get_layout(label_selection);
+    int64_t             digits = idx;
+    if (idx < layout.num_short) {
+        len--;
+    } else {
+        int64_t long_idx = idx - layout.num_short;
+        int64_t block    = long_idx / layout.block_len;
+
+        digits = layout.num_short + long_idx % layout.block_len +
+                 block * layout.num_prefixes;
+    }
 
-    for (label_selection->next = 0;
-         label_selection->next < label_selection->len;
+    for (label_selection->next = 0; label_selection->next < len;
          label_selection->next++) {
-        label_selection->input[label_selection->next]  = idx % num_symbols;
-        idx                                           /= num_symbols;
+        label_selection->input[label_selection->next]  = digits % num_symbols;
+        digits                                        /= num_symbols;
     }
 
-    return idx == 0;
+    return digits == 0;
 }
 
 int label_selection_incr(label_selection_t *label_selection) {
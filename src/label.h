@@ -4,8 +4,19 @@
 #define __LABEL_H_INCLUDED__
 
 #include <stdbool.h>
+#include <stdint.h>
+
+// Size of the table of the symbols' runes. It's kept at most half full so that
+// lookups only probe a few slots.
+#define LABEL_SYMBOLS_TABLE_BITS 9
+#define LABEL_SYMBOLS_TABLE_SIZE (1 << LABEL_SYMBOLS_TABLE_BITS)
 
 typedef struct {
+    // Open addressing table of the symbols' runes. `rune_indices` holds the
+    // index of each symbol plus one, 0 for empty slots.
+    uint32_t      runes[LABEL_SYMBOLS_TABLE_SIZE];
+    unsigned char rune_indices[LABEL_SYMBOLS_TABLE_SIZE];
+
     /*         data             data[num_symbols]
      *         |                |
      *  | 4 || 0 | 2 | 4 | 6 ||`a`| 0 |`b`| 0 |`c`| 0 |`d`| 0 |
@@ -21,9 +32,13 @@ typedef struct {
 typedef struct {
     label_symbols_t *label_symbols;
     int              num_labels;
-    unsigned char    len;
-    unsigned char    next;
-    unsigned char    input[];
+
+    // The first `num_short` labels are one symbol shorter than the others.
+    // None of the longer labels start with them.
+    int           num_short;
+    unsigned char len;
+    unsigned char next;
+    unsigned char input[];
 } label_selection_t;
 
 // Create a `label_symbols_t` from a string of characters.
@@ -41,10 +56,18 @@ char *label_symbols_idx_to_ptr(label_symbols_t *label_symbols, int idx);
 // Returns value <0 upon error.
 int label_symbols_find_idx(label_symbols_t *label_symbols, char *s);
 
+// Find symbol index from given rune.
+// Returns value <0 upon error.
+int label_symbols_find_rune(label_symbols_t *label_symbols, uint32_t rune);
+
 // Create a `label_selection_t`.
 label_selection_t *
 label_selection_new(label_symbols_t *label_symbols, int num_labels);
 
+// Give as many of the first labels as possible one symbol less. It must be
+// done before anything is appended.
+void label_selection_shorten(label_selection_t *label_selection);
+
 // Clear selection.
 void label_selection_clear(label_selection_t *label_selection);
 
@@ -69,10 +92,20 @@ bool label_selection_is_included(
 // Returns associated label index.
 int label_selection_to_idx(label_selection_t *label_selection);
 
+// Returns index of the first label starting with the selection or -1 if there
+// is none. The following ones are given by `label_selection_next_match`.
+int label_selection_first_match(label_selection_t *label_selection);
+
+// Returns index of the label after `idx` starting with the selection or -1 if
+// there is none. As labels' first symbols are their lowest digits, they are
+// evenly spaced among labels of the same length.
+int label_selection_next_match(label_selection_t *label_selection, int idx);
+
 // Set selection from associated index.
 int label_selection_set_from_idx(label_selection_t *label_selection, int idx);
 
-// Set to selection with incremented associated index.
+// Set to selection with incremented associated index. Labels must not have
+// been shortened.
 int label_selection_incr(label_selection_t *label_selection);
 
 // Get size of buffer needed to store label's string.
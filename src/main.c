@@ -1,11 +1,15 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include "config.h"
+#include "daemon.h"
+#include "event_loop.h"
 #include "fractional-scale-v1-client-protocol.h"
 #include "log.h"
 #include "mode.h"
+#include "rect_parse.h"
 #include "state.h"
 #include "surface_buffer.h"
+#include "trace.h"
 #include "utils_wayland.h"
 #include "viewporter-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
@@ -25,6 +29,9 @@
 #include <xkbcommon/xkbcommon-keysyms.h>
 #include <xkbcommon/xkbcommon.h>
 
+static void enter_first_mode_if_ready(struct state *state);
+static void prepare_first_mode_if_possible(struct state *state);
+
 static void send_frame(struct state *state) {
     int32_t scale_120 = state->fractional_scale;
     if (scale_120 == 0) {
@@ -35,19 +42,23 @@ static void send_frame(struct state *state) {
     }
 
     struct surface_buffer *surface_buffer = get_next_buffer(
-        state->wl_shm, &state->surface_buffer_pool,
-        state->surface_width * scale_120 / 120,
+        &state->surface_buffer_pool, state->surface_width * scale_120 / 120,
         state->surface_height * scale_120 / 120
     );
     if (surface_buffer == NULL) {
         return;
     }
     surface_buffer->state = SURFACE_BUFFER_BUSY;
+    surface_buffer_start_frame(surface_buffer);
 
     cairo_t *cairo = surface_buffer->cairo;
     cairo_identity_matrix(cairo);
     cairo_scale(cairo, scale_120 / 120.0, scale_120 / 120.0);
+    state->current_buffer = surface_buffer;
+    trace_begin("mode_render");
     mode_render(state, cairo);
+    trace_end("mode_render");
+    state->current_buffer = NULL;
 
     wl_surface_set_buffer_scale(state->wl_surface, 1);
 
@@ -55,10 +66,12 @@ static void send_frame(struct state *state) {
     wp_viewport_set_destination(
         state->wp_viewport, state->surface_width, state->surface_height
     );
-    wl_surface_damage(
-        state->wl_surface, 0, 0, state->surface_width, state->surface_height
+    surface_buffer_damage_surface(
+        surface_buffer, state->wl_surface, scale_120 / 120.0
     );
     wl_surface_commit(state->wl_surface);
+    state->committed_content_id = surface_buffer->content_id;
+    trace_instant("wl_surface_commit");
 }
 
 /**
@@ -69,7 +82,7 @@ static void send_frame(struct state *state) {
  */
 static void send_transparent_frame(struct state *state) {
     struct surface_buffer *surface_buffer =
-        get_next_buffer(state->wl_shm, &state->surface_buffer_pool, 1, 1);
+        get_next_buffer(&state->surface_buffer_pool, 1, 1);
     if (surface_buffer == NULL) {
         return;
     }
@@ -84,6 +97,7 @@ static void send_transparent_frame(struct state *state) {
     );
     wl_surface_damage(state->wl_surface, 0, 0, 1, 1);
     wl_surface_commit(state->wl_surface);
+    state->committed_content_id = 0;
 }
 
 static void surface_callback_done(
@@ -100,7 +114,7 @@ const struct wl_callback_listener surface_callback_listener = {
     .done = surface_callback_done,
 };
 
-static void request_frame(struct state *state) {
+void request_frame(struct state *state) {
     if (state->wl_surface_callback != NULL) {
         return;
     }
@@ -112,6 +126,14 @@ static void request_frame(struct state *state) {
     wl_surface_commit(state->wl_surface);
 }
 
+// A frame couldn't be drawn because all the buffers were busy.
+static void handle_buffer_released(void *data) {
+    struct state *state = data;
+    if (state->current_mode != NO_MODE_ENTERED) {
+        request_frame(state);
+    }
+}
+
 bool compute_initial_area(struct state *state, struct rect *initial_area) {
     if (initial_area->w == -1) {
         initial_area->x = 0;
@@ -202,7 +224,10 @@ static void handle_keyboard_keymap(
     void *data, struct wl_keyboard *keyboard, uint32_t format, int fd,
     uint32_t size
 ) {
-    struct seat *seat = data;
+    struct seat *seat     = data;
+    seat->keymap_received = true;
+    trace_instant("keymap");
+
     if (seat->xkb_state != NULL) {
         xkb_state_unref(seat->xkb_state);
         seat->xkb_state = NULL;
@@ -243,21 +268,21 @@ static void handle_keyboard_keymap(
         );
     }
     seat->xkb_state = xkb_state_new(seat->xkb_keymap);
+
+    enter_first_mode_if_ready(seat->state);
 }
 
 static void handle_keyboard_key(
     void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t time,
     uint32_t key, uint32_t key_state
 ) {
-    struct seat        *seat = data;
-    char                text[64];
+    struct seat        *seat     = data;
     const xkb_keycode_t key_code = key + 8;
     const xkb_keysym_t  key_sym =
         xkb_state_key_get_one_sym(seat->xkb_state, key_code);
-    xkb_keysym_to_utf8(key_sym, text, sizeof(text));
 
     if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-        bool redraw = mode_handle_key(seat->state, key_sym, text);
+        bool redraw = mode_handle_key(seat->state, key_sym);
         if (has_last_mode_returned(seat->state)) {
             seat->state->running = false;
         } else if (redraw) {
@@ -289,13 +314,18 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
 static void handle_seat_capabilities(
     void *data, struct wl_seat *wl_seat, uint32_t capabilities
 ) {
-    struct seat *seat = data;
-    if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
+    struct seat *seat           = data;
+    seat->capabilities_received = true;
+
+    if ((capabilities & WL_SEAT_CAPABILITY_KEYBOARD) &&
+        seat->wl_keyboard == NULL) {
         seat->wl_keyboard = wl_seat_get_keyboard(seat->wl_seat);
         wl_keyboard_add_listener(
             seat->wl_keyboard, &wl_keyboard_listener, data
         );
     }
+
+    enter_first_mode_if_ready(seat->state);
 }
 
 const struct wl_seat_listener wl_seat_listener = {
@@ -325,15 +355,21 @@ static void free_seats(struct wl_list *seats) {
     }
 }
 
+static void free_output(struct output *output) {
+    wl_output_destroy(output->wl_output);
+    if (output->xdg_output != NULL) {
+        zxdg_output_v1_destroy(output->xdg_output);
+    }
+    wl_list_remove(&output->link);
+    free(output->name);
+    free(output);
+}
+
 static void free_outputs(struct wl_list *outputs) {
     struct output *output;
     struct output *tmp;
     wl_list_for_each_safe (output, tmp, outputs, link) {
-        wl_output_destroy(output->wl_output);
-        zxdg_output_v1_destroy(output->xdg_output);
-        wl_list_remove(&output->link);
-        free(output->name);
-        free(output);
+        free_output(output);
     }
 }
 
@@ -397,26 +433,56 @@ static void handle_xdg_output_name(
     output->name          = strdup(name);
 }
 
+static void
+handle_xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output) {
+    struct output *output   = data;
+    output->xdg_output_done = true;
+
+    if (output == output->state->current_output) {
+        prepare_first_mode_if_possible(output->state);
+        enter_first_mode_if_ready(output->state);
+    }
+}
+
 const static struct zxdg_output_v1_listener xdg_output_listener = {
     .logical_position = handle_xdg_output_logical_position,
     .logical_size     = handle_xdg_output_logical_size,
-    .done             = noop,
+    .done             = handle_xdg_output_done,
     .name             = handle_xdg_output_name,
     .description      = noop,
 };
 
-static void load_xdg_outputs(struct state *state) {
+static void load_xdg_output(struct state *state, struct output *output) {
+    output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+        state->xdg_output_manager, output->wl_output
+    );
+    zxdg_output_v1_add_listener(
+        output->xdg_output, &xdg_output_listener, output
+    );
+}
+
+static bool are_outputs_loaded(struct state *state) {
     struct output *output;
     wl_list_for_each (output, &state->outputs, link) {
-        output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
-            state->xdg_output_manager, output->wl_output
-        );
-        zxdg_output_v1_add_listener(
-            output->xdg_output, &xdg_output_listener, output
-        );
+        if (!output->xdg_output_done) {
+            return false;
+        }
     }
 
-    wl_display_roundtrip(state->wl_display);
+    return true;
+}
+
+/**
+ * `wait_for_outputs` makes sure the outputs' names and positions are known.
+ * The xdg-output objects are requested when the globals are bound so this
+ * only needs a round trip if their events haven't been received yet.
+ */
+static void wait_for_outputs(struct state *state) {
+    if (!are_outputs_loaded(state)) {
+        trace_begin("outputs_roundtrip");
+        wl_display_roundtrip(state->wl_display);
+        trace_end("outputs_roundtrip");
+    }
 }
 
 static void enter_first_mode(struct state *state) {
@@ -446,6 +512,66 @@ static void enter_first_mode(struct state *state) {
     }
 }
 
+/**
+ * `prepare_first_mode_if_possible` lets the first mode start its slow work,
+ * like capturing the screen, as soon as the output's geometry is known. This
+ * overlaps with the surface's configuration and the keymaps' loading.
+ */
+static void prepare_first_mode_if_possible(struct state *state) {
+    if (state->first_mode_prepared ||
+        state->current_mode != NO_MODE_ENTERED ||
+        state->current_output == NULL ||
+        !state->current_output->xdg_output_done) {
+        return;
+    }
+
+    struct rect area = state->initial_area;
+    if (area.w == -1) {
+        // The surface covers the whole output.
+        area = (struct rect){
+            0, 0, state->current_output->width, state->current_output->height
+        };
+    } else if (!compute_initial_area(state, &area)) {
+        return;
+    }
+
+    state->first_mode_prepared = true;
+    prepare_first_mode(state, area);
+}
+
+/**
+ * `is_ready_to_enter` tells whether everything the first mode depends on has
+ * been received: the surface size, the output's geometry and the keymaps
+ * which give the home row keys.
+ */
+static bool is_ready_to_enter(struct state *state) {
+    if (!state->surface_configured || state->current_output == NULL ||
+        !state->current_output->xdg_output_done) {
+        return false;
+    }
+
+    struct seat *seat;
+    wl_list_for_each (seat, &state->seats, link) {
+        if (!seat->capabilities_received ||
+            (seat->wl_keyboard != NULL && !seat->keymap_received)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * `enter_first_mode_if_ready` is called whenever one of the events the first
+ * mode waits for is received. They can come in any order as the start-up
+ * requests are not separated by round trips.
+ */
+static void enter_first_mode_if_ready(struct state *state) {
+    if (state->running && is_ready_to_enter(state)) {
+        enter_first_mode(state);
+    }
+}
+
 static void handle_surface_enter(
     void *data, struct wl_surface *surface, struct wl_output *wl_output
 ) {
@@ -453,10 +579,10 @@ static void handle_surface_enter(
     struct output *output =
         find_output_from_wl_output(&state->outputs, wl_output);
     state->current_output = output;
+    trace_instant("surface_enter");
 
-    if (state->surface_configured) {
-        enter_first_mode(state);
-    }
+    prepare_first_mode_if_possible(state);
+    enter_first_mode_if_ready(state);
 }
 
 static const struct wl_surface_listener surface_listener = {
@@ -499,17 +625,30 @@ static void handle_registry_global(
         struct wl_output *wl_output =
             wl_registry_bind(registry, name, &wl_output_interface, 3);
         struct output *output = calloc(1, sizeof(struct output));
+        output->wl_name       = name;
         output->wl_output     = wl_output;
         output->scale         = 1;
+        output->state         = state;
 
         wl_output_add_listener(output->wl_output, &output_listener, output);
         wl_list_insert(&state->outputs, &output->link);
 
+        // The manager may be announced after the outputs. Outputs plugged in
+        // while running as a daemon are loaded here.
+        if (state->xdg_output_manager != NULL) {
+            load_xdg_output(state, output);
+        }
+
     } else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
         state->xdg_output_manager = wl_registry_bind(
             registry, name, &zxdg_output_manager_v1_interface, 2
         );
 
+        struct output *output;
+        wl_list_for_each (output, &state->outputs, link) {
+            load_xdg_output(state, output);
+        }
+
     } else if (strcmp(
                    interface, zwlr_virtual_pointer_manager_v1_interface.name
                ) == 0) {
@@ -525,19 +664,45 @@ static void handle_registry_global(
         state->fractional_scale_mgr = wl_registry_bind(
             registry, name, &wp_fractional_scale_manager_v1_interface, 1
         );
-#if OPENCV_ENABLED
     } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) ==
                0) {
         state->wl_screencopy_manager = wl_registry_bind(
-            registry, name, &zwlr_screencopy_manager_v1_interface, 1
+            registry, name, &zwlr_screencopy_manager_v1_interface,
+            version < 3 ? version : 3
         );
-#endif
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0) {
+        state->linux_dmabuf = wl_registry_bind(
+            registry, name, &zwp_linux_dmabuf_v1_interface,
+            version < 3 ? version : 3
+        );
+    }
+}
+
+static void handle_registry_global_remove(
+    void *data, struct wl_registry *registry, uint32_t name
+) {
+    struct state  *state = data;
+    struct output *output;
+    wl_list_for_each (output, &state->outputs, link) {
+        if (output->wl_name == name) {
+            if (output == state->current_output) {
+                state->current_output = NULL;
+                state->running        = false;
+            }
+
+            if (state->detection_watch != NULL) {
+                detection_watch_remove_output(state->detection_watch, output);
+            }
+
+            free_output(output);
+            return;
+        }
     }
 }
 
 const struct wl_registry_listener wl_registry_listener = {
     .global        = handle_registry_global,
-    .global_remove = noop,
+    .global_remove = handle_registry_global_remove,
 };
 
 static void handle_layer_surface_configure(
@@ -548,14 +713,16 @@ static void handle_layer_surface_configure(
     state->surface_width  = width;
     state->surface_height = height;
     zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+    trace_instant("layer_surface_configure");
 
-    if (state->current_output != NULL) {
-        enter_first_mode(state);
-    } else if (!state->surface_configured) {
+    // Without an output, the surface needs to be mapped for the compositor
+    // to tell which output it's on.
+    if (state->current_output == NULL && !state->surface_configured) {
         send_transparent_frame(state);
     }
 
     state->surface_configured = true;
+    enter_first_mode_if_ready(state);
 }
 
 static void handle_layer_surface_closed(
@@ -611,7 +778,7 @@ static struct output *find_output_by_name(struct state *state, char *name) {
     return NULL;
 }
 
-static void print_result(struct state *state) {
+static void format_result(struct state *state, char *out, size_t len) {
     char click;
     switch (state->click) {
     case CLICK_LEFT_BTN:
@@ -627,8 +794,8 @@ static void print_result(struct state *state) {
         click = 'n';
     }
 
-    printf(
-        "%dx%d+%d+%d +%d+%d %c\n", state->result.w, state->result.h,
+    snprintf(
+        out, len, "%dx%d+%d+%d +%d+%d %c\n", state->result.w, state->result.h,
         state->result.x, state->result.y, state->current_output->x,
         state->current_output->y, click
     );
@@ -645,6 +812,12 @@ static void print_usage() {
     puts(" -o, --option        set configuration option");
     puts(" -O, --output        specify display output to use");
     puts(" -p, --only-print    only print, don't move the cursor or click");
+    puts(" -d, --daemon        stay in the background and wait for triggers");
+    puts(" -t, --trigger       trigger a selection in the running daemon");
+    puts(" --trace=FILE        write timings to FILE (also `WL_KBPTR_TRACE`)");
+    puts(" --dump-capture=DIR  write the screen captures used for detection");
+    puts(" --replay-capture=FILE");
+    puts("                     detect targets in a dumped capture instead");
 }
 
 static void print_version() {
@@ -655,30 +828,285 @@ static void print_version() {
     puts("");
 }
 
+/**
+ * `run_session` shows the overlay and runs the selection modes until a result
+ * is selected or the selection is cancelled. The result line is written to
+ * `result` which must be `DAEMON_MAX_RESULT_LEN` long. Returns the status code
+ * to exit with.
+ */
+static int run_session(
+    struct state *state, struct daemon_request *request, char *result
+) {
+    result[0] = '\0';
+    trace_begin("session");
+
+    state->running              = true;
+    state->surface_configured   = false;
+    state->wl_surface_callback  = NULL;
+    state->committed_content_id = 0;
+    state->current_output       = NULL;
+    state->surface_width        = 0;
+    state->surface_height       = 0;
+    state->fractional_scale     = 0;
+    state->result               = (struct rect){-1, -1, -1, -1};
+    state->initial_area         = request->initial_area;
+    state->current_mode         = NO_MODE_ENTERED;
+    state->first_mode_prepared  = false;
+    state->click                = CLICK_NONE;
+
+    // Outputs are only needed up front when one has to be picked from the
+    // request. Otherwise, their events are received along the surface's.
+    if (request->output_name || state->initial_area.w != -1) {
+        wait_for_outputs(state);
+    }
+
+    if (request->output_name) {
+        state->current_output =
+            find_output_by_name(state, request->output_name);
+
+        if (!state->current_output) {
+            LOG_ERR("Could not find output '%s'.", request->output_name);
+            trace_end("session");
+            return 1;
+        }
+    } else if (state->initial_area.w != -1) {
+        state->current_output =
+            find_output_from_rect(state, &state->initial_area);
+
+        if (!state->current_output) {
+            LOG_ERR("Could not find output containing given area.");
+            trace_end("session");
+            return 1;
+        }
+
+        state->initial_area.x -= state->current_output->x;
+        state->initial_area.y -= state->current_output->y;
+    }
+
+    // The overlay would damage the watched region.
+    if (state->detection_watch != NULL) {
+        detection_watch_stop(state->detection_watch);
+    }
+
+    prepare_first_mode_if_possible(state);
+
+    surface_buffer_pool_init(
+        &state->surface_buffer_pool, &state->shm_pool,
+        state->config.general.surface_buffers, handle_buffer_released, state
+    );
+
+    state->wl_surface = wl_compositor_create_surface(state->wl_compositor);
+    wl_surface_add_listener(state->wl_surface, &surface_listener, state);
+    state->wl_layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+        state->wl_layer_shell, state->wl_surface,
+        state->current_output == NULL ? NULL : state->current_output->wl_output,
+        ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection"
+    );
+    zwlr_layer_surface_v1_add_listener(
+        state->wl_layer_surface, &wl_layer_surface_listener, state
+    );
+    zwlr_layer_surface_v1_set_exclusive_zone(state->wl_layer_surface, -1);
+    zwlr_layer_surface_v1_set_anchor(
+        state->wl_layer_surface, ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
+                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM
+    );
+    zwlr_layer_surface_v1_set_keyboard_interactivity(
+        state->wl_layer_surface, true
+    );
+
+    struct wp_fractional_scale_v1 *fractional_scale = NULL;
+    if (state->fractional_scale_mgr) {
+        fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+            state->fractional_scale_mgr, state->wl_surface
+        );
+        wp_fractional_scale_v1_add_listener(
+            fractional_scale, &fractional_scale_listener, state
+        );
+    }
+
+    state->wp_viewport =
+        wp_viewporter_get_viewport(state->wp_viewporter, state->wl_surface);
+
+    struct wl_region *wl_region =
+        wl_compositor_create_region(state->wl_compositor);
+    wl_region_add(wl_region, 0, 0, 0, 0);
+    wl_surface_set_input_region(state->wl_surface, wl_region);
+
+    wl_surface_commit(state->wl_surface);
+    while (state->running && !daemon_should_stop() &&
+           event_loop_dispatch(state) >= 0) {}
+
+    if (state->wl_surface_callback != NULL) {
+        wl_callback_destroy(state->wl_surface_callback);
+        state->wl_surface_callback = NULL;
+    }
+
+    // The first mode may have been prepared but never entered.
+    if (state->pending_capture != NULL) {
+        cancel_screenshot(state->pending_capture);
+        state->pending_capture = NULL;
+    }
+
+    if (fractional_scale != NULL) {
+        wp_fractional_scale_v1_destroy(fractional_scale);
+    }
+
+    wp_viewport_destroy(state->wp_viewport);
+
+    zwlr_layer_surface_v1_destroy(state->wl_layer_surface);
+    wl_surface_destroy(state->wl_surface);
+    wl_region_destroy(wl_region);
+    state->surface_configured = false;
+
+    surface_buffer_pool_destroy(&state->surface_buffer_pool);
+    wl_display_roundtrip(state->wl_display);
+
+    int status_code = 0;
+    if (state->result.x != -1 && state->current_output != NULL) {
+        format_result(state, result, DAEMON_MAX_RESULT_LEN);
+        if (!request->only_print) {
+            move_pointer(
+                state, state->result.x + state->result.w / 2,
+                state->result.y + state->result.h / 2, state->click
+            );
+        }
+    } else {
+        status_code = state->config.general.cancellation_status_code;
+    }
+
+    free_mode_states(state);
+    state->current_mode = NO_MODE_ENTERED;
+
+    if (state->detection_watch != NULL) {
+        detection_watch_start(state->detection_watch);
+    }
+
+    trace_end("session");
+    trace_flush();
+
+    return status_code;
+}
+
+/**
+ * `may_capture_screen` tells whether a session can request a screen capture,
+ * which is when targets are detected by the floating mode.
+ */
+static bool may_capture_screen(struct state *state) {
+    if (state->config.mode_floating.source != FLOATING_MODE_SOURCE_DETECT ||
+        state->replay_capture_file != NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < MAX_NUM_MODES && state->mode_interfaces[i] != NULL;
+         i++) {
+        if (strcmp(state->mode_interfaces[i]->name, "floating") == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+handle_daemon_connection(struct state *state, int listen_fd, void *data) {
+    struct daemon_request request;
+    int client_fd = daemon_accept_request(listen_fd, &request);
+    if (client_fd < 0) {
+        return;
+    }
+
+    // Only one selection can be shown at a time. Other clients wait in the
+    // socket's backlog until this one is done.
+    event_loop_remove_fd(state, listen_fd);
+
+    char result[DAEMON_MAX_RESULT_LEN] = "";
+    int  status_code;
+
+    // The daemon may have been started with `--only-print` on a compositor
+    // that can't move the pointer.
+    if (state->wl_virtual_pointer_mgr == NULL && !request.only_print) {
+        LOG_ERR(
+            "Failed to get wlr_virtual_pointer_manager_v1 object, only "
+            "printing is possible."
+        );
+        status_code = 1;
+    } else if (state->wl_screencopy_manager == NULL &&
+               may_capture_screen(state)) {
+        LOG_ERR(
+            "Failed to get zwlr_screencopy_manager_v1 object, targets can't "
+            "be detected."
+        );
+        status_code = 1;
+    } else {
+        status_code = run_session(state, &request, result);
+    }
+    daemon_send_response(client_fd, status_code, result);
+    daemon_request_free(&request);
+
+    event_loop_add_fd(state, listen_fd, handle_daemon_connection, data);
+}
+
+static int run_daemon(struct state *state) {
+    int listen_fd = daemon_listen();
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    daemon_handle_signals();
+    event_loop_add_fd(state, listen_fd, handle_daemon_connection, NULL);
+
+    int status_code = 0;
+    while (!daemon_should_stop()) {
+        if (event_loop_dispatch(state) < 0) {
+            LOG_ERR("Lost connection to the Wayland compositor.");
+            status_code = 1;
+            break;
+        }
+    }
+
+    event_loop_remove_fd(state, listen_fd);
+    daemon_close(listen_fd);
+
+    return status_code;
+}
+
 int main(int argc, char **argv) {
     struct state state = {
-        .wl_display          = NULL,
-        .wl_registry         = NULL,
-        .wl_compositor       = NULL,
-        .wl_shm              = NULL,
-        .wl_layer_shell      = NULL,
-        .wl_surface          = NULL,
-        .wl_surface_callback = NULL,
-        .wl_layer_surface    = NULL,
-        .surface_configured  = false,
-#if OPENCV_ENABLED
+        .wl_display            = NULL,
+        .wl_registry           = NULL,
+        .wl_compositor         = NULL,
+        .wl_shm                = NULL,
+        .wl_layer_shell        = NULL,
+        .wl_surface            = NULL,
+        .wl_surface_callback   = NULL,
+        .wl_layer_surface      = NULL,
+        .surface_configured    = false,
         .wl_screencopy_manager = NULL,
-#endif
-        .wp_viewporter        = NULL,
-        .fractional_scale_mgr = NULL,
-        .running              = true,
-        .fractional_scale     = 0,
-        .result               = (struct rect){-1, -1, -1, -1},
-        .initial_area         = (struct rect){-1, -1, -1, -1},
+        .linux_dmabuf          = NULL,
+        .pending_capture       = NULL,
+        .detection_cache       = NULL,
+        .detection_watch       = NULL,
+        .dump_capture_dir      = NULL,
+        .replay_capture_file   = NULL,
+        .wp_viewporter         = NULL,
+        .fractional_scale_mgr  = NULL,
+        .running               = true,
+        .fractional_scale      = 0,
+        .result                = (struct rect){-1, -1, -1, -1},
+        .initial_area          = (struct rect){-1, -1, -1, -1},
         .home_row = (char *[]){"", "", "", "", "", "", "", "", "", "", ""},
         .click    = CLICK_NONE,
+        .num_fd_watches = 0,
     };
 
+    char *trace_file_name = getenv(TRACE_ENV_VAR);
+    if (trace_file_name != NULL && trace_init(trace_file_name) != 0) {
+        return 1;
+    }
+    trace_begin("startup");
+
     config_set_default(&state.config);
     struct config_loader config_loader;
     config_loader_init(&config_loader, &state.config);
@@ -691,19 +1119,30 @@ int main(int argc, char **argv) {
         {"config", required_argument, 0, 'c'},
         {"output", required_argument, 0, 'O'},
         {"only-print", no_argument, 0, 'p'},
+        {"daemon", no_argument, 0, 'd'},
+        {"trigger", no_argument, 0, 't'},
+        {"trace", required_argument, 0, 'T'},
+        {"dump-capture", required_argument, 0, 'D'},
+        {"replay-capture", required_argument, 0, 'P'},
         {NULL, 0, NULL, 0}
     };
 
-    int    num_cli_configs      = 0;
-    char **cli_configs          = malloc(10 * sizeof(char*));
-    int    cli_configs_len      = 10;
-    int    option_char          = 0;
-    int    option_index         = 0;
-    char  *config_filename      = NULL;
-    char  *selected_output_name = NULL;
-    bool   only_print           = false;
+    struct daemon_request request = {
+        .initial_area = (struct rect){-1, -1, -1, -1},
+        .output_name  = NULL,
+        .only_print   = false,
+    };
+
+    int    num_cli_configs = 0;
+    char **cli_configs     = malloc(10 * sizeof(char*));
+    int    cli_configs_len = 10;
+    int    option_char     = 0;
+    int    option_index    = 0;
+    char  *config_filename = NULL;
+    bool   daemon          = false;
+    bool   trigger         = false;
     while ((option_char = getopt_long(
-                argc, argv, "hvr:o:c:O:Rp", long_options, &option_index
+                argc, argv, "hvr:o:c:O:Rpdt", long_options, &option_index
             )) != -1) {
         switch (option_char) {
         case 'h':
@@ -717,11 +1156,7 @@ int main(int argc, char **argv) {
             return 0;
 
         case 'r':
-            if (sscanf(
-                    optarg, "%dx%d+%d+%d", &state.initial_area.w,
-                    &state.initial_area.h, &state.initial_area.x,
-                    &state.initial_area.y
-                ) != 4) {
+            if (rect_parse_str(optarg, &request.initial_area)) {
                 LOG_ERR("Could not parse --restrict argument.");
                 return 1;
             }
@@ -746,11 +1181,35 @@ int main(int argc, char **argv) {
             return 0;
 
         case 'O':
-            selected_output_name = strdup(optarg);
+            request.output_name = strdup(optarg);
             break;
 
         case 'p':
-            only_print = true;
+            request.only_print = true;
+            break;
+
+        case 'd':
+            daemon = true;
+            break;
+
+        case 't':
+            trigger = true;
+            break;
+
+        case 'T':
+            trace_finish();
+            if (trace_init(optarg) != 0) {
+                return 1;
+            }
+            trace_begin("startup");
+            break;
+
+        case 'D':
+            state.dump_capture_dir = optarg;
+            break;
+
+        case 'P':
+            state.replay_capture_file = optarg;
             break;
 
         default:
@@ -760,6 +1219,27 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (trigger) {
+        // The configuration is loaded once by the daemon.
+        if (num_cli_configs > 0 || config_filename != NULL) {
+            LOG_WARN("Configuration options are ignored with --trigger.");
+        }
+
+        free(config_filename);
+        free(cli_configs);
+        config_free_values(&state.config);
+
+        int status_code = daemon_trigger(&request);
+        daemon_request_free(&request);
+        return status_code;
+    }
+
+    if (daemon && (request.initial_area.w != -1 || request.output_name)) {
+        LOG_ERR("--restrict and --output must be passed with --trigger.");
+        return 1;
+    }
+
+    trace_begin("config");
     int err = config_loader_load_file(&config_loader, config_filename);
     if (err) {
         LOG_ERR("Failed to read configuration file.");
@@ -778,6 +1258,11 @@ int main(int argc, char **argv) {
     free(cli_configs);
     cli_configs = NULL;
 
+    // Replayed captures go through the detection like screenshots.
+    if (state.replay_capture_file != NULL) {
+        state.config.mode_floating.source = FLOATING_MODE_SOURCE_DETECT;
+    }
+
     if (state.config.general.home_row_keys != NULL) {
         state.home_row = state.config.general.home_row_keys;
     }
@@ -786,15 +1271,18 @@ int main(int argc, char **argv) {
         LOG_ERR("Could not load modes.");
         return 1;
     }
+    trace_end("config");
 
     wl_list_init(&state.outputs);
     wl_list_init(&state.seats);
 
+    trace_begin("wl_display_connect");
     state.wl_display = wl_display_connect(NULL);
     if (state.wl_display == NULL) {
         LOG_ERR("Failed to connect to Wayland compositor.");
         return 1;
     }
+    trace_end("wl_display_connect");
 
     state.wl_registry = wl_display_get_registry(state.wl_display);
     if (state.wl_registry == NULL) {
@@ -803,7 +1291,9 @@ int main(int argc, char **argv) {
     }
 
     wl_registry_add_listener(state.wl_registry, &wl_registry_listener, &state);
+    trace_begin("registry_roundtrip");
     wl_display_roundtrip(state.wl_display);
+    trace_end("registry_roundtrip");
 
     if (state.wl_compositor == NULL) {
         LOG_ERR("Failed to get wl_compositor object.");
@@ -820,7 +1310,7 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    if (state.wl_virtual_pointer_mgr == NULL && !only_print) {
+    if (state.wl_virtual_pointer_mgr == NULL && !request.only_print) {
         LOG_ERR("Failed to get wlr_virtual_pointer_manager_v1 object.");
         return 1;
     }
@@ -835,101 +1325,37 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    load_xdg_outputs(&state);
-
-    // This round trip should load the keymap which is needed to determine the
-    // home row keys.
-    wl_display_roundtrip(state.wl_display);
-
-    if (selected_output_name) {
-        state.current_output =
-            find_output_by_name(&state, selected_output_name);
-
-        if (!state.current_output) {
-            LOG_ERR("Could not find output '%s'.", selected_output_name);
-            return 1;
-        }
+    if (shm_pool_init(&state.shm_pool, state.wl_shm)) {
+        return 1;
+    }
 
-        free(selected_output_name);
-        selected_output_name = NULL;
-    } else if (state.initial_area.w != -1) {
-        state.current_output =
-            find_output_from_rect(&state, &state.initial_area);
+    // The outputs' and keymaps' events are not waited for here: the surface is
+    // created right away and the first mode is entered once they've all been
+    // received.
+    trace_end("startup");
 
-        if (!state.current_output) {
-            LOG_ERR("Could not find output containing given area.");
+    int status_code;
+    if (daemon) {
+        struct detection_cache detection_cache = {0};
+        struct detection_watch detection_watch;
+        if (detection_watch_init(&detection_watch, &state, &detection_cache)) {
             return 1;
         }
 
-        state.initial_area.x -= state.current_output->x;
-        state.initial_area.y -= state.current_output->y;
-    }
-
-    surface_buffer_pool_init(&state.surface_buffer_pool);
-
-    state.wl_surface = wl_compositor_create_surface(state.wl_compositor);
-    wl_surface_add_listener(state.wl_surface, &surface_listener, &state);
-    state.wl_layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-        state.wl_layer_shell, state.wl_surface,
-        state.current_output == NULL ? NULL : state.current_output->wl_output,
-        ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection"
-    );
-    zwlr_layer_surface_v1_add_listener(
-        state.wl_layer_surface, &wl_layer_surface_listener, &state
-    );
-    zwlr_layer_surface_v1_set_exclusive_zone(state.wl_layer_surface, -1);
-    zwlr_layer_surface_v1_set_anchor(
-        state.wl_layer_surface, ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
-                                    ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
-                                    ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
-                                    ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM
-    );
-    zwlr_layer_surface_v1_set_keyboard_interactivity(
-        state.wl_layer_surface, true
-    );
-
-    struct wp_fractional_scale_v1 *fractional_scale = NULL;
-    if (state.fractional_scale_mgr) {
-        fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
-            state.fractional_scale_mgr, state.wl_surface
-        );
-        wp_fractional_scale_v1_add_listener(
-            fractional_scale, &fractional_scale_listener, &state
-        );
-    }
-
-    state.wp_viewport =
-        wp_viewporter_get_viewport(state.wp_viewporter, state.wl_surface);
-
-    struct wl_region *wl_region =
-        wl_compositor_create_region(state.wl_compositor);
-    wl_region_add(wl_region, 0, 0, 0, 0);
-    wl_surface_set_input_region(state.wl_surface, wl_region);
-
-    wl_surface_commit(state.wl_surface);
-    while (state.running && wl_display_dispatch(state.wl_display)) {}
-
-    wp_viewport_destroy(state.wp_viewport);
-
-    zwlr_layer_surface_v1_destroy(state.wl_layer_surface);
-    wl_surface_destroy(state.wl_surface);
-    wl_region_destroy(wl_region);
+        state.detection_cache = &detection_cache;
+        state.detection_watch = &detection_watch;
+        status_code           = run_daemon(&state);
 
-    surface_buffer_pool_destroy(&state.surface_buffer_pool);
-    wl_display_roundtrip(state.wl_display);
-
-    int status_code = 0;
-    if (state.result.x != -1) {
-        print_result(&state);
-        if (!only_print) {
-            move_pointer(
-                &state, state.result.x + state.result.w / 2,
-                state.result.y + state.result.h / 2, state.click
-            );
-        }
+        detection_watch_finish(&detection_watch);
+        detection_cache_finish(&detection_cache);
+        state.detection_watch = NULL;
+        state.detection_cache = NULL;
     } else {
-        status_code = state.config.general.cancellation_status_code;
+        char result[DAEMON_MAX_RESULT_LEN];
+        status_code = run_session(&state, &request, result);
+        fputs(result, stdout);
     }
+    daemon_request_free(&request);
 
     if (state.wl_virtual_pointer_mgr != NULL) {
         zwlr_virtual_pointer_manager_v1_destroy(state.wl_virtual_pointer_mgr);
@@ -941,30 +1367,33 @@ int main(int argc, char **argv) {
     zxdg_output_manager_v1_destroy(state.xdg_output_manager);
 
     if (state.fractional_scale_mgr) {
-        wp_fractional_scale_v1_destroy(fractional_scale);
         wp_fractional_scale_manager_v1_destroy(state.fractional_scale_mgr);
     }
 
     wp_viewporter_destroy(state.wp_viewporter);
+    shm_pool_finish(&state.shm_pool);
     wl_shm_destroy(state.wl_shm);
     wl_compositor_destroy(state.wl_compositor);
     wl_registry_destroy(state.wl_registry);
     zwlr_layer_shell_v1_destroy(state.wl_layer_shell);
 
-#if OPENCV_ENABLED
     if (state.wl_screencopy_manager) {
         zwlr_screencopy_manager_v1_destroy(state.wl_screencopy_manager);
     }
-#endif
+
+    if (state.linux_dmabuf) {
+        zwp_linux_dmabuf_v1_destroy(state.linux_dmabuf);
+    }
 
     wl_display_disconnect(state.wl_display);
 
     config_free_values(&state.config);
-    free_mode_states(&state);
 
 #if DEBUG
     cairo_debug_reset_static_data();
 #endif
 
+    trace_finish();
+
     return status_code;
 }
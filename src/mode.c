@@ -64,6 +64,13 @@ int load_modes(struct state *state, char *modes) {
     return 0;
 }
 
+void prepare_first_mode(struct state *state, struct rect area) {
+    struct mode_interface *mode_interface = state->mode_interfaces[0];
+    if (mode_interface != NULL && mode_interface->prepare != NULL) {
+        mode_interface->prepare(state, area);
+    }
+}
+
 void enter_next_mode(struct state *state, struct rect area) {
     if (has_last_mode_returned(state)) {
         return;
@@ -118,13 +125,13 @@ void free_mode_states(struct state *state) {
     }
 }
 
-bool mode_handle_key(struct state *state, xkb_keysym_t sym, char *text) {
+bool mode_handle_key(struct state *state, xkb_keysym_t sym) {
     if (has_last_mode_returned(state)) {
         return false;
     }
 
     return state->mode_interfaces[state->current_mode]->key(
-        state, state->mode_states[state->current_mode], sym, text
+        state, state->mode_states[state->current_mode], sym
     );
 }
 void mode_render(struct state *state, cairo_t *cairo) {
@@ -11,9 +11,14 @@
 
 struct mode_interface {
     char *name;
+
+    // Optional. Called for the first mode as soon as the output and the area
+    // are known, before the surface is ready and the mode is entered.
+    void (*prepare)(struct state *, struct rect area);
+
     void *(*enter)(struct state *, struct rect area);
     void (*reenter)(struct state *, void *mode_state);
-    bool (*key)(struct state *, void *mode_state, xkb_keysym_t, char *text);
+    bool (*key)(struct state *, void *mode_state, xkb_keysym_t);
     void (*render)(struct state *, void *mode_state, cairo_t *);
     void (*free)(void *mode_state);
 };
@@ -26,11 +31,18 @@ extern struct mode_interface *mode_interfaces[];
  */
 int load_modes(struct state *, char *);
 
+void prepare_first_mode(struct state *, struct rect area);
 void enter_next_mode(struct state *, struct rect area);
 bool has_last_mode_returned(struct state *);
 bool reenter_prev_mode(struct state *);
 void free_mode_states(struct state *);
-bool mode_handle_key(struct state *, xkb_keysym_t, char *text);
+bool mode_handle_key(struct state *, xkb_keysym_t);
 void mode_render(struct state *, cairo_t *);
 
+/**
+ * `request_frame` redraws the surface at the next frame. Modes call it when
+ * their content changes other than on key presses.
+ */
+void request_frame(struct state *);
+
 #endif
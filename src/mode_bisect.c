@@ -437,7 +437,7 @@ bisect_mode_render(struct state *state, void *mode_state, cairo_t *cairo) {
 }
 
 static bool bisect_mode_key(
-    struct state *state, void *mode_state, xkb_keysym_t keysym, char *text
+    struct state *state, void *mode_state, xkb_keysym_t keysym
 ) {
     struct bisect_mode_state *ms = mode_state;
 
@@ -467,6 +467,9 @@ static bool bisect_mode_key(
         struct rect         *area     = &ms->areas[ms->current];
         enum bisect_division division = determine_division(area);
 
+        char text[64];
+        xkb_keysym_to_utf8(keysym, text, sizeof(text));
+
         int matched_i = find_str(state->home_row, HOME_ROW_LEN_WITH_BTN, text);
         if (matched_i < 0) {
             return false;
@@ -13,7 +13,7 @@ static void click_mode_reenter(struct state *state, void *mode_state) {
 }
 
 static bool click_mode_key(
-    struct state *state, void *mode_state, xkb_keysym_t keysym, char *text
+    struct state *state, void *mode_state, xkb_keysym_t keysym
 ) {
     return false;
 }
@@ -1,117 +1,749 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include "area_grid.h"
+#include "area_input.h"
+#include "capture_file.h"
 #include "config.h"
+#include "detection_cache.h"
+#include "detection_watch.h"
+#include "event_loop.h"
+#include "glyph_atlas.h"
 #include "log.h"
 #include "mode.h"
 #include "screencopy.h"
 #include "state.h"
 #include "target_detection.h"
+#include "trace.h"
 #include "utils.h"
 #include "utils_cairo.h"
 
 #include <cairo.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
 
 #define MIN_SUB_AREA_SIZE (25 * 50)
 
-static void get_areas_from_stdin(struct floating_mode_state *ms) {
-    size_t       areas_cap   = 256;
-    struct rect *areas       = malloc(sizeof(struct rect) * areas_cap);
-    int          areas_count = 0;
-    char        *buf         = NULL;
-    size_t       buf_n       = 0;
-
-    while (getline(&buf, &buf_n, stdin) >= 0) {
-        if (areas_count >= areas_cap) {
-            areas_cap *= 2;
-            areas      = realloc(areas, sizeof(struct rect) * areas_cap);
-        }
+// Font size of the placeholder shown while detecting targets.
+#define DETECTING_FONT_SIZE 20
+
+// Areas whose edges are all this close to another area's are duplicates.
+#define DUPLICATE_TOLERANCE 2
+
+// Areas are ordered along a Hilbert curve filling a square of
+// `1 << HILBERT_ORDER` positions wide.
+#define HILBERT_ORDER 16
+
+static void
+get_areas_from_stdin(struct state *state, struct floating_mode_state *ms) {
+    struct area_input input;
+    area_input_init(&input, state->config.mode_floating.stdin_format);
+
+    area_input_read_all(&input, STDIN_FILENO);
+
+    LOG_INFO("Got %d areas.", input.num_areas);
+
+    ms->areas     = input.areas;
+    ms->num_areas = input.num_areas;
+    input.areas   = NULL;
+    area_input_finish(&input);
+}
+
+static void dump_capture(
+    const char *dir, struct scrcpy_buffer *scrcpy_buffer,
+    enum wl_output_transform transform, struct rect area
+) {
+    static int num_dumps = 0;
+
+    time_t    now = time(NULL);
+    struct tm tm;
+    char      time_str[32];
+    localtime_r(&now, &tm);
+    strftime(time_str, sizeof(time_str), "%Y%m%d-%H%M%S", &tm);
+
+    char path[PATH_MAX];
+    snprintf(
+        path, sizeof(path), "%s/capture-%s-%d-%d.raw", dir, time_str, getpid(),
+        num_dumps++
+    );
+
+    struct capture_file capture = {
+        .format    = scrcpy_buffer->format,
+        .width     = scrcpy_buffer->width,
+        .height    = scrcpy_buffer->height,
+        .stride    = scrcpy_buffer->stride,
+        .transform = transform,
+        .area      = area,
+        .data      = scrcpy_buffer->data,
+    };
+
+    if (capture_file_write(path, &capture) == 0) {
+        LOG_INFO("Capture written to '%s'.", path);
+    }
+}
+
+/**
+ * `get_detect_max_pixels` returns the maximum number of pixels the detection
+ * runs on for a capture of `area`, or 0 for the capture's own resolution.
+ */
+static uint64_t get_detect_max_pixels(struct state *state, struct rect area) {
+    struct detect_resolution *res =
+        &state->config.mode_floating.detect_resolution;
+
+    switch (res->type) {
+    case DETECT_RESOLUTION_LOGICAL:
+        return (uint64_t)area.w * area.h;
+    case DETECT_RESOLUTION_MAX_PIXELS:
+        return res->max_pixels;
+    default:
+        return 0;
+    }
+}
+
+static target_detector_t get_detector(struct state *state) {
+#if OPENCV_ENABLED
+    if (state->config.mode_floating.detector == TARGET_DETECTOR_OPENCV) {
+        return compute_target_from_img_buffer;
+    }
+#endif
+
+    return detect_targets_native;
+}
 
-        struct rect *curr_area     = &areas[areas_count];
-        int          matched_count = sscanf(
-            buf, "%dx%d+%d+%d", &curr_area->w, &curr_area->h, &curr_area->x,
-            &curr_area->y
+/**
+ * `detect_targets` runs the configured target detector on a capture of
+ * `area` and returns the number of targets stored in `areas`. The daemon only
+ * runs it on the parts of the capture that changed since the previous one.
+ */
+static int detect_targets(
+    struct state *state, void *data, uint32_t height, uint32_t width,
+    uint32_t stride, enum wl_shm_format format,
+    enum wl_output_transform transform, struct rect area, struct rect **areas
+) {
+    uint64_t          max_pixels = get_detect_max_pixels(state, area);
+    target_detector_t detector   = get_detector(state);
+
+    if (state->detection_cache != NULL) {
+        return detection_cache_detect(
+            state->detection_cache, detector, data, height, width, stride,
+            format, transform, area, max_pixels, areas
         );
-        if (matched_count < 4) {
-            LOG_ERR("Error parsing '%s'. Skipping.", buf);
-            continue;
+    }
+
+    return detector(
+        data, height, width, stride, format, transform, area, 0, max_pixels,
+        areas, NULL
+    );
+}
+
+/**
+ * `has_watched_targets` tells whether the daemon's detection watch has up to
+ * date targets for a capture of `region`.
+ */
+static bool has_watched_targets(struct state *state, struct rect region) {
+    return state->detection_watch != NULL &&
+           detection_watch_has_targets(
+               state->detection_watch, state->current_output, region,
+               get_detector(state), get_detect_max_pixels(state, region)
+           );
+}
+
+/**
+ * `get_area_from_capture_file` runs the detection on a dumped capture. The
+ * targets are placed relative to `area` but the capture's own area size is
+ * used so that the detection behaves as it did originally.
+ */
+static void get_area_from_capture_file(
+    struct state *state, struct floating_mode_state *ms, struct rect area
+) {
+    ms->areas     = NULL;
+    ms->num_areas = 0;
+
+    struct capture_file capture;
+    if (capture_file_read(state->replay_capture_file, &capture)) {
+        return;
+    }
+
+    area.w = capture.area.w;
+    area.h = capture.area.h;
+
+    ms->num_areas = detect_targets(
+        state, capture.data, capture.height, capture.width, capture.stride,
+        capture.format, capture.transform, area, &ms->areas
+    );
+    capture_file_free(&capture);
+}
+
+/**
+ * A `detection_job` runs the target detection on a worker thread. A byte is
+ * written to `done_fds[1]` once it's done so that the event loop wakes up.
+ */
+struct detection_job {
+    struct state               *state;
+    struct floating_mode_state *ms;
+    struct scrcpy_buffer       *scrcpy_buffer;
+    enum wl_output_transform    transform;
+    struct rect                 area;
+    struct rect                *areas;
+    int                         num_areas;
+    pthread_t                   thread;
+    bool                        threaded;
+    int                         done_fds[2];
+};
+
+// This is so that we don't capture window borders.
+static struct rect get_capture_region(struct rect area) {
+    return (struct rect){area.x + 1, area.y + 1, area.w - 2, area.h - 2};
+}
+
+static bool is_duplicate(struct rect a, struct rect b) {
+    return abs(a.x - b.x) <= DUPLICATE_TOLERANCE &&
+           abs(a.y - b.y) <= DUPLICATE_TOLERANCE &&
+           abs(a.x + a.w - b.x - b.w) <= DUPLICATE_TOLERANCE &&
+           abs(a.y + a.h - b.y - b.h) <= DUPLICATE_TOLERANCE;
+}
+
+struct duplicate_search {
+    const struct rect *areas;
+    const bool        *removed;
+    int                idx;
+    bool               found;
+};
+
+static bool find_previous_duplicate(int idx, void *data) {
+    struct duplicate_search *search = data;
+
+    if (idx < search->idx && !search->removed[idx] &&
+        is_duplicate(search->areas[idx], search->areas[search->idx])) {
+        search->found = true;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * `filter_areas` removes the areas outside of the mode's area and the
+ * near-duplicates of previous areas. Duplicates are looked for with a grid so
+ * that tens of thousands of areas given on stdin stay manageable.
+ */
+static int filter_areas(struct rect area, struct rect *areas, int num_areas) {
+    int num_inside = 0;
+    for (int i = 0; i < num_areas; i++) {
+        struct rect a = areas[i];
+        if (a.x < area.x + area.w && area.x < a.x + a.w &&
+            a.y < area.y + area.h && area.y < a.y + a.h) {
+            areas[num_inside++] = a;
         }
+    }
 
-        areas_count++;
+    struct area_grid grid;
+    bool            *removed = calloc(max(num_inside, 1), sizeof(bool));
+    if (removed == NULL || area_grid_init(&grid, areas, num_inside, area)) {
+        free(removed);
+        return num_inside;
     }
 
-    free(buf);
+    for (int i = 0; i < num_inside; i++) {
+        struct duplicate_search search = {
+            .areas   = areas,
+            .removed = removed,
+            .idx     = i,
+        };
+        struct rect near = {
+            areas[i].x - DUPLICATE_TOLERANCE,
+            areas[i].y - DUPLICATE_TOLERANCE,
+            areas[i].w + 2 * DUPLICATE_TOLERANCE,
+            areas[i].h + 2 * DUPLICATE_TOLERANCE,
+        };
+        area_grid_query(&grid, near, find_previous_duplicate, &search);
+        removed[i] = search.found;
+    }
 
-    LOG_INFO("Got %d areas.", areas_count);
+    area_grid_finish(&grid);
 
-    ms->areas     = areas;
-    ms->num_areas = areas_count;
+    int num_kept = 0;
+    for (int i = 0; i < num_inside; i++) {
+        if (!removed[i]) {
+            areas[num_kept++] = areas[i];
+        }
+    }
+    free(removed);
+
+    LOG_DEBUG(
+        "Removed %d areas outside of the mode's area and %d duplicates.",
+        num_areas - num_inside, num_inside - num_kept
+    );
+
+    return num_kept;
 }
 
-#if OPENCV_ENABLED
+/**
+ * `hilbert_index` returns the distance of (`x`, `y`) along a Hilbert curve.
+ * Points close along it are close on screen.
+ */
+static uint64_t hilbert_index(uint32_t x, uint32_t y) {
+    uint32_t size = 1 << HILBERT_ORDER;
+    uint64_t idx  = 0;
+
+    for (uint32_t s = size / 2; s > 0; s /= 2) {
+        uint32_t rx  = (x & s) != 0;
+        uint32_t ry  = (y & s) != 0;
+        idx         += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+        // Rotates the quadrant so that the curve continues from the previous
+        // one.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = size - 1 - x;
+                y = size - 1 - y;
+            }
+
+            uint32_t tmp = x;
+            x            = y;
+            y            = tmp;
+        }
+    }
 
-static void get_area_from_screenshot(
-    struct state *state, struct floating_mode_state *ms, struct rect area
+    return idx;
+}
+
+/**
+ * `get_curve_position` returns the position of `a`'s center on the Hilbert
+ * curve filling `area`.
+ */
+static uint64_t get_curve_position(struct rect area, struct rect a) {
+    uint32_t max_pos = (1 << HILBERT_ORDER) - 1;
+
+    // Doubled coordinates keep the centers exact.
+    int64_t x = min(max(2 * (a.x - area.x) + a.w, 0), 2 * area.w);
+    int64_t y = min(max(2 * (a.y - area.y) + a.h, 0), 2 * area.h);
+
+    return hilbert_index(
+        x * max_pos / max(2 * area.w, 1), y * max_pos / max(2 * area.h, 1)
+    );
+}
+
+static uint64_t get_center_distance(struct rect area, struct rect a) {
+    int64_t dx = 2 * (a.x - area.x) + a.w - area.w;
+    int64_t dy = 2 * (a.y - area.y) + a.h - area.h;
+    return dx * dx + dy * dy;
+}
+
+struct ordered_area {
+    uint64_t    key;
+    int         idx;
+    struct rect rect;
+};
+
+static int compare_ordered_areas(const void *a, const void *b) {
+    const struct ordered_area *oa = a;
+    const struct ordered_area *ob = b;
+
+    if (oa->key != ob->key) {
+        return oa->key < ob->key ? -1 : 1;
+    }
+
+    // Keeps the input order of areas at the same place.
+    return oa->idx - ob->idx;
+}
+
+/**
+ * `order_areas` sorts the areas so that those given the first labels come
+ * first.
+ */
+static void order_areas(
+    enum floating_label_order order, struct rect area, struct rect *areas,
+    int num_areas
+) {
+    if (order == FLOATING_LABEL_ORDER_INPUT || num_areas < 2) {
+        return;
+    }
+
+    struct ordered_area *ordered = malloc(sizeof(*ordered) * num_areas);
+    if (ordered == NULL) {
+        LOG_WARN("Could not order areas, keeping their input order.");
+        return;
+    }
+
+    for (int i = 0; i < num_areas; i++) {
+        ordered[i] = (struct ordered_area){
+            .key  = order == FLOATING_LABEL_ORDER_HILBERT
+                        ? get_curve_position(area, areas[i])
+                        : get_center_distance(area, areas[i]),
+            .idx  = i,
+            .rect = areas[i],
+        };
+    }
+
+    qsort(ordered, num_areas, sizeof(*ordered), compare_ordered_areas);
+
+    for (int i = 0; i < num_areas; i++) {
+        areas[i] = ordered[i].rect;
+    }
+    free(ordered);
+}
+
+/**
+ * `new_label_selection` creates a selection of the areas' labels. They are
+ * shortened around the center when areas are ordered from it.
+ */
+static label_selection_t *
+new_label_selection(struct state *state, struct floating_mode_state *ms) {
+    label_selection_t *selection =
+        label_selection_new(ms->label_symbols, ms->num_areas);
+
+    if (state->config.mode_floating.label_order ==
+        FLOATING_LABEL_ORDER_CENTER) {
+        label_selection_shorten(selection);
+    }
+
+    return selection;
+}
+
+static void set_areas(
+    struct state *state, struct floating_mode_state *ms, struct rect *areas,
+    int num_areas
 ) {
-    // This is so that we don't capture window borders.
-    area.x += 1;
-    area.y += 1;
-    area.h -= 2;
-    area.w -= 2;
-
-    struct scrcpy_buffer    *scrcpy_buffer = query_screenshot(state, area);
-    enum wl_output_transform output_transform =
-        state->current_output->transform;
-    ms->num_areas = compute_target_from_img_buffer(
-        scrcpy_buffer->data, scrcpy_buffer->height, scrcpy_buffer->width,
-        scrcpy_buffer->stride, scrcpy_buffer->format, output_transform, area,
-        &ms->areas
+    ms->areas     = areas;
+    ms->num_areas = filter_areas(ms->area, areas, num_areas);
+    ms->detecting = false;
+
+    order_areas(
+        state->config.mode_floating.label_order, ms->area, ms->areas,
+        ms->num_areas
     );
-    destroy_scrcpy_buffer(scrcpy_buffer);
+    ms->label_selection = new_label_selection(state, ms);
 }
 
-#endif
+/**
+ * A `stdin_stream` reads areas from the standard input as they come. They are
+ * labelled again at most once per frame when some were added.
+ */
+struct stdin_stream {
+    struct state               *state;
+    struct floating_mode_state *ms;
+    struct area_input           input;
+
+    // Number of areas the labels were last given for.
+    int num_labelled;
+
+    // Flags of the standard input before it was made non-blocking. They are
+    // shared with the other processes using it so they are restored.
+    int stdin_flags;
+};
+
+static void finish_stdin_stream(struct stdin_stream *stream) {
+    event_loop_remove_fd(stream->state, STDIN_FILENO);
+    fcntl(STDIN_FILENO, F_SETFL, stream->stdin_flags);
+    area_input_finish(&stream->input);
+    free(stream);
+}
+
+static void relabel_streamed_areas(struct stdin_stream *stream) {
+    struct floating_mode_state *ms        = stream->ms;
+    int                         num_areas = stream->input.num_areas;
+
+    struct rect *areas = malloc(sizeof(struct rect) * max(num_areas, 1));
+    if (areas == NULL) {
+        LOG_ERR("Could not allocate areas.");
+        return;
+    }
+    memcpy(areas, stream->input.areas, sizeof(struct rect) * num_areas);
+
+    free(ms->areas);
+    label_selection_t *typed = ms->label_selection;
+    set_areas(stream->state, ms, areas, num_areas);
+    stream->num_labelled = num_areas;
+
+    // What was typed is kept as long as labels still start with it.
+    for (int i = 0; i < typed->next; i++) {
+        if (label_selection_append(ms->label_selection, typed->input[i]) !=
+            LABEL_SELECTION_APPEND_SUCCESS) {
+            break;
+        }
+    }
+    label_selection_free(typed);
+}
+
+/**
+ * `update_streamed_areas` labels the areas read since the last time, if any.
+ * It's done when they are needed rather than on each read so that a slow
+ * writer doesn't have all areas labelled again for each line.
+ */
+static void update_streamed_areas(struct floating_mode_state *ms) {
+    struct stdin_stream *stream = ms->stdin_stream;
+    if (stream != NULL && stream->input.num_areas != stream->num_labelled) {
+        relabel_streamed_areas(stream);
+    }
+}
+
+static void handle_stdin(struct state *state, int fd, void *data) {
+    struct stdin_stream *stream    = data;
+    int                  num_areas = stream->input.num_areas;
+
+    int ret = area_input_read(&stream->input, fd);
+    if (stream->input.num_areas != num_areas) {
+        request_frame(state);
+    }
+
+    if (ret <= 0) {
+        LOG_INFO("Got %d areas.", stream->input.num_areas);
+        update_streamed_areas(stream->ms);
+        stream->ms->stdin_stream = NULL;
+        finish_stdin_stream(stream);
+    }
+}
+
+/**
+ * `start_stdin_stream` shows the areas given on the standard input as they
+ * come instead of waiting for its end.
+ */
+static void
+start_stdin_stream(struct state *state, struct floating_mode_state *ms) {
+    struct stdin_stream *stream = calloc(1, sizeof(*stream));
+    stream->state               = state;
+    stream->ms                  = ms;
+    area_input_init(&stream->input, state->config.mode_floating.stdin_format);
+
+    set_areas(state, ms, NULL, 0);
+
+    int flags           = fcntl(STDIN_FILENO, F_GETFL);
+    stream->stdin_flags = flags;
+    if (flags >= 0 &&
+        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) == 0 &&
+        event_loop_add_fd(state, STDIN_FILENO, handle_stdin, stream) == 0) {
+        ms->stdin_stream = stream;
+        return;
+    }
+
+    LOG_WARN("Could not watch the standard input, reading it all at once.");
+    if (flags >= 0) {
+        fcntl(STDIN_FILENO, F_SETFL, flags);
+    }
+
+    area_input_read_all(&stream->input, STDIN_FILENO);
+    relabel_streamed_areas(stream);
+    area_input_finish(&stream->input);
+    free(stream);
+}
+
+static void *run_detection_job(void *data) {
+    struct detection_job *job = data;
+
+    job->num_areas = detect_targets(
+        job->state, job->scrcpy_buffer->data, job->scrcpy_buffer->height,
+        job->scrcpy_buffer->width, job->scrcpy_buffer->stride,
+        job->scrcpy_buffer->format, job->transform, job->area, &job->areas
+    );
+
+    char c = 0;
+    while (write(job->done_fds[1], &c, 1) < 0 && errno == EINTR) {}
+
+    return NULL;
+}
+
+static void finish_detection_job(struct detection_job *job) {
+    event_loop_remove_fd(job->state, job->done_fds[0]);
+    if (job->threaded) {
+        pthread_join(job->thread, NULL);
+    }
+    close(job->done_fds[0]);
+    close(job->done_fds[1]);
+    destroy_scrcpy_buffer(job->scrcpy_buffer);
+}
+
+static void handle_detection_done(struct state *state, int fd, void *data) {
+    struct detection_job       *job = data;
+    struct floating_mode_state *ms  = job->ms;
+    trace_end("detection");
+
+    finish_detection_job(job);
+    ms->detection_job = NULL;
+
+    set_areas(state, ms, job->areas, job->num_areas);
+    free(job);
+    request_frame(state);
+}
+
+static void handle_capture_done(
+    struct state *state, struct scrcpy_buffer *scrcpy_buffer, void *data
+) {
+    struct floating_mode_state *ms = data;
+    ms->capture                    = NULL;
+
+    // The output's transform is needed to map the targets back.
+    if (scrcpy_buffer == NULL || state->current_output == NULL) {
+        if (scrcpy_buffer != NULL) {
+            LOG_ERR("Capture done without an output, no targets detected.");
+            destroy_scrcpy_buffer(scrcpy_buffer);
+        }
+
+        set_areas(state, ms, NULL, 0);
+        request_frame(state);
+        return;
+    }
+
+    struct rect              region    = get_capture_region(ms->area);
+    enum wl_output_transform transform = state->current_output->transform;
+
+    if (state->dump_capture_dir != NULL) {
+        dump_capture(state->dump_capture_dir, scrcpy_buffer, transform, region);
+    }
+
+    // The region is watched for changes once the selection is done.
+    if (state->detection_watch != NULL) {
+        detection_watch_set(
+            state->detection_watch, state->current_output, region,
+            get_detector(state), get_detect_max_pixels(state, region)
+        );
+    }
+
+    struct detection_job *job = calloc(1, sizeof(*job));
+    job->state                = state;
+    job->ms                   = ms;
+    job->scrcpy_buffer        = scrcpy_buffer;
+    job->transform            = transform;
+    job->area                 = region;
+
+    if (pipe2(job->done_fds, O_CLOEXEC) != 0) {
+        LOG_ERR("Could not create detection pipe.");
+        destroy_scrcpy_buffer(scrcpy_buffer);
+        free(job);
+        set_areas(state, ms, NULL, 0);
+        request_frame(state);
+        return;
+    }
+
+    trace_begin("detection");
+    job->threaded =
+        pthread_create(&job->thread, NULL, run_detection_job, job) == 0;
+    if (!job->threaded) {
+        // Running it here delays the placeholder but still works.
+        run_detection_job(job);
+    }
+
+    if (event_loop_add_fd(
+            state, job->done_fds[0], handle_detection_done, job
+        )) {
+        LOG_ERR("Could not wait for detection in the background.");
+        trace_end("detection");
+
+        // Finishing the job waits for the detection so its targets can
+        // still be shown.
+        finish_detection_job(job);
+        set_areas(state, ms, job->areas, job->num_areas);
+        free(job);
+        request_frame(state);
+        return;
+    }
+
+    ms->detection_job = job;
+
+    // Shows that the targets are being detected.
+    request_frame(state);
+}
+
+static void floating_mode_prepare(struct state *state, struct rect area) {
+    struct rect region = get_capture_region(area);
+
+    if (state->config.mode_floating.source == FLOATING_MODE_SOURCE_DETECT &&
+        state->replay_capture_file == NULL &&
+        !has_watched_targets(state, region)) {
+        state->pending_capture =
+            request_screenshot(state, state->current_output, region);
+    }
+}
+
+static void start_detection(
+    struct state *state, struct floating_mode_state *ms, struct rect area
+) {
+    if (state->replay_capture_file != NULL) {
+        get_area_from_capture_file(state, ms, get_capture_region(area));
+        set_areas(state, ms, ms->areas, ms->num_areas);
+        return;
+    }
+
+    struct rect            region  = get_capture_region(area);
+    struct scrcpy_request *capture = state->pending_capture;
+    state->pending_capture         = NULL;
+
+    if (has_watched_targets(state, region)) {
+        LOG_DEBUG("Screen unchanged since the targets were detected.");
+        if (capture != NULL) {
+            cancel_screenshot(capture);
+        }
+
+        struct rect *areas;
+        int          num_areas = detection_watch_get_targets(
+            state->detection_watch, state->current_output, region,
+            get_detector(state), get_detect_max_pixels(state, region), &areas
+        );
+        set_areas(state, ms, areas, num_areas);
+        return;
+    }
+
+    if (capture != NULL && memcmp(&capture->region, &region, sizeof(region))) {
+        LOG_DEBUG("Area changed since the screen capture was requested.");
+        cancel_screenshot(capture);
+        capture = NULL;
+    }
+
+    if (capture == NULL) {
+        capture = request_screenshot(state, state->current_output, region);
+    }
+
+    if (capture == NULL) {
+        set_areas(state, ms, NULL, 0);
+        return;
+    }
+
+    ms->detecting = true;
+    ms->capture   = capture;
+    scrcpy_request_set_handler(capture, handle_capture_done, ms);
+}
 
 void *floating_mode_enter(struct state *state, struct rect area) {
-    struct floating_mode_state *ms = malloc(sizeof(*ms));
+    struct floating_mode_state *ms = calloc(1, sizeof(*ms));
+    ms->area                       = area;
 
     ms->label_symbols =
         label_symbols_from_str(state->config.mode_floating.label_symbols);
 
     if (ms->label_symbols == NULL) {
-        ms->areas           = NULL;
-        ms->label_selection = NULL;
-        state->running      = false;
+        state->running = false;
         return ms;
     }
 
+    ms->label_font_face = cairo_toy_font_face_create(
+        state->config.mode_floating.label_font_family, CAIRO_FONT_SLANT_NORMAL,
+        CAIRO_FONT_WEIGHT_NORMAL
+    );
+    ms->glyph_atlas = glyph_atlas_new(ms->label_symbols, ms->label_font_face);
+
     switch (state->config.mode_floating.source) {
     case FLOATING_MODE_SOURCE_STDIN:
-        get_areas_from_stdin(ms);
+        if (state->config.mode_floating.stdin_stream) {
+            start_stdin_stream(state, ms);
+            break;
+        }
+
+        get_areas_from_stdin(state, ms);
+        set_areas(state, ms, ms->areas, ms->num_areas);
         break;
     case FLOATING_MODE_SOURCE_DETECT:
-#if OPENCV_ENABLED
-        get_area_from_screenshot(state, ms, area);
-#else
-        // This should not happen as the value is checked when loading the
-        // configuration.
-        LOG_ERR("Binary not built with OpenCV support.");
-        exit(1);
-#endif
+        start_detection(state, ms, area);
         break;
     }
 
-    ms->label_selection = label_selection_new(ms->label_symbols, ms->num_areas);
-
-    ms->label_font_face = cairo_toy_font_face_create(
-        state->config.mode_floating.label_font_family, CAIRO_FONT_SLANT_NORMAL,
-        CAIRO_FONT_WEIGHT_NORMAL
-    );
-
     return ms;
 }
 
@@ -121,9 +753,18 @@ void floating_mode_reenter(struct state *state, void *mode_state) {
 }
 
 static bool floating_mode_key(
-    struct state *state, void *mode_state, xkb_keysym_t keysym, char *text
+    struct state *state, void *mode_state, xkb_keysym_t keysym
 ) {
     struct floating_mode_state *ms = mode_state;
+    update_streamed_areas(ms);
+
+    if (ms->detecting) {
+        if (keysym == XKB_KEY_Escape) {
+            state->running = false;
+        }
+
+        return false;
+    }
 
     switch (keysym) {
     case XKB_KEY_BackSpace:
@@ -133,7 +774,9 @@ static bool floating_mode_key(
         state->running = false;
         break;
     default:;
-        int symbol_idx = label_symbols_find_idx(ms->label_symbols, text);
+        int symbol_idx = label_symbols_find_rune(
+            ms->label_symbols, xkb_keysym_to_utf32(keysym)
+        );
         if (symbol_idx < 0) {
             return false;
         }
@@ -150,90 +793,96 @@ static bool floating_mode_key(
     return false;
 }
 
+/**
+ * `render_detecting` draws a placeholder while the targets are being
+ * detected. Nothing is drawn while the screen is being captured so that the
+ * overlay doesn't end up in the capture.
+ */
+static void render_detecting(
+    struct state *state, struct floating_mode_state *ms, cairo_t *cairo
+) {
+    struct mode_floating_config *config = &state->config.mode_floating;
+
+    cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+
+    if (ms->capture != NULL) {
+        cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+        cairo_paint(cairo);
+        return;
+    }
+
+    cairo_set_source_u32(cairo, config->unselectable_bg_color);
+    cairo_paint(cairo);
+
+    static const char *text = "Detecting…";
+
+    cairo_text_extents_t extents;
+    cairo_set_font_face(cairo, ms->label_font_face);
+    cairo_set_font_size(cairo, DETECTING_FONT_SIZE);
+    cairo_text_extents(cairo, text, &extents);
+
+    cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+    cairo_set_source_u32(cairo, config->label_color);
+    cairo_move_to(
+        cairo,
+        ms->area.x + (ms->area.w - extents.width) / 2 - extents.x_bearing,
+        ms->area.y + (ms->area.h - extents.height) / 2 - extents.y_bearing
+    );
+    cairo_show_text(cairo, text);
+}
+
 void floating_mode_render(
     struct state *state, void *mode_state, cairo_t *cairo
 ) {
     struct floating_mode_state  *ms     = mode_state;
     struct mode_floating_config *config = &state->config.mode_floating;
 
-    label_selection_t *curr_label =
-        label_selection_new(ms->label_symbols, ms->num_areas);
-    label_selection_set_from_idx(curr_label, 0);
+    update_streamed_areas(ms);
+    if (ms->detecting) {
+        render_detecting(state, ms, cairo);
+        return;
+    }
 
-    int  label_str_max_len = label_selection_str_max_len(curr_label) + 1;
-    char label_selected_str[label_str_max_len];
-    char label_unselected_str[label_str_max_len];
-
-    cairo_set_font_face(cairo, ms->label_font_face);
+    label_selection_t *curr_label = new_label_selection(state, ms);
+    label_selection_t *selection  = ms->label_selection;
 
     cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
     cairo_set_source_u32(cairo, config->unselectable_bg_color);
     cairo_paint(cairo);
 
+    // Only the areas whose label starts with the selection are drawn.
     cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-    for (int i = 0; i < ms->num_areas; i++) {
-        const bool selectable =
-            label_selection_is_included(curr_label, ms->label_selection);
-
-        if (selectable) {
-            struct rect a = ms->areas[i];
-            cairo_set_source_rgba(cairo, 0, 0, 0, 0);
-            cairo_rectangle(cairo, a.x, a.y, a.w, a.h);
-            cairo_fill(cairo);
-        }
-
-        label_selection_incr(curr_label);
+    cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+    for (int i = label_selection_first_match(selection); i >= 0;
+         i      = label_selection_next_match(selection, i)) {
+        struct rect a = ms->areas[i];
+        cairo_rectangle(cairo, a.x, a.y, a.w, a.h);
+        cairo_fill(cairo);
     }
 
-    label_selection_set_from_idx(curr_label, 0);
-    for (int i = 0; i < ms->num_areas; i++) {
+    for (int i = label_selection_first_match(selection); i >= 0;
+         i      = label_selection_next_match(selection, i)) {
         struct rect a = ms->areas[i];
 
-        const bool selectable =
-            label_selection_is_included(curr_label, ms->label_selection);
-
-        if (selectable) {
-            cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
-            cairo_set_source_u32(cairo, config->selectable_bg_color);
-            cairo_rectangle(cairo, a.x, a.y, a.w, a.h);
-            cairo_fill(cairo);
-
-            cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-            cairo_set_source_u32(cairo, config->selectable_border_color);
-            cairo_rectangle(cairo, a.x + .5, a.y + .5, a.w - 1, a.h - 1);
-            cairo_set_line_width(cairo, 1);
-            cairo_stroke(cairo);
-
-            cairo_set_font_size(
-                cairo, compute_relative_font_size(&config->label_font_size, a.h)
-            );
-            cairo_text_extents_t te_all;
-            label_selection_str(curr_label, label_selected_str);
-            cairo_text_extents(cairo, label_selected_str, &te_all);
-
-            label_selection_str_split(
-                curr_label, label_selected_str, label_unselected_str,
-                ms->label_selection->next
-            );
-
-            cairo_text_extents_t te_selected, te_unselected;
-            cairo_text_extents(cairo, label_selected_str, &te_selected);
-            cairo_text_extents(cairo, label_unselected_str, &te_unselected);
-
-            cairo_move_to(
-                cairo,
-                a.x +
-                    (a.w - te_selected.x_advance - te_unselected.x_advance) / 2,
-                a.y + (int)((a.h + te_all.height) / 2)
-            );
-            cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
-            cairo_set_source_u32(cairo, config->label_select_color);
-            cairo_show_text(cairo, label_selected_str);
-            cairo_set_source_u32(cairo, config->label_color);
-            cairo_show_text(cairo, label_unselected_str);
-        }
-
-        label_selection_incr(curr_label);
+        cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+        cairo_set_source_u32(cairo, config->selectable_bg_color);
+        cairo_rectangle(cairo, a.x, a.y, a.w, a.h);
+        cairo_fill(cairo);
+
+        cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_u32(cairo, config->selectable_border_color);
+        cairo_rectangle(cairo, a.x + .5, a.y + .5, a.w - 1, a.h - 1);
+        cairo_set_line_width(cairo, 1);
+        cairo_stroke(cairo);
+
+        cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+        label_selection_set_from_idx(curr_label, i);
+        glyph_atlas_draw_label(
+            ms->glyph_atlas, cairo,
+            compute_relative_font_size(&config->label_font_size, a.h), a,
+            curr_label, selection->next, config->label_select_color,
+            config->label_color
+        );
     }
 
     label_selection_free(curr_label);
@@ -241,15 +890,41 @@ void floating_mode_render(
 
 void floating_mode_free(void *mode_state) {
     struct floating_mode_state *ms = mode_state;
+
+    if (ms->capture != NULL) {
+        cancel_screenshot(ms->capture);
+    }
+
+    if (ms->stdin_stream != NULL) {
+        finish_stdin_stream(ms->stdin_stream);
+    }
+
+    // The detection can't be interrupted so it has to be waited for.
+    if (ms->detection_job != NULL) {
+        finish_detection_job(ms->detection_job);
+        free(ms->detection_job->areas);
+        free(ms->detection_job);
+    }
+
     free(ms->areas);
-    cairo_font_face_destroy(ms->label_font_face);
-    label_selection_free(ms->label_selection);
-    label_symbols_free(ms->label_symbols);
+    if (ms->glyph_atlas != NULL) {
+        glyph_atlas_free(ms->glyph_atlas);
+    }
+    if (ms->label_font_face != NULL) {
+        cairo_font_face_destroy(ms->label_font_face);
+    }
+    if (ms->label_selection != NULL) {
+        label_selection_free(ms->label_selection);
+    }
+    if (ms->label_symbols != NULL) {
+        label_symbols_free(ms->label_symbols);
+    }
     free(ms);
 }
 
 struct mode_interface floating_mode_interface = {
     .name    = "floating",
+    .prepare = floating_mode_prepare,
     .enter   = floating_mode_enter,
     .reenter = floating_mode_reenter,
     .key     = floating_mode_key,
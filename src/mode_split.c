@@ -271,7 +271,7 @@ split_mode_split(struct state *state, void *mode_state, enum split_dir dir) {
 }
 
 static bool split_mode_key(
-    struct state *state, void *mode_state, xkb_keysym_t keysym, char *text
+    struct state *state, void *mode_state, xkb_keysym_t keysym
 ) {
     struct split_mode_state *ms = mode_state;
 
@@ -307,6 +307,9 @@ static bool split_mode_key(
         return split_mode_split(state, mode_state, SPLIT_DIR_DOWN);
     }
 
+    char text[64];
+    xkb_keysym_to_utf8(keysym, text, sizeof(text));
+
     int matched_i = find_str(state->home_row, HOME_ROW_LEN_WITH_BTN, text);
     switch (matched_i) {
     case HOME_ROW_LEFT_CLICK:
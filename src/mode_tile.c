@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include "config.h"
+#include "glyph_atlas.h"
 #include "label.h"
 #include "mode.h"
 #include "state.h"
@@ -15,6 +16,19 @@
 
 #define MIN_SUB_AREA_SIZE (25 * 50)
 
+static uint32_t next_generation = 1;
+
+/**
+ * A `label_prefix` is the part of the label typed so far. The labels of the
+ * cells that start with it have an index equal to `value` modulo `modulo` as
+ * labels are little-endian.
+ */
+struct label_prefix {
+    int len;
+    int value;
+    int modulo;
+};
+
 void *tile_mode_enter(struct state *state, struct rect area) {
     struct tile_mode_state *ms = malloc(sizeof(*ms));
     ms->area                   = area;
@@ -56,6 +70,9 @@ void *tile_mode_enter(struct state *state, struct rect area) {
         state->config.mode_tile.label_font_family, CAIRO_FONT_SLANT_NORMAL,
         CAIRO_FONT_WEIGHT_NORMAL
     );
+    ms->glyph_atlas = glyph_atlas_new(ms->label_symbols, ms->label_font_face);
+
+    ms->generation = next_generation++;
 
     return ms;
 }
@@ -91,7 +108,7 @@ idx_to_rect(struct tile_mode_state *mode_state, int idx, int x_off, int y_off) {
 }
 
 static bool tile_mode_key(
-    struct state *state, void *mode_state, xkb_keysym_t keysym, char *text
+    struct state *state, void *mode_state, xkb_keysym_t keysym
 ) {
     struct tile_mode_state *ms = mode_state;
 
@@ -104,7 +121,9 @@ static bool tile_mode_key(
         state->running = false;
         break;
     default:;
-        int symbol_idx = label_symbols_find_idx(ms->label_symbols, text);
+        int symbol_idx = label_symbols_find_rune(
+            ms->label_symbols, xkb_keysym_to_utf32(keysym)
+        );
         if (symbol_idx < 0) {
             return false;
         }
@@ -123,15 +142,116 @@ static bool tile_mode_key(
     return false;
 }
 
+// The content id of a frame is made of the state's generation and of the typed
+// prefix of the label.
+static uint64_t tile_mode_content_id(struct tile_mode_state *mode_state) {
+    label_selection_t *selection   = mode_state->label_selection;
+    int                num_symbols = selection->label_symbols->num_symbols;
+
+    uint32_t value  = 0;
+    uint32_t factor = 1;
+    for (int i = 0; i < selection->next; i++) {
+        value  += selection->input[i] * factor;
+        factor *= num_symbols;
+    }
+
+    return (uint64_t)mode_state->generation << 32 | value << 8 |
+           selection->next;
+}
+
+// `content_id_to_prefix` returns false if the content was not rendered by this
+// state.
+static bool content_id_to_prefix(
+    struct tile_mode_state *mode_state, uint64_t content_id,
+    struct label_prefix *prefix
+) {
+    if (content_id >> 32 != mode_state->generation) {
+        return false;
+    }
+
+    prefix->len    = content_id & 0xff;
+    prefix->value  = (content_id & 0xffffffff) >> 8;
+    prefix->modulo = 1;
+    for (int i = 0; i < prefix->len; i++) {
+        prefix->modulo *= mode_state->label_symbols->num_symbols;
+    }
+
+    return true;
+}
+
+static bool label_prefix_matches(struct label_prefix *prefix, int idx) {
+    return idx % prefix->modulo == prefix->value;
+}
+
+// A cell looks different with two prefixes when it's selectable with either
+// of them: either its background changes or the typed part of its label does.
+static bool has_cell_changed(
+    struct label_prefix *from, struct label_prefix *to, int idx
+) {
+    if (from->len == to->len && from->value == to->value) {
+        return false;
+    }
+
+    return label_prefix_matches(from, idx) || label_prefix_matches(to, idx);
+}
+
+/**
+ * `add_changed_cells_damage` damages the cells that differ from what's in the
+ * buffer and from what's currently displayed. Returns false if either wasn't
+ * rendered by this state in which case everything has to be redrawn.
+ */
+static bool add_changed_cells_damage(
+    struct state *state, struct tile_mode_state *mode_state,
+    struct surface_buffer *buffer, uint64_t content_id
+) {
+    struct label_prefix curr, prev, committed;
+    if (!content_id_to_prefix(mode_state, content_id, &curr) ||
+        !content_id_to_prefix(mode_state, buffer->prev_content_id, &prev) ||
+        !content_id_to_prefix(
+            mode_state, state->committed_content_id, &committed
+        )) {
+        return false;
+    }
+
+    buffer->damage_full = false;
+
+    struct rect *area      = &mode_state->area;
+    int          num_cells = mode_state->sub_area_columns *
+                    mode_state->sub_area_rows;
+    for (int idx = 0; idx < num_cells; idx++) {
+        if (has_cell_changed(&prev, &curr, idx) ||
+            has_cell_changed(&committed, &curr, idx)) {
+            surface_buffer_add_damage(
+                buffer, idx_to_rect(mode_state, idx, area->x, area->y)
+            );
+        }
+    }
+
+    return true;
+}
+
 void tile_mode_render(struct state *state, void *mode_state, cairo_t *cairo) {
     struct mode_tile_config *config = &state->config.mode_tile;
     struct tile_mode_state  *ms     = mode_state;
+    struct surface_buffer   *buffer = state->current_buffer;
+
+    // After the first frame, only the cells whose label or background changed
+    // are redrawn.
+    uint64_t content_id = tile_mode_content_id(ms);
+    bool     partial = add_changed_cells_damage(state, ms, buffer, content_id);
+    buffer->content_id = content_id;
 
-    cairo_set_font_face(cairo, ms->label_font_face);
-    cairo_set_font_size(
-        cairo, compute_relative_font_size(
-                   &config->label_font_size, ms->sub_area_height
-               )
+    if (partial) {
+        if (buffer->num_damage == 0) {
+            return;
+        }
+
+        cairo_save(cairo);
+        surface_buffer_clip_damage(buffer, cairo);
+    }
+
+    const double font_size = compute_relative_font_size(
+        &config->label_font_size, ms->sub_area_height
     );
 
     cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
@@ -148,73 +268,49 @@ void tile_mode_render(struct state *state, void *mode_state, cairo_t *cairo) {
     label_selection_t *curr_label = label_selection_new(
         ms->label_symbols, ms->sub_area_columns * ms->sub_area_rows
     );
-    label_selection_set_from_idx(curr_label, 0);
-
-    int  label_str_max_len = label_selection_str_max_len(curr_label) + 1;
-    char label_selected_str[label_str_max_len];
-    char label_unselected_str[label_str_max_len];
-
-    for (int i = 0; i < ms->sub_area_columns; i++) {
-        for (int j = 0; j < ms->sub_area_rows; j++) {
-            const int x =
-                i * ms->sub_area_width + min(i, ms->sub_area_width_off);
-            const int w =
-                ms->sub_area_width + (i < ms->sub_area_width_off ? 1 : 0);
-            const int y =
-                j * ms->sub_area_height + min(j, ms->sub_area_height_off);
-            const int h =
-                ms->sub_area_height + (j < ms->sub_area_height_off ? 1 : 0);
-
-            const bool selectable =
-                label_selection_is_included(curr_label, ms->label_selection);
-
-            cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-            if (selectable) {
-                cairo_set_source_u32(cairo, config->selectable_bg_color);
-                cairo_rectangle(cairo, x, y, w, h);
-                cairo_fill(cairo);
-
-                cairo_set_source_u32(cairo, config->selectable_border_color);
-                cairo_rectangle(cairo, x + .5, y + .5, w - 1, h - 1);
-                cairo_set_line_width(cairo, 1);
-                cairo_stroke(cairo);
-
-                cairo_text_extents_t te_all;
-                label_selection_str(curr_label, label_selected_str);
-                cairo_text_extents(cairo, label_selected_str, &te_all);
-
-                label_selection_str_split(
-                    curr_label, label_selected_str, label_unselected_str,
-                    ms->label_selection->next
-                );
-
-                cairo_text_extents_t te_selected, te_unselected;
-                cairo_text_extents(cairo, label_selected_str, &te_selected);
-                cairo_text_extents(cairo, label_unselected_str, &te_unselected);
-
-                // Centers the label.
-                cairo_move_to(
-                    cairo,
-                    x + (w - te_selected.x_advance - te_unselected.x_advance) /
-                            2,
-                    y + (int)((h + te_all.height) / 2)
-                );
-                cairo_set_source_u32(cairo, config->label_select_color);
-                cairo_show_text(cairo, label_selected_str);
-                cairo_set_source_u32(cairo, config->label_color);
-                cairo_show_text(cairo, label_unselected_str);
-            }
-
-            label_selection_incr(curr_label);
+    label_selection_t *selection = ms->label_selection;
+
+    // Only the cells whose label starts with the selection are drawn.
+    for (int idx = label_selection_first_match(selection); idx >= 0;
+         idx      = label_selection_next_match(selection, idx)) {
+        if (!surface_buffer_is_damaged(
+                buffer, idx_to_rect(ms, idx, ms->area.x, ms->area.y)
+            )) {
+            continue;
         }
+
+        struct rect cell = idx_to_rect(ms, idx, 0, 0);
+
+        cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_u32(cairo, config->selectable_bg_color);
+        cairo_rectangle(cairo, cell.x, cell.y, cell.w, cell.h);
+        cairo_fill(cairo);
+
+        cairo_set_source_u32(cairo, config->selectable_border_color);
+        cairo_rectangle(
+            cairo, cell.x + .5, cell.y + .5, cell.w - 1, cell.h - 1
+        );
+        cairo_set_line_width(cairo, 1);
+        cairo_stroke(cairo);
+
+        label_selection_set_from_idx(curr_label, idx);
+        glyph_atlas_draw_label(
+            ms->glyph_atlas, cairo, font_size, cell, curr_label,
+            selection->next, config->label_select_color, config->label_color
+        );
     }
 
     label_selection_free(curr_label);
     cairo_translate(cairo, -ms->area.x, -ms->area.y);
+
+    if (partial) {
+        cairo_restore(cairo);
+    }
 }
 
 void tile_mode_state_free(void *mode_state) {
     struct tile_mode_state *ms = mode_state;
+    glyph_atlas_free(ms->glyph_atlas);
     cairo_font_face_destroy(ms->label_font_face);
     label_selection_free(ms->label_selection);
     label_symbols_free(ms->label_symbols);
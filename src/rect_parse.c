@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "rect_parse.h"
+
+#include "log.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define RECT_PARSE_SSE2 1
+#include <immintrin.h>
+#endif
+
+// Numbers have at most this many digits so that they fit in an `int`.
+#define MAX_DIGITS 9
+
+// Separators before the height, x and y.
+static const char separators[] = {'x', '+', '+'};
+
+static bool is_digit(char c) {
+    return (unsigned char)(c - '0') <= 9;
+}
+
+static int parse_digits(const char *s, int len) {
+    int value = 0;
+    for (int i = 0; i < len; i++) {
+        value = value * 10 + (s[i] - '0');
+    }
+    return value;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * `parse_int` parses an integer the way `%d` of `scanf` does, spaces before it
+ * included, as long as it fits in `MAX_DIGITS`.
+ */
+static const char *parse_int(const char *s, const char *end, int *value) {
+    while (s < end && is_space(*s)) {
+        s++;
+    }
+
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+
+    const char *digits = s;
+    while (s < end && s - digits < MAX_DIGITS && is_digit(*s)) {
+        s++;
+    }
+
+    if (s == digits || (s < end && is_digit(*s))) {
+        return NULL;
+    }
+
+    *value = parse_digits(digits, s - digits);
+    if (negative) {
+        *value = -*value;
+    }
+    return s;
+}
+
+static const char *
+parse_rect_scalar(const char *s, const char *end, struct rect *rect) {
+    int values[4];
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            if (s == end || *s != separators[i - 1]) {
+                return NULL;
+            }
+            s++;
+        }
+
+        s = parse_int(s, end, &values[i]);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+
+    *rect = (struct rect){values[2], values[3], values[0], values[1]};
+    return s;
+}
+
+#if RECT_PARSE_SSE2
+
+// Bytes classified at once. Longer lines are parsed by the scalar parser.
+#define CHUNK_SIZE 32
+
+/**
+ * `get_non_digits` returns a mask of the bytes of `s` that aren't digits, with
+ * the bits past the chunk set so that runs of digits always end.
+ */
+static uint64_t get_non_digits(const char *s) {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+
+    uint64_t digits = 0;
+    for (int i = 0; i < CHUNK_SIZE / 16; i++) {
+        __m128i chunk  = _mm_loadu_si128((const __m128i *)s + i);
+        __m128i offset = _mm_sub_epi8(chunk, zero);
+
+        // Digits are the bytes that are at most 9 once offset, unsigned.
+        __m128i is_digit =
+            _mm_cmpeq_epi8(_mm_min_epu8(offset, nine), offset);
+        digits |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_digit) << (i * 16);
+    }
+
+    return ~digits;
+}
+
+/**
+ * `parse_rect_sse2` finds the numbers of the rectangle from a mask of the
+ * digits of the next `CHUNK_SIZE` bytes instead of testing them one by one.
+ * Anything unusual, e.g. signs or spaces, is left to the scalar parser.
+ * `limit` is the end of the readable memory, past `end`.
+ */
+static const char *parse_rect_sse2(
+    const char *s, const char *end, const char *limit, struct rect *rect
+) {
+    if (limit - s < CHUNK_SIZE) {
+        return parse_rect_scalar(s, end, rect);
+    }
+
+    uint64_t non_digits = get_non_digits(s);
+
+    int values[4];
+    int pos = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            if (s[pos] != separators[i - 1]) {
+                return parse_rect_scalar(s, end, rect);
+            }
+            pos++;
+        }
+
+        int len = __builtin_ctzll(non_digits >> pos);
+        if (len == 0 || len > MAX_DIGITS || pos + len >= CHUNK_SIZE) {
+            return parse_rect_scalar(s, end, rect);
+        }
+
+        values[i]  = parse_digits(s + pos, len);
+        pos       += len;
+    }
+
+    // Numbers end at the first non-digit, at the latest the end of line.
+    *rect = (struct rect){values[2], values[3], values[0], values[1]};
+    return s + pos;
+}
+
+#endif
+
+/**
+ * `parse_rect` parses a rectangle from `s` to `end`. Memory can be read up to
+ * `limit`.
+ */
+static const char *parse_rect(
+    const char *s, const char *end, const char *limit, struct rect *rect
+) {
+#if RECT_PARSE_SSE2
+    return parse_rect_sse2(s, end, limit, rect);
+#else
+    return parse_rect_scalar(s, end, rect);
+#endif
+}
+
+const char *rect_parse(const char *s, const char *end, struct rect *rect) {
+    return parse_rect(s, end, end, rect);
+}
+
+int rect_parse_str(const char *s, struct rect *rect) {
+    const char *end = s + strlen(s);
+    return rect_parse(s, end, rect) != end;
+}
+
+size_t rect_parse_lines(
+    const char *data, size_t len, bool complete, int *line,
+    rect_handler_t handler, void *handler_data
+) {
+    const char *s   = data;
+    const char *end = data + len;
+
+    while (s < end) {
+        const char *eol = memchr(s, '\n', end - s);
+        if (eol == NULL) {
+            if (!complete) {
+                break;
+            }
+            eol = end;
+        }
+
+        (*line)++;
+
+        struct rect rect;
+        if (eol > s) {
+            if (parse_rect(s, eol, end, &rect) == NULL) {
+                LOG_ERR(
+                    "Error parsing line %d '%.*s'. Skipping.", *line,
+                    (int)(eol - s), s
+                );
+            } else if (handler(rect, handler_data)) {
+                return len;
+            }
+        }
+
+        s = eol < end ? eol + 1 : end;
+    }
+
+    return s - data;
+}
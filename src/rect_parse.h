@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __RECT_PARSE_H_INCLUDED__
+#define __RECT_PARSE_H_INCLUDED__
+
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * `rect_parse` parses a rectangle in the `wxh+x+y` format at the start of `s`,
+ * which ends at `end`. Returns a pointer to what follows it or NULL if there
+ * is none.
+ */
+const char *rect_parse(const char *s, const char *end, struct rect *rect);
+
+/**
+ * `rect_parse_str` parses a `\0` terminated string made of a rectangle only.
+ * Returns 0 on success.
+ */
+int rect_parse_str(const char *s, struct rect *rect);
+
+/**
+ * A `rect_handler_t` is given each rectangle parsed. It returns non-zero to
+ * stop parsing.
+ */
+typedef int (*rect_handler_t)(struct rect rect, void *data);
+
+/**
+ * `rect_parse_lines` parses a rectangle per line of `data`. The last line is
+ * only parsed if `complete`, otherwise it's left for the rest of it to come.
+ * Lines that can't be parsed are reported with their number, counted from
+ * `*line`, and skipped. Empty lines are ignored. Returns the length parsed,
+ * all of it if `handler` stopped the parsing.
+ */
+size_t rect_parse_lines(
+    const char *data, size_t len, bool complete, int *line,
+    rect_handler_t handler, void *handler_data
+);
+
+#endif
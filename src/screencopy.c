@@ -1,67 +1,80 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
-#if OPENCV_ENABLED
-
 #include "screencopy.h"
 
+#include "config.h"
+#include "grayscale.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "log.h"
+#include "shm_pool.h"
 #include "state.h"
-#include "surface_buffer.h"
+#include "trace.h"
 #include "wlr-screencopy-unstable-v1-client-protocol.h"
 
-#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <unistd.h>
-
-enum screen_capture_state {
-    CAPTURE_NOT_REQUESTED,
-    CAPTURE_REQUESTED,
-    CAPTURE_FAILED,
-    CAPTURE_SUCCESS,
-};
 
-struct scrcpy_state {
-    struct wl_shm                   *wl_shm;
-    struct zwlr_screencopy_frame_v1 *wl_screencopy_frame;
-    struct scrcpy_buffer            *scrcpy_buffer;
-    enum screen_capture_state        screen_capture_state;
-};
+// DRM formats share their codes with `wl_shm` formats except for these two.
+#define DRM_FORMAT_ARGB8888 0x34325241
+#define DRM_FORMAT_XRGB8888 0x34325258
 
-static struct scrcpy_buffer *create_scrcpy_buffer(
-    struct wl_shm *shm, enum wl_shm_format format, uint32_t width,
-    uint32_t height, uint32_t stride
-) {
-    size_t size = stride * height;
+// Linear layout, the only one a udmabuf can be read with.
+#define DRM_FORMAT_MOD_LINEAR 0ULL
 
-    int fd = allocate_shm_file(size);
-    if (fd == -1) {
-        LOG_ERR("Could not allocate SHM file.");
-        return NULL;
+// Row alignment of dmabufs, which suits the import requirements of most GPUs.
+#define DMABUF_STRIDE_ALIGNMENT 256
+
+static enum wl_shm_format wl_shm_format_from_drm(uint32_t drm_format) {
+    switch (drm_format) {
+    case DRM_FORMAT_ARGB8888:
+        return WL_SHM_FORMAT_ARGB8888;
+    case DRM_FORMAT_XRGB8888:
+        return WL_SHM_FORMAT_XRGB8888;
+    default:
+        return drm_format;
     }
+}
 
-    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) {
-        LOG_ERR("Could not mmap shared buffer for surface buffer.");
+static struct scrcpy_buffer *create_scrcpy_buffer(
+    struct shm_pool *shm_pool, enum wl_shm_format format, uint32_t width,
+    uint32_t height, uint32_t stride
+) {
+    struct scrcpy_buffer *buffer = calloc(1, sizeof(*buffer));
 
-        close(fd);
+    if (shm_pool_alloc(shm_pool, stride * height, &buffer->shm)) {
+        LOG_ERR("Could not allocate SHM buffer.");
+        free(buffer);
         return NULL;
     }
 
-    struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(shm, fd, size);
-    struct wl_buffer   *wl_buffer   = wl_shm_pool_create_buffer(
-        wl_shm_pool, 0, width, height, stride, format
+    buffer->wl_buffer = shm_pool_create_buffer(
+        shm_pool, &buffer->shm, width, height, stride, format
     );
-    wl_shm_pool_destroy(wl_shm_pool);
+    buffer->shm_pool = shm_pool;
+    buffer->format   = format;
+    buffer->data     = buffer->shm.data;
+    buffer->width    = width;
+    buffer->height   = height;
+    buffer->stride   = stride;
+
+    return buffer;
+}
 
-    close(fd);
+static struct scrcpy_buffer *create_dmabuf_scrcpy_buffer(
+    uint32_t drm_format, uint32_t width, uint32_t height
+) {
+    uint32_t stride = (width * 4 + DMABUF_STRIDE_ALIGNMENT - 1) /
+                      DMABUF_STRIDE_ALIGNMENT * DMABUF_STRIDE_ALIGNMENT;
 
-    struct scrcpy_buffer *buffer = malloc(sizeof(*buffer));
+    struct scrcpy_buffer *buffer = calloc(1, sizeof(*buffer));
+    if (udmabuf_create(&buffer->udmabuf, (size_t)stride * height)) {
+        free(buffer);
+        return NULL;
+    }
 
-    buffer->wl_buffer = wl_buffer;
-    buffer->format    = format;
-    buffer->data      = data;
+    buffer->is_dmabuf = true;
+    buffer->format    = wl_shm_format_from_drm(drm_format);
+    buffer->data      = buffer->udmabuf.data;
     buffer->width     = width;
     buffer->height    = height;
     buffer->stride    = stride;
@@ -70,44 +83,285 @@ static struct scrcpy_buffer *create_scrcpy_buffer(
 }
 
 void destroy_scrcpy_buffer(struct scrcpy_buffer *buf) {
-    if (buf != NULL) {
-        munmap(buf->data, buf->stride * buf->height);
+    if (buf == NULL) {
+        return;
+    }
+
+    if (buf->wl_buffer != NULL) {
         wl_buffer_destroy(buf->wl_buffer);
-        free(buf);
     }
+
+    if (buf->is_dmabuf) {
+        if (buf->udmabuf_reading) {
+            udmabuf_end_read(&buf->udmabuf);
+        }
+        udmabuf_destroy(&buf->udmabuf);
+    } else {
+        shm_pool_free(buf->shm_pool, &buf->shm);
+    }
+
+    free(buf->damage);
+    free(buf);
+}
+
+static void finish_request(struct scrcpy_request *request) {
+    if (request->wl_screencopy_frame != NULL) {
+        zwlr_screencopy_frame_v1_destroy(request->wl_screencopy_frame);
+        request->wl_screencopy_frame = NULL;
+    }
+
+    if (request->dmabuf_params != NULL) {
+        zwp_linux_buffer_params_v1_destroy(request->dmabuf_params);
+        request->dmabuf_params = NULL;
+    }
+
+    if (request->handler == NULL) {
+        // Waiting for the handler to be set.
+        return;
+    }
+
+    if (request->screen_capture_state == CAPTURE_FAILED) {
+        destroy_scrcpy_buffer(request->scrcpy_buffer);
+        request->scrcpy_buffer = NULL;
+    }
+
+    request->handler(
+        request->state, request->scrcpy_buffer, request->handler_data
+    );
+    free(request);
+}
+
+static void fail_request(struct scrcpy_request *request) {
+    request->screen_capture_state = CAPTURE_FAILED;
+    finish_request(request);
+}
+
+static void copy_frame(
+    struct scrcpy_request *request, struct wl_buffer *wl_buffer
+) {
+    if (request->on_damage) {
+        zwlr_screencopy_frame_v1_copy_with_damage(
+            request->wl_screencopy_frame, wl_buffer
+        );
+    } else {
+        zwlr_screencopy_frame_v1_copy(request->wl_screencopy_frame, wl_buffer);
+    }
+}
+
+static void copy_to_shm(struct scrcpy_request *request) {
+    struct scrcpy_buffer_offer *offer = &request->shm_offer;
+    if (!offer->offered) {
+        LOG_ERR("Compositor did not offer an SHM buffer.");
+        fail_request(request);
+        return;
+    }
+
+    LOG_DEBUG(
+        "Copying capture buffer (format: 0x%08x, %dx%d, stride: %d)",
+        offer->format, offer->width, offer->height, offer->stride
+    );
+
+    request->scrcpy_buffer = create_scrcpy_buffer(
+        &request->state->shm_pool, offer->format, offer->width, offer->height,
+        offer->stride
+    );
+    if (request->scrcpy_buffer == NULL) {
+        fail_request(request);
+        return;
+    }
+
+    copy_frame(request, request->scrcpy_buffer->wl_buffer);
+}
+
+static void dmabuf_params_handle_created(
+    void *data, struct zwp_linux_buffer_params_v1 *params,
+    struct wl_buffer *wl_buffer
+) {
+    struct scrcpy_request *request = data;
+
+    zwp_linux_buffer_params_v1_destroy(params);
+    request->dmabuf_params            = NULL;
+    request->scrcpy_buffer->wl_buffer = wl_buffer;
+
+    copy_frame(request, wl_buffer);
+}
+
+static void dmabuf_params_handle_failed(
+    void *data, struct zwp_linux_buffer_params_v1 *params
+) {
+    struct scrcpy_request *request = data;
+
+    LOG_DEBUG("Compositor could not import dmabuf, falling back to SHM.");
+    zwp_linux_buffer_params_v1_destroy(params);
+    request->dmabuf_params = NULL;
+    destroy_scrcpy_buffer(request->scrcpy_buffer);
+    request->scrcpy_buffer = NULL;
+
+    copy_to_shm(request);
+}
+
+static const struct zwp_linux_buffer_params_v1_listener dmabuf_params_listener =
+    {
+        .created = dmabuf_params_handle_created,
+        .failed  = dmabuf_params_handle_failed,
+};
+
+/**
+ * `copy_to_dmabuf` creates a udmabuf for the dmabuf offer. The copy starts
+ * once the compositor has imported it. Returns 0 on success.
+ */
+static int copy_to_dmabuf(struct scrcpy_request *request) {
+    struct scrcpy_buffer_offer *offer = &request->dmabuf_offer;
+
+    request->scrcpy_buffer =
+        create_dmabuf_scrcpy_buffer(offer->format, offer->width, offer->height);
+    if (request->scrcpy_buffer == NULL) {
+        return 1;
+    }
+
+    LOG_DEBUG(
+        "Copying capture dmabuf (format: 0x%08x, %dx%d, stride: %d)",
+        offer->format, offer->width, offer->height,
+        request->scrcpy_buffer->stride
+    );
+
+    request->dmabuf_params =
+        zwp_linux_dmabuf_v1_create_params(request->state->linux_dmabuf);
+    zwp_linux_buffer_params_v1_add_listener(
+        request->dmabuf_params, &dmabuf_params_listener, request
+    );
+    zwp_linux_buffer_params_v1_add(
+        request->dmabuf_params, request->scrcpy_buffer->udmabuf.dmabuf_fd, 0,
+        0, request->scrcpy_buffer->stride, DRM_FORMAT_MOD_LINEAR >> 32,
+        DRM_FORMAT_MOD_LINEAR & 0xffffffff
+    );
+    zwp_linux_buffer_params_v1_create(
+        request->dmabuf_params, offer->width, offer->height, offer->format, 0
+    );
+
+    return 0;
+}
+
+static bool can_use_dmabuf(struct scrcpy_request *request) {
+    enum capture_buffer_type type =
+        request->state->config.mode_floating.capture_buffer;
+
+    if (type == CAPTURE_BUFFER_SHM || request->shm_only) {
+        return false;
+    }
+
+    bool supported =
+        request->dmabuf_offer.offered && request->state->linux_dmabuf != NULL &&
+        grayscale_is_format_supported(
+            wl_shm_format_from_drm(request->dmabuf_offer.format)
+        );
+
+    if (!supported && type == CAPTURE_BUFFER_DMABUF) {
+        LOG_WARN("Cannot capture screen into a dmabuf, using SHM instead.");
+    }
+
+    return supported;
 }
 
 static void screencopy_frame_handle_buffer(
     void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
     uint32_t width, uint32_t height, uint32_t stride
 ) {
-    struct scrcpy_state *state = data;
+    struct scrcpy_request *request = data;
+    request->shm_offer.offered     = true;
+    request->shm_offer.format      = format;
+    request->shm_offer.width       = width;
+    request->shm_offer.height      = height;
+    request->shm_offer.stride      = stride;
+
+    // Before version 3, no more buffer types are offered.
+    if (zwlr_screencopy_frame_v1_get_version(frame) < 3) {
+        copy_to_shm(request);
+    }
+}
 
-    LOG_DEBUG(
-        "Copying capture buffer (format: 0x%08x, %dx%d, stride: %d)", format,
-        width, height, stride
-    );
+static void screencopy_frame_handle_linux_dmabuf(
+    void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
+    uint32_t width, uint32_t height
+) {
+    struct scrcpy_request *request = data;
+    request->dmabuf_offer.offered  = true;
+    request->dmabuf_offer.format   = format;
+    request->dmabuf_offer.width    = width;
+    request->dmabuf_offer.height   = height;
+}
+
+static void screencopy_frame_handle_buffer_done(
+    void *data, struct zwlr_screencopy_frame_v1 *frame
+) {
+    struct scrcpy_request *request = data;
+
+    if (can_use_dmabuf(request) && copy_to_dmabuf(request) == 0) {
+        return;
+    }
+
+    copy_to_shm(request);
+}
 
-    state->scrcpy_buffer =
-        create_scrcpy_buffer(state->wl_shm, format, width, height, stride);
+static void screencopy_frame_handle_damage(
+    void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height
+) {
+    struct scrcpy_request *request = data;
+    struct scrcpy_buffer  *buffer  = request->scrcpy_buffer;
+
+    struct rect *damage =
+        realloc(buffer->damage, sizeof(struct rect) * (buffer->num_damage + 1));
+    if (damage == NULL) {
+        LOG_ERR("Could not allocate damage.");
+        return;
+    }
 
-    zwlr_screencopy_frame_v1_copy(frame, state->scrcpy_buffer->wl_buffer);
+    damage[buffer->num_damage++] = (struct rect){x, y, width, height};
+    buffer->damage               = damage;
 }
 
 static void screencopy_frame_handle_ready(
     void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi,
     uint32_t tv_sec_lo, uint32_t tv_nsec
 ) {
-    struct scrcpy_state *state  = data;
-    state->screen_capture_state = CAPTURE_SUCCESS;
+    struct scrcpy_request *request = data;
+    request->screen_capture_state  = CAPTURE_SUCCESS;
+
+    if (request->scrcpy_buffer->is_dmabuf) {
+        udmabuf_begin_read(&request->scrcpy_buffer->udmabuf);
+        request->scrcpy_buffer->udmabuf_reading = true;
+    }
+
+    trace_instant("screencopy_ready");
+    finish_request(request);
 }
 
+static void capture_frame(struct scrcpy_request *request);
+
 static void screencopy_frame_handle_failed(
     void *data, struct zwlr_screencopy_frame_v1 *frame
 ) {
-    struct scrcpy_state *state  = data;
-    state->screen_capture_state = CAPTURE_FAILED;
+    struct scrcpy_request *request = data;
+
+    if (request->scrcpy_buffer != NULL && request->scrcpy_buffer->is_dmabuf &&
+        request->state->config.mode_floating.capture_buffer ==
+            CAPTURE_BUFFER_AUTO) {
+        LOG_DEBUG("Could not capture screen into dmabuf, retrying with SHM.");
+        zwlr_screencopy_frame_v1_destroy(request->wl_screencopy_frame);
+        if (request->dmabuf_params != NULL) {
+            zwp_linux_buffer_params_v1_destroy(request->dmabuf_params);
+            request->dmabuf_params = NULL;
+        }
+        destroy_scrcpy_buffer(request->scrcpy_buffer);
+        request->scrcpy_buffer = NULL;
+        request->shm_only      = true;
+        capture_frame(request);
+        return;
+    }
+
     LOG_ERR("Could not capture screen.");
+    fail_request(request);
 }
 
 static void noop() {}
@@ -117,44 +371,84 @@ const struct zwlr_screencopy_frame_v1_listener screencopy_frame_listener = {
     .flags        = noop,
     .ready        = screencopy_frame_handle_ready,
     .failed       = screencopy_frame_handle_failed,
-    .buffer_done  = noop,
-    .damage       = noop,
-    .linux_dmabuf = noop,
+    .buffer_done  = screencopy_frame_handle_buffer_done,
+    .damage       = screencopy_frame_handle_damage,
+    .linux_dmabuf = screencopy_frame_handle_linux_dmabuf,
 };
 
-struct scrcpy_buffer *
-query_screenshot(struct state *state, struct rect region) {
-    struct scrcpy_state scrcpy_state;
-    scrcpy_state.wl_shm = state->wl_shm;
+static void capture_frame(struct scrcpy_request *request) {
+    struct rect region    = request->region;
+    request->shm_offer    = (struct scrcpy_buffer_offer){0};
+    request->dmabuf_offer = (struct scrcpy_buffer_offer){0};
 
+    request->wl_screencopy_frame =
+        zwlr_screencopy_manager_v1_capture_output_region(
+            request->state->wl_screencopy_manager, false,
+            request->output->wl_output, region.x, region.y, region.w, region.h
+        );
+    zwlr_screencopy_frame_v1_add_listener(
+        request->wl_screencopy_frame, &screencopy_frame_listener, request
+    );
+}
+
+static struct scrcpy_request *new_request(
+    struct state *state, struct output *output, struct rect region,
+    bool on_damage
+) {
     if (state->wl_screencopy_manager == NULL) {
         LOG_ERR("Could not load `zwlr_screencopy_manager_v1`.");
-        exit(1);
+        return NULL;
     }
 
     LOG_DEBUG(
         "Capture region: %dx%d+%d+%d", region.w, region.h, region.x, region.y
     );
 
-    scrcpy_state.wl_screencopy_frame =
-        zwlr_screencopy_manager_v1_capture_output_region(
-            state->wl_screencopy_manager, false,
-            state->current_output->wl_output, region.x, region.y, region.w,
-            region.h
-        );
-    zwlr_screencopy_frame_v1_add_listener(
-        scrcpy_state.wl_screencopy_frame, &screencopy_frame_listener,
-        &scrcpy_state
-    );
+    struct scrcpy_request *request = calloc(1, sizeof(*request));
+    request->state                 = state;
+    request->output                = output;
+    request->region                = region;
+    request->screen_capture_state  = CAPTURE_REQUESTED;
+    request->on_damage             = on_damage;
 
-    scrcpy_state.screen_capture_state = CAPTURE_REQUESTED;
-    while (scrcpy_state.screen_capture_state == CAPTURE_REQUESTED) {
-        wl_display_roundtrip(state->wl_display);
-    }
+    capture_frame(request);
+    trace_instant("screencopy_request");
+
+    return request;
+}
+
+struct scrcpy_request *request_screenshot(
+    struct state *state, struct output *output, struct rect region
+) {
+    return new_request(state, output, region, false);
+}
+
+struct scrcpy_request *request_screenshot_on_damage(
+    struct state *state, struct output *output, struct rect region
+) {
+    return new_request(state, output, region, true);
+}
 
-    zwlr_screencopy_frame_v1_destroy(scrcpy_state.wl_screencopy_frame);
+void scrcpy_request_set_handler(
+    struct scrcpy_request *request, scrcpy_handler_t handler, void *data
+) {
+    request->handler      = handler;
+    request->handler_data = data;
 
-    return scrcpy_state.scrcpy_buffer;
+    if (request->screen_capture_state != CAPTURE_REQUESTED) {
+        finish_request(request);
+    }
 }
 
-#endif
+void cancel_screenshot(struct scrcpy_request *request) {
+    if (request->wl_screencopy_frame != NULL) {
+        zwlr_screencopy_frame_v1_destroy(request->wl_screencopy_frame);
+    }
+
+    if (request->dmabuf_params != NULL) {
+        zwp_linux_buffer_params_v1_destroy(request->dmabuf_params);
+    }
+
+    destroy_scrcpy_buffer(request->scrcpy_buffer);
+    free(request);
+}
@@ -3,25 +3,123 @@
 #ifndef __SCREENCOPY_H_INCLUDED__
 #define __SCREENCOPY_H_INCLUDED__
 
-#if OPENCV_ENABLED
+#include "shm_pool.h"
+#include "udmabuf.h"
+#include "utils.h"
 
+#include <stdbool.h>
 #include <wayland-client.h>
 
+/**
+ * A `scrcpy_buffer` holds a captured frame either in an SHM buffer or in a
+ * udmabuf when `is_dmabuf` is set. `data` points to the pixels in both cases.
+ * `udmabuf_reading` tells whether the CPU read of the udmabuf was begun.
+ * Captures requested on damage also list the damaged regions, in buffer
+ * coordinates.
+ */
 struct scrcpy_buffer {
     struct wl_buffer  *wl_buffer;
+    struct shm_pool   *shm_pool;
+    struct shm_buffer  shm;
+    bool               is_dmabuf;
+    struct udmabuf     udmabuf;
+    bool               udmabuf_reading;
     void              *data;
     enum wl_shm_format format;
     int32_t            width;
     int32_t            height;
     int32_t            stride;
+    struct rect       *damage;
+    int                num_damage;
+};
+
+enum screen_capture_state {
+    CAPTURE_REQUESTED,
+    CAPTURE_FAILED,
+    CAPTURE_SUCCESS,
 };
 
 struct state;
-struct rect;
-struct scrcpy_buffer *query_screenshot(struct state *state, struct rect region);
+struct output;
 
-void destroy_scrcpy_buffer(struct scrcpy_buffer *buf);
+/**
+ * A `scrcpy_buffer_offer` is a buffer description sent by the compositor.
+ * `format` is a `wl_shm` format for SHM offers and a DRM format for dmabuf
+ * ones.
+ */
+struct scrcpy_buffer_offer {
+    bool     offered;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+};
 
-#endif
+/**
+ * A `scrcpy_handler_t` receives the captured buffer, or NULL if the capture
+ * failed. It owns the buffer.
+ */
+typedef void (*scrcpy_handler_t)(
+    struct state *state, struct scrcpy_buffer *buffer, void *data
+);
+
+/**
+ * A `scrcpy_request` is a screen capture in progress. It's completed while
+ * the Wayland events are dispatched.
+ */
+struct scrcpy_request {
+    struct state                      *state;
+    struct output                     *output;
+    struct zwlr_screencopy_frame_v1   *wl_screencopy_frame;
+    struct zwp_linux_buffer_params_v1 *dmabuf_params;
+    struct scrcpy_buffer              *scrcpy_buffer;
+    enum screen_capture_state          screen_capture_state;
+    struct rect                        region;
+    scrcpy_handler_t                   handler;
+    void                              *handler_data;
+
+    struct scrcpy_buffer_offer shm_offer;
+    struct scrcpy_buffer_offer dmabuf_offer;
+
+    // Set once a dmabuf capture failed so that the retry uses SHM.
+    bool shm_only;
+
+    // Whether the copy waits for the region to be damaged.
+    bool on_damage;
+};
+
+/**
+ * `request_screenshot` asks the compositor for a copy of `region` of `output`
+ * without waiting for it. Returns NULL if the compositor can't capture the
+ * screen.
+ */
+struct scrcpy_request *request_screenshot(
+    struct state *state, struct output *output, struct rect region
+);
+
+/**
+ * `request_screenshot_on_damage` is like `request_screenshot` but the copy
+ * only happens once the region is damaged. The buffer lists the regions
+ * damaged since the previous capture requested on damage.
+ */
+struct scrcpy_request *request_screenshot_on_damage(
+    struct state *state, struct output *output, struct rect region
+);
+
+/**
+ * `scrcpy_request_set_handler` sets the function called once the capture is
+ * done. It's called right away if it's already done. The request is freed
+ * after the handler returns.
+ */
+void scrcpy_request_set_handler(
+    struct scrcpy_request *request, scrcpy_handler_t handler, void *data
+);
+
+/**
+ * `cancel_screenshot` frees a request whose handler hasn't been called.
+ */
+void cancel_screenshot(struct scrcpy_request *request);
+
+void destroy_scrcpy_buffer(struct scrcpy_buffer *buf);
 
 #endif
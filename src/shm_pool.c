@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "shm_pool.h"
+
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static int create_tmp_file(void) {
+    char name[] = "/tmp/wl-shm-XXXXXX";
+    int  fd     = mkostemp(name, O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    unlink(name);
+    return fd;
+}
+
+static int create_shm_file(void) {
+    int fd = memfd_create("wl-kbptr-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        // The compositor maps the file as well so it must not shrink.
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+        return fd;
+    }
+
+    LOG_DEBUG("memfd_create failed, falling back to a temporary file.");
+    return create_tmp_file();
+}
+
+static size_t page_align(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+int shm_pool_init(struct shm_pool *pool, struct wl_shm *wl_shm) {
+    memset(pool, 0, sizeof(*pool));
+    pool->wl_shm = wl_shm;
+
+    pool->fd = create_shm_file();
+    if (pool->fd < 0) {
+        LOG_ERR("Could not create shared memory file.");
+        return 1;
+    }
+
+    return 0;
+}
+
+void shm_pool_finish(struct shm_pool *pool) {
+    if (pool->num_ranges > 0) {
+        LOG_WARN("%d SHM buffers were not freed.", pool->num_ranges);
+    }
+
+    if (pool->wl_shm_pool != NULL) {
+        wl_shm_pool_destroy(pool->wl_shm_pool);
+    }
+
+    if (pool->fd >= 0) {
+        close(pool->fd);
+    }
+
+    free(pool->ranges);
+    memset(pool, 0, sizeof(*pool));
+    pool->fd = -1;
+}
+
+static int grow(struct shm_pool *pool, size_t size) {
+    int err;
+    while ((err = ftruncate(pool->fd, size)) && errno == EINTR) {}
+    if (err) {
+        LOG_ERR("Could not resize shared memory file.");
+        return 1;
+    }
+
+    if (pool->wl_shm_pool == NULL) {
+        pool->wl_shm_pool = wl_shm_create_pool(pool->wl_shm, pool->fd, size);
+    } else {
+        wl_shm_pool_resize(pool->wl_shm_pool, size);
+    }
+
+    pool->size = size;
+    return 0;
+}
+
+/**
+ * `find_free_range` returns the index at which a range of `size` bytes can be
+ * inserted, the first free one big enough, and sets its offset. Ranges past
+ * the end of the pool need it to grow.
+ */
+static int find_free_range(struct shm_pool *pool, size_t size, size_t *offset) {
+    size_t end = 0;
+    for (int i = 0; i < pool->num_ranges; i++) {
+        if (pool->ranges[i].offset - end >= size) {
+            *offset = end;
+            return i;
+        }
+
+        end = pool->ranges[i].offset + pool->ranges[i].size;
+    }
+
+    *offset = end;
+    return pool->num_ranges;
+}
+
+int shm_pool_alloc(struct shm_pool *pool, size_t size, struct shm_buffer *buf) {
+    size = page_align(size);
+
+    size_t offset;
+    int    idx = find_free_range(pool, size, &offset);
+    if (offset + size > pool->size && grow(pool, offset + size)) {
+        return 1;
+    }
+
+    void *data = mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, offset
+    );
+    if (data == MAP_FAILED) {
+        LOG_ERR("Could not mmap shared memory.");
+        return 1;
+    }
+
+    if (pool->num_ranges >= pool->ranges_cap) {
+        pool->ranges_cap = pool->ranges_cap == 0 ? 8 : pool->ranges_cap * 2;
+        pool->ranges     = realloc(
+            pool->ranges, pool->ranges_cap * sizeof(struct shm_range)
+        );
+    }
+
+    memmove(
+        &pool->ranges[idx + 1], &pool->ranges[idx],
+        (pool->num_ranges - idx) * sizeof(struct shm_range)
+    );
+    pool->num_ranges++;
+    pool->ranges[idx] = (struct shm_range){.offset = offset, .size = size};
+
+    buf->range = pool->ranges[idx];
+    buf->data  = data;
+    return 0;
+}
+
+void shm_pool_free(struct shm_pool *pool, struct shm_buffer *buf) {
+    munmap(buf->data, buf->range.size);
+
+    // The file can't shrink but the memory of the range is given back.
+    fallocate(
+        pool->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, buf->range.offset,
+        buf->range.size
+    );
+
+    for (int i = 0; i < pool->num_ranges; i++) {
+        if (pool->ranges[i].offset == buf->range.offset) {
+            pool->num_ranges--;
+            memmove(
+                &pool->ranges[i], &pool->ranges[i + 1],
+                (pool->num_ranges - i) * sizeof(struct shm_range)
+            );
+            break;
+        }
+    }
+
+    memset(buf, 0, sizeof(*buf));
+}
+
+struct wl_buffer *shm_pool_create_buffer(
+    struct shm_pool *pool, struct shm_buffer *buf, int32_t width,
+    int32_t height, int32_t stride, enum wl_shm_format format
+) {
+    return wl_shm_pool_create_buffer(
+        pool->wl_shm_pool, buf->range.offset, width, height, stride, format
+    );
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __SHM_POOL_H_INCLUDED__
+#define __SHM_POOL_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct shm_range {
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * A `shm_pool` is a single shared memory file, and its `wl_shm_pool`, from
+ * which all the buffers are allocated. The pool grows as needed and freed
+ * ranges are reused.
+ */
+struct shm_pool {
+    struct wl_shm      *wl_shm;
+    struct wl_shm_pool *wl_shm_pool;
+    int                 fd;
+    size_t              size;
+
+    // Allocated ranges sorted by offset.
+    struct shm_range *ranges;
+    int               num_ranges;
+    int               ranges_cap;
+};
+
+/**
+ * A `shm_buffer` is a mapped range of a `shm_pool`.
+ */
+struct shm_buffer {
+    struct shm_range range;
+    void            *data;
+};
+
+/**
+ * `shm_pool_init` creates the pool's file. Returns 0 on success.
+ */
+int shm_pool_init(struct shm_pool *pool, struct wl_shm *wl_shm);
+
+/**
+ * `shm_pool_finish` releases the pool. The `wl_buffer`s created from it stay
+ * valid but must not be used once their `shm_buffer` is freed.
+ */
+void shm_pool_finish(struct shm_pool *pool);
+
+/**
+ * `shm_pool_alloc` allocates and maps `size` bytes. Returns 0 on success.
+ */
+int shm_pool_alloc(struct shm_pool *pool, size_t size, struct shm_buffer *buf);
+
+/**
+ * `shm_pool_free` unmaps the buffer and makes its range available again. The
+ * `wl_buffer` created from it must have been destroyed.
+ */
+void shm_pool_free(struct shm_pool *pool, struct shm_buffer *buf);
+
+struct wl_buffer *shm_pool_create_buffer(
+    struct shm_pool *pool, struct shm_buffer *buf, int32_t width,
+    int32_t height, int32_t stride, enum wl_shm_format format
+);
+
+#endif
@@ -4,9 +4,14 @@
 #define __STATE_H_INCLUDED__
 
 #include "config.h"
+#include "detection_cache.h"
+#include "detection_watch.h"
+#include "event_loop.h"
 #include "fractional-scale-v1-client-protocol.h"
 #include "label.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "screencopy.h"
+#include "shm_pool.h"
 #include "surface_buffer.h"
 #include "utils.h"
 #include "viewporter-client-protocol.h"
@@ -40,6 +45,7 @@
 #define NO_MODE_ENTERED -1
 
 struct mode_interface;
+struct glyph_atlas;
 
 struct tile_mode_state {
     struct rect area;
@@ -55,17 +61,35 @@ struct tile_mode_state {
     label_selection_t *label_selection;
     label_symbols_t   *label_symbols;
 
-    cairo_font_face_t *label_font_face;
+    cairo_font_face_t  *label_font_face;
+    struct glyph_atlas *glyph_atlas;
+
+    // Tells the buffers rendered by this state apart from others'.
+    uint32_t generation;
 };
 
+struct detection_job;
+struct stdin_stream;
+
 struct floating_mode_state {
+    struct rect  area;
     struct rect *areas;
     int          num_areas;
 
+    // Set until the targets are known: `areas` and `label_selection` aren't
+    // set yet.
+    bool                   detecting;
+    struct scrcpy_request *capture;
+    struct detection_job  *detection_job;
+
+    // Set while areas are read from the standard input as they come.
+    struct stdin_stream *stdin_stream;
+
     label_selection_t *label_selection;
     label_symbols_t   *label_symbols;
 
-    cairo_font_face_t *label_font_face;
+    cairo_font_face_t  *label_font_face;
+    struct glyph_atlas *glyph_atlas;
 };
 
 struct bisect_mode_state {
@@ -82,6 +106,7 @@ struct split_mode_state {
 
 struct output {
     struct wl_list           link; // type: struct output
+    uint32_t                 wl_name;
     struct wl_output        *wl_output;
     struct zxdg_output_v1   *xdg_output;
     char                    *name;
@@ -91,6 +116,8 @@ struct output {
     int32_t                  x;
     int32_t                  y;
     enum wl_output_transform transform;
+    bool                     xdg_output_done;
+    struct state            *state;
 };
 
 struct seat {
@@ -101,6 +128,8 @@ struct seat {
     struct xkb_keymap  *xkb_keymap;
     struct xkb_state   *xkb_state;
     struct state       *state;
+    bool                capabilities_received;
+    bool                keymap_received;
 };
 
 struct state {
@@ -114,14 +143,31 @@ struct state {
     struct wp_viewporter                   *wp_viewporter;
     struct wp_viewport                     *wp_viewport;
     struct wp_fractional_scale_manager_v1  *fractional_scale_mgr;
+    struct shm_pool                         shm_pool;
     struct surface_buffer_pool              surface_buffer_pool;
+    struct surface_buffer                  *current_buffer; // Being rendered.
+    uint64_t                                committed_content_id;
     struct wl_surface                      *wl_surface;
     struct wl_callback                     *wl_surface_callback;
     struct zwlr_layer_surface_v1           *wl_layer_surface;
     bool                                    surface_configured;
-#if OPENCV_ENABLED
-    struct zwlr_screencopy_manager_v1 *wl_screencopy_manager;
-#endif
+    struct zwlr_screencopy_manager_v1      *wl_screencopy_manager;
+    struct zwp_linux_dmabuf_v1             *linux_dmabuf;
+
+    // Capture requested when preparing the first mode. The mode takes it when
+    // entered.
+    struct scrcpy_request *pending_capture;
+
+    // Targets found in the previous captures and kept up to date between
+    // selections. Only used by the daemon.
+    struct detection_cache *detection_cache;
+    struct detection_watch *detection_watch;
+
+    // Captures are written to `dump_capture_dir` when set. Detection reads
+    // `replay_capture_file` instead of capturing the screen when set.
+    char *dump_capture_dir;
+    char *replay_capture_file;
+
     struct zxdg_output_manager_v1 *xdg_output_manager;
     struct wl_list                 outputs;
     struct wl_list                 seats;
@@ -137,7 +183,10 @@ struct state {
     struct mode_interface         *mode_interfaces[MAX_NUM_MODES];
     void                          *mode_states[MAX_NUM_MODES];
     int                            current_mode;
+    bool                           first_mode_prepared;
     enum click                     click;
+    struct fd_watch                fd_watches[MAX_FD_WATCHES];
+    int                            num_fd_watches;
 };
 
 #endif
@@ -5,44 +5,21 @@
 #include "log.h"
 
 #include <cairo/cairo.h>
-#include <errno.h>
-#include <fcntl.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
-#include <unistd.h>
 
 #define CAIRO_SURFACE_FORMAT CAIRO_FORMAT_ARGB32
 
-static int create_shm_file(void) {
-    char name[] = "/tmp/wl-shm-XXXXXX";
-    int  fd     = mkostemp(name, O_CLOEXEC);
-    if (fd < 0) {
-        return -1;
-    }
-
-    unlink(name);
-    return fd;
-}
-
-int allocate_shm_file(size_t size) {
-    int fd = create_shm_file();
-    if (fd < 0) {
-        return -1;
-    }
+static void handle_buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    struct surface_buffer      *buffer = data;
+    struct surface_buffer_pool *pool   = buffer->pool;
+    buffer->state                      = SURFACE_BUFFER_READY;
 
-    int err;
-    while ((err = ftruncate(fd, size)) && errno == EINTR) {}
-    if (err) {
-        close(fd);
-        return -1;
+    if (pool->frame_dropped) {
+        pool->frame_dropped = false;
+        pool->release_handler(pool->release_data);
     }
-
-    return fd;
-}
-
-static void handle_buffer_release(void *data, struct wl_buffer *wl_buffer) {
-    ((struct surface_buffer *)data)->state = SURFACE_BUFFER_READY;
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
@@ -50,52 +27,39 @@ static const struct wl_buffer_listener wl_buffer_listener = {
 };
 
 static struct surface_buffer *surface_buffer_init(
-    struct wl_shm *wl_shm, struct surface_buffer *buffer, int32_t width,
-    int32_t height
+    struct surface_buffer_pool *pool, struct surface_buffer *buffer,
+    int32_t width, int32_t height
 ) {
-    const uint32_t stride =
+    struct shm_pool *shm_pool = pool->shm_pool;
+    const uint32_t   stride =
         cairo_format_stride_for_width(CAIRO_SURFACE_FORMAT, width);
-    const uint32_t data_size = height * stride;
-    void          *data;
 
-    int fd = allocate_shm_file(data_size);
-    if (fd < 0) {
+    if (shm_pool_alloc(shm_pool, height * stride, &buffer->shm)) {
         LOG_ERR("Could not allocate shared buffer for surface buffer.");
         return NULL;
     }
 
-    data = mmap(NULL, data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) {
-        LOG_ERR("Could not mmap shared buffer for surface buffer.");
-
-        close(fd);
-        return NULL;
-    }
-
-    struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(wl_shm, fd, data_size);
-    buffer->wl_buffer               = wl_shm_pool_create_buffer(
-        wl_shm_pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888
+    buffer->wl_buffer = shm_pool_create_buffer(
+        shm_pool, &buffer->shm, width, height, stride, WL_SHM_FORMAT_ARGB8888
     );
     wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
-    wl_shm_pool_destroy(wl_shm_pool);
-
-    close(fd);
 
-    buffer->data      = data;
-    buffer->data_size = data_size;
-    buffer->width     = width;
-    buffer->height    = height;
-    buffer->state     = SURFACE_BUFFER_READY;
+    buffer->pool   = pool;
+    buffer->width  = width;
+    buffer->height = height;
+    buffer->state  = SURFACE_BUFFER_READY;
 
     buffer->cairo_surface = cairo_image_surface_create_for_data(
-        buffer->data, CAIRO_SURFACE_FORMAT, width, height, stride
+        buffer->shm.data, CAIRO_SURFACE_FORMAT, width, height, stride
     );
     buffer->cairo = cairo_create(buffer->cairo_surface);
 
     return buffer;
 }
 
-static void surface_buffer_destroy(struct surface_buffer *buffer) {
+static void surface_buffer_destroy(
+    struct shm_pool *shm_pool, struct surface_buffer *buffer
+) {
     if (buffer->state == SURFACE_BUFFER_UNINITIALIZED) {
         return;
     }
@@ -112,49 +76,202 @@ static void surface_buffer_destroy(struct surface_buffer *buffer) {
         wl_buffer_destroy(buffer->wl_buffer);
     }
 
-    if (buffer->data) {
-        munmap(buffer->data, buffer->data_size);
+    if (buffer->shm.data) {
+        shm_pool_free(shm_pool, &buffer->shm);
     }
 
+    free(buffer->damage);
+
     memset(buffer, 0, sizeof(struct surface_buffer));
 }
 
-void surface_buffer_pool_init(struct surface_buffer_pool *pool) {
+void surface_buffer_pool_init(
+    struct surface_buffer_pool *pool, struct shm_pool *shm_pool,
+    int num_buffers, void (*release_handler)(void *data), void *release_data
+) {
     memset(pool, 0, sizeof(struct surface_buffer_pool));
+    pool->shm_pool        = shm_pool;
+    pool->num_buffers     = min(max(num_buffers, 2), MAX_SURFACE_BUFFERS);
+    pool->release_handler = release_handler;
+    pool->release_data    = release_data;
 }
 
 void surface_buffer_pool_destroy(struct surface_buffer_pool *pool) {
-    surface_buffer_destroy(&pool->buffers[0]);
-    surface_buffer_destroy(&pool->buffers[1]);
+    for (int i = 0; i < pool->num_buffers; i++) {
+        surface_buffer_destroy(pool->shm_pool, &pool->buffers[i]);
+    }
 }
 
-struct surface_buffer *get_next_buffer(
-    struct wl_shm *wl_shm, struct surface_buffer_pool *pool, uint32_t width,
-    uint32_t height
-) {
-    struct surface_buffer *buffer = NULL;
-    for (size_t i = 0; i < 2; i++) {
-        if (pool->buffers[i].state != SURFACE_BUFFER_BUSY) {
-            buffer = &pool->buffers[i];
+/**
+ * `pick_buffer` picks the buffer to render the next frame into. In order of
+ * preference, it's the ready buffer of the right size used last, as its
+ * content is the most likely to be reused, an uninitialized one, or the ready
+ * buffer used the longest ago which will be reallocated. Busy buffers are
+ * never touched.
+ */
+static struct surface_buffer *
+pick_buffer(struct surface_buffer_pool *pool, uint32_t width, uint32_t height) {
+    struct surface_buffer *same_size     = NULL;
+    struct surface_buffer *uninitialized = NULL;
+    struct surface_buffer *other_size    = NULL;
+
+    for (int i = 0; i < pool->num_buffers; i++) {
+        struct surface_buffer *buffer = &pool->buffers[i];
+        switch (buffer->state) {
+        case SURFACE_BUFFER_UNINITIALIZED:
+            if (uninitialized == NULL) {
+                uninitialized = buffer;
+            }
+            break;
+
+        case SURFACE_BUFFER_READY:
+            if (buffer->width == width && buffer->height == height) {
+                if (same_size == NULL ||
+                    buffer->last_used > same_size->last_used) {
+                    same_size = buffer;
+                }
+            } else if (other_size == NULL ||
+                       buffer->last_used < other_size->last_used) {
+                other_size = buffer;
+            }
+            break;
+
+        case SURFACE_BUFFER_BUSY:
             break;
         }
     }
 
+    if (same_size != NULL) {
+        return same_size;
+    }
+
+    return uninitialized != NULL ? uninitialized : other_size;
+}
+
+struct surface_buffer *get_next_buffer(
+    struct surface_buffer_pool *pool, uint32_t width, uint32_t height
+) {
+    struct surface_buffer *buffer = pick_buffer(pool, width, height);
     if (buffer == NULL) {
-        LOG_WARN("All surface buffers are busy.");
+        // The frame is drawn once a buffer is released instead.
+        LOG_DEBUG("All surface buffers are busy.");
+        pool->frame_dropped = true;
         return NULL;
     }
 
     if (buffer->width != width || buffer->height != height) {
-        surface_buffer_destroy(buffer);
+        surface_buffer_destroy(pool->shm_pool, buffer);
     }
 
     if (buffer->state == SURFACE_BUFFER_UNINITIALIZED) {
-        if (surface_buffer_init(wl_shm, buffer, width, height) == NULL) {
+        if (surface_buffer_init(pool, buffer, width, height) == NULL) {
             LOG_ERR("Could not initialize next buffer.");
             return NULL;
         }
     }
 
+    buffer->last_used = ++pool->num_frames;
     return buffer;
 }
+
+void surface_buffer_start_frame(struct surface_buffer *buffer) {
+    buffer->prev_content_id = buffer->content_id;
+    buffer->content_id      = 0;
+    buffer->damage_full     = true;
+    buffer->num_damage      = 0;
+}
+
+void surface_buffer_add_damage(
+    struct surface_buffer *buffer, struct rect rect
+) {
+    // Areas are often added top to bottom so stacked ones are merged.
+    if (buffer->num_damage > 0) {
+        struct rect *last = &buffer->damage[buffer->num_damage - 1];
+        if (last->x == rect.x && last->w == rect.w &&
+            last->y + last->h == rect.y) {
+            last->h += rect.h;
+            return;
+        }
+    }
+
+    if (buffer->num_damage >= buffer->damage_cap) {
+        buffer->damage_cap = buffer->damage_cap == 0 ? 16
+                                                     : buffer->damage_cap * 2;
+        buffer->damage     = realloc(
+            buffer->damage, buffer->damage_cap * sizeof(struct rect)
+        );
+    }
+
+    buffer->damage[buffer->num_damage++] = rect;
+}
+
+bool surface_buffer_is_damaged(
+    struct surface_buffer *buffer, struct rect rect
+) {
+    if (buffer->damage_full) {
+        return true;
+    }
+
+    // Pixels on the edges of the damaged areas are shared with neighbours once
+    // rounded out so the areas are grown by one pixel.
+    for (int i = 0; i < buffer->num_damage; i++) {
+        struct rect *d = &buffer->damage[i];
+        if (rect.x <= d->x + d->w && d->x <= rect.x + rect.w &&
+            rect.y <= d->y + d->h && d->y <= rect.y + rect.h) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct rect round_out(
+    struct rect *rect, double scale_x, double scale_y, double x0, double y0
+) {
+    int x = floor(rect->x * scale_x + x0);
+    int y = floor(rect->y * scale_y + y0);
+    return (struct rect){
+        .x = x,
+        .y = y,
+        .w = ceil((rect->x + rect->w) * scale_x + x0) - x,
+        .h = ceil((rect->y + rect->h) * scale_y + y0) - y,
+    };
+}
+
+void surface_buffer_clip_damage(struct surface_buffer *buffer, cairo_t *cairo) {
+    if (buffer->damage_full) {
+        return;
+    }
+
+    cairo_matrix_t matrix;
+    cairo_get_matrix(cairo, &matrix);
+    cairo_identity_matrix(cairo);
+
+    cairo_new_path(cairo);
+    for (int i = 0; i < buffer->num_damage; i++) {
+        struct rect r = round_out(
+            &buffer->damage[i], matrix.xx, matrix.yy, matrix.x0, matrix.y0
+        );
+        cairo_rectangle(cairo, r.x, r.y, r.w, r.h);
+    }
+    cairo_clip(cairo);
+
+    cairo_set_matrix(cairo, &matrix);
+}
+
+void surface_buffer_damage_surface(
+    struct surface_buffer *buffer, struct wl_surface *wl_surface, double scale
+) {
+    if (buffer->damage_full ||
+        buffer->num_damage > SURFACE_BUFFER_MAX_DAMAGE_RECTS) {
+        wl_surface_damage_buffer(
+            wl_surface, 0, 0, buffer->width, buffer->height
+        );
+        return;
+    }
+
+    for (int i = 0; i < buffer->num_damage; i++) {
+        struct rect r = round_out(&buffer->damage[i], scale, scale, 0, 0);
+        wl_surface_damage_buffer(wl_surface, r.x, r.y, r.w, r.h);
+    }
+}
@@ -3,9 +3,20 @@
 #ifndef __SURFACE_BUFFER_H_INCLUDED__
 #define __SURFACE_BUFFER_H_INCLUDED__
 
+#include "shm_pool.h"
+#include "utils.h"
+
 #include <cairo/cairo.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <wayland-client.h>
 
+#define MAX_SURFACE_BUFFERS 8
+
+// Past this number of damaged areas, the whole buffer is reported as damaged
+// to the compositor.
+#define SURFACE_BUFFER_MAX_DAMAGE_RECTS 64
+
 enum surface_buffer_state {
     // This must be set to 0 as we set the whole structure to 0 when it's not
     // initialized.
@@ -15,29 +26,93 @@ enum surface_buffer_state {
     SURFACE_BUFFER_BUSY  = 2,
 };
 
+struct surface_buffer_pool;
+
 struct surface_buffer {
-    enum surface_buffer_state state;
-    struct wl_buffer         *wl_buffer;
-    cairo_surface_t          *cairo_surface;
-    cairo_t                  *cairo;
-    void                     *data;
-    size_t                    data_size;
-    uint32_t                  width;
-    uint32_t                  height;
+    enum surface_buffer_state   state;
+    struct surface_buffer_pool *pool;
+    struct wl_buffer           *wl_buffer;
+    cairo_surface_t            *cairo_surface;
+    cairo_t                    *cairo;
+    struct shm_buffer           shm;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint64_t                    last_used; // Frame number.
+
+    // Renderers that know what they drew in the buffer the last time set
+    // `content_id` to something other than 0. It's moved to `prev_content_id`
+    // when a new frame starts so that they can only redraw what changed.
+    uint64_t content_id;
+    uint64_t prev_content_id;
+
+    // Areas redrawn for the current frame in surface coordinates. They're
+    // ignored when `damage_full` is set.
+    bool         damage_full;
+    struct rect *damage;
+    int          num_damage;
+    int          damage_cap;
 };
 
 struct surface_buffer_pool {
-    struct surface_buffer buffers[2];
+    struct shm_pool      *shm_pool;
+    int                   num_buffers;
+    struct surface_buffer buffers[MAX_SURFACE_BUFFERS];
+    uint64_t              num_frames;
+
+    // Set when no buffer was available for a frame. `release_handler` is
+    // then called once one is released so that the frame can be drawn.
+    bool frame_dropped;
+    void (*release_handler)(void *data);
+    void *release_data;
 };
 
-void surface_buffer_pool_init(struct surface_buffer_pool *pool);
+/**
+ * `surface_buffer_pool_init` initializes a pool of `num_buffers` buffers,
+ * between 2 and `MAX_SURFACE_BUFFERS`.
+ */
+void surface_buffer_pool_init(
+    struct surface_buffer_pool *pool, struct shm_pool *shm_pool,
+    int num_buffers, void (*release_handler)(void *data), void *release_data
+);
 void surface_buffer_pool_destroy(struct surface_buffer_pool *pool);
 
 struct surface_buffer *get_next_buffer(
-    struct wl_shm *wl_shm, struct surface_buffer_pool *pool, uint32_t width,
-    uint32_t height
+    struct surface_buffer_pool *pool, uint32_t width, uint32_t height
 );
 
-int allocate_shm_file(size_t size);
+/**
+ * `surface_buffer_start_frame` resets the buffer's damage to the whole buffer
+ * before rendering into it.
+ */
+void surface_buffer_start_frame(struct surface_buffer *buffer);
+
+/**
+ * `surface_buffer_add_damage` adds an area that is redrawn. Renderers that use
+ * it must clear `damage_full`.
+ */
+void surface_buffer_add_damage(
+    struct surface_buffer *buffer, struct rect rect
+);
+
+/**
+ * `surface_buffer_is_damaged` tells whether `rect` touches a damaged area.
+ */
+bool surface_buffer_is_damaged(
+    struct surface_buffer *buffer, struct rect rect
+);
+
+/**
+ * `surface_buffer_clip_damage` restricts drawing to the damaged areas rounded
+ * out to whole buffer pixels.
+ */
+void surface_buffer_clip_damage(struct surface_buffer *buffer, cairo_t *cairo);
+
+/**
+ * `surface_buffer_damage_surface` reports the buffer's damage to `wl_surface`
+ * which must be at least version 4.
+ */
+void surface_buffer_damage_surface(
+    struct surface_buffer *buffer, struct wl_surface *wl_surface, double scale
+);
 
 #endif
@@ -2,13 +2,21 @@
 
 #include "target_detection.h"
 
+#include "components.h"
+#include "grayscale.h"
 #include "log.h"
+#include "target_filter.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <pixman.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <system_error>
+#include <thread>
 #include <wayland-client.h>
 
 static pixman_format_code_t get_pixman_format(enum wl_shm_format format) {
@@ -70,14 +78,18 @@ static pixman_format_code_t get_pixman_format(enum wl_shm_format format) {
     }
 }
 
-static pixman_image_t *make_pixman_image_a8r8g8b8(
+// Number of rows converted at a time for formats that need Pixman so that the
+// intermediate ARGB8888 buffer stays small.
+#define PIXMAN_STRIP_ROWS 64
+
+static int convert_strips_with_pixman(
     void *data, uint32_t width, uint32_t height, uint32_t stride,
-    enum wl_shm_format format
+    enum wl_shm_format format, cv::Mat &gray
 ) {
     pixman_format_code_t pixman_format = get_pixman_format(format);
     if (pixman_format == 0) {
         LOG_ERR("Unsupported format 0x%08x.", format);
-        return NULL;
+        return 1;
     }
 
     LOG_DEBUG(
@@ -90,301 +102,343 @@ static pixman_image_t *make_pixman_image_a8r8g8b8(
     );
     if (in_image == NULL) {
         LOG_ERR("Failed to create pixman image.");
-        return NULL;
+        return 1;
     }
 
-    int out_stride = width * sizeof(uint32_t);
-    LOG_DEBUG(
-        "Creating `pixman_image_t` for ouput image (w: %d, h: %d, stride: %d).",
-        width, height, out_stride
-    );
+    int strip_stride = width * sizeof(uint32_t);
 
-    pixman_image_t *out_image = pixman_image_create_bits(
-        PIXMAN_a8r8g8b8, width, height, NULL, out_stride
+    pixman_image_t *strip_image = pixman_image_create_bits(
+        PIXMAN_a8r8g8b8, width, PIXMAN_STRIP_ROWS, NULL, strip_stride
     );
-    if (out_image == NULL) {
-        LOG_ERR("Failed to create (out) pixman image.");
-        return NULL;
+    if (strip_image == NULL) {
+        LOG_ERR("Failed to create (strip) pixman image.");
+        pixman_image_unref(in_image);
+        return 1;
     }
 
-    pixman_image_composite32(
-        PIXMAN_OP_SRC, in_image, NULL, out_image, 0, 0, 0, 0, 0, 0, width,
-        height
-    );
+    void *strip_data = pixman_image_get_data(strip_image);
+    for (uint32_t y = 0; y < height; y += PIXMAN_STRIP_ROWS) {
+        uint32_t rows = std::min<uint32_t>(PIXMAN_STRIP_ROWS, height - y);
+
+        pixman_image_composite32(
+            PIXMAN_OP_SRC, in_image, NULL, strip_image, 0, y, 0, 0, 0, 0, width,
+            rows
+        );
+        grayscale_convert(
+            strip_data, width, rows, strip_stride, WL_SHM_FORMAT_ARGB8888,
+            gray.ptr(y), gray.step
+        );
+    }
 
+    pixman_image_unref(strip_image);
     pixman_image_unref(in_image);
 
-    return out_image;
+    return 0;
 }
 
-static cv::Mat get_gray_scale_from_buffer(
+/**
+ * `get_gray_scale_from_buffer` converts the buffer into `gray`. Returns 0 on
+ * success.
+ */
+static int get_gray_scale_from_buffer(
     void *data, uint32_t height, uint32_t width, uint32_t stride,
-    enum wl_shm_format format
+    enum wl_shm_format format, cv::Mat &gray
 ) {
-    pixman_image_t *image = NULL;
-    cv::Mat         buf;
-    int             in_out[3];
+    gray.create(height, width, CV_8UC1);
 
-    switch (format) {
-    case WL_SHM_FORMAT_ARGB8888:
-    case WL_SHM_FORMAT_XRGB8888:
-        buf       = cv::Mat(height, width, CV_8UC4, data);
-        in_out[0] = 1;
-        in_out[1] = 1;
-        in_out[2] = 2;
-        break;
-
-    case WL_SHM_FORMAT_XBGR8888:
-    case WL_SHM_FORMAT_ABGR8888:
-        buf       = cv::Mat(height, width, CV_8UC4, data);
-        in_out[0] = 2;
-        in_out[1] = 1;
-        in_out[2] = 0;
-        break;
-
-    default:
-        LOG_DEBUG("Converting buffer with Pixman");
-        image = make_pixman_image_a8r8g8b8(data, width, height, stride, format);
-        if (image == NULL) {
-            exit(1);
-        }
-        buf = cv::Mat(height, width, CV_8UC4, pixman_image_get_data(image));
-        in_out[0] = 1;
-        in_out[1] = 1;
-        in_out[2] = 2;
-        break;
+    if (grayscale_is_format_supported(format)) {
+        grayscale_convert(
+            data, width, height, stride, format, gray.ptr(), gray.step
+        );
+        return 0;
     }
 
-    cv::Mat in_channels[4];
-    cv::split(buf, in_channels);
+    LOG_DEBUG("Converting buffer with Pixman");
+    return convert_strips_with_pixman(
+        data, width, height, stride, format, gray
+    );
+}
 
-    cv::Mat out_channels[3] = {
-        in_channels[in_out[0]],
-        in_channels[in_out[1]],
-        in_channels[in_out[2]],
-    };
+/**
+ * `downsample` shrinks `gray` with area averaging so that it has at most
+ * `max_pixels` pixels. The aspect ratio is kept.
+ */
+static void downsample(cv::Mat &gray, uint64_t max_pixels) {
+    const uint64_t pixels = (uint64_t)gray.cols * gray.rows;
+    if (max_pixels == 0 || pixels <= max_pixels) {
+        return;
+    }
 
-    cv::Mat out;
-    cv::merge(out_channels, 3, out);
+    const double f      = sqrt((double)max_pixels / pixels);
+    const int    width  = std::max<int>(floor(gray.cols * f), 1);
+    const int    height = std::max<int>(floor(gray.rows * f), 1);
 
-    cv::Mat grayed;
-    cv::cvtColor(out, grayed, cv::COLOR_BGR2GRAY);
+    LOG_DEBUG(
+        "Downsampling detection input from %dx%d to %dx%d.", gray.cols,
+        gray.rows, width, height
+    );
 
-    if (image != NULL) {
-        pixman_image_unref(image);
-    }
+    cv::Mat resized;
+    cv::resize(gray, resized, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    gray = resized;
+}
 
-    return grayed;
+// Targets are at most 50 logical pixels high and must fit in the overlap
+// between bands, along with their parent, to be found the same way as when the
+// whole frame is processed at once.
+#define MAX_TARGET_HEIGHT 50
+
+// Bands are made at least this many times larger than their margins as it's
+// not worth processing the overlap twice otherwise.
+#define MIN_BAND_TO_MARGIN_RATIO 4
+
+/**
+ * A `band` is a slice of the frame along the displayed vertical axis, which is
+ * the buffer's horizontal axis for rotated outputs. Components are searched
+ * between `ext_start` and `ext_end` but only the ones starting between `start`
+ * and `end` belong to the band.
+ */
+struct band {
+    int start;
+    int end;
+    int ext_start;
+    int ext_end;
+};
+
+struct band_params {
+    const cv::Mat           *edges;
+    bool                     rotated;
+    enum wl_output_transform transform;
+    int                      width;
+    int                      height;
+    double                   scale;
+    struct rect              initial_area;
+    uint32_t                 cut_edges;
+};
+
+struct band_result {
+    std::vector<struct target_rect> targets;
+    double                          contours_time;
+    double                          filter_time;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
 }
 
-static void apply_transform(
-    cv::Mat &m, enum wl_output_transform transform, uint32_t &width,
-    uint32_t &height
+static void detect_band_targets(
+    const struct band_params *params, const struct band *band,
+    struct band_result *result
 ) {
-    cv::Mat tmp;
-    bool    switch_width_height = false;
-
-    switch (transform) {
-    case WL_OUTPUT_TRANSFORM_NORMAL:
-        break;
-
-    case WL_OUTPUT_TRANSFORM_90:
-        cv::rotate(m, tmp, cv::ROTATE_90_CLOCKWISE);
-        m                   = tmp;
-        switch_width_height = true;
-        break;
-
-    case WL_OUTPUT_TRANSFORM_270:
-        cv::rotate(m, tmp, cv::ROTATE_90_COUNTERCLOCKWISE);
-        m                   = tmp;
-        switch_width_height = true;
-        break;
-
-    case WL_OUTPUT_TRANSFORM_180:
-        cv::rotate(m, tmp, cv::ROTATE_180);
-        m = tmp;
-        break;
-
-    case WL_OUTPUT_TRANSFORM_FLIPPED:
-        cv::flip(m, tmp, 1);
-        m = tmp;
-        break;
-
-    case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-        cv::rotate(m, tmp, cv::ROTATE_90_CLOCKWISE);
-        cv::flip(tmp, m, 1);
-        switch_width_height = true;
-        break;
-
-    case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-        cv::rotate(m, tmp, cv::ROTATE_180);
-        cv::flip(tmp, m, 1);
-        break;
-
-    case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-        cv::rotate(m, tmp, cv::ROTATE_90_COUNTERCLOCKWISE);
-        cv::flip(tmp, m, 1);
-        switch_width_height = true;
-        break;
-    }
+    auto stage_start = std::chrono::steady_clock::now();
 
-    if (switch_width_height) {
-        uint32_t tmp = height;
-        height       = width;
-        width        = tmp;
-    }
-}
+    const int axis_len = params->rotated ? params->width : params->height;
+    const int ext_len  = band->ext_end - band->ext_start;
 
-static void compute_rects(
-    const std::vector<std::vector<cv::Point>> &contours,
-    std::vector<cv::Rect2d> &rects, double scale, double x_off, double y_off
-) {
-    rects.clear();
-    rects.reserve(contours.size());
+    cv::Rect roi = params->rotated
+                       ? cv::Rect(band->ext_start, 0, ext_len, params->height)
+                       : cv::Rect(0, band->ext_start, params->width, ext_len);
 
-    for (const std::vector<cv::Point> &contour : contours) {
-        cv::Rect rect = cv::boundingRect(contour);
+    // The components are searched in the band's view of the edges, without
+    // copying them.
+    const cv::Mat     edges = (*params->edges)(roi);
+    struct component *comps;
+    int               count = find_components(
+        edges.ptr(), edges.cols, edges.rows, (int)edges.step, &comps
+    );
+    if (count < 0) {
+        count = 0;
+    }
 
-        rects.push_back(
-            cv::Rect2d(
-                rect.x / scale + x_off, rect.y / scale + y_off,
-                rect.width / scale, rect.height / scale
-            )
+    result->contours_time = seconds_since(stage_start);
+    stage_start           = std::chrono::steady_clock::now();
+
+    // Components cut by the band's edges are partial. The full ones are larger
+    // than the margin so they would be filtered anyway. So are the ones cut by
+    // the capture's edges.
+    std::vector<struct target_rect> rects(count);
+    bool *filtered = (bool *)calloc(std::max(count, 1), sizeof(bool));
+    for (int i = 0; i < count; i++) {
+        struct rect *box = &comps[i].box;
+        box->x += roi.x;
+        box->y += roi.y;
+
+        const int start = params->rotated ? box->x : box->y;
+        const int end   = start + (params->rotated ? box->w : box->h);
+
+        filtered[i] = (band->ext_start > 0 && start <= band->ext_start) ||
+                      (band->ext_end < axis_len && end >= band->ext_end) ||
+                      is_box_cut(
+                          *box, params->cut_edges, params->width,
+                          params->height
+                      );
+
+        rects[i] = to_target_rect(
+            *box, params->transform, params->width, params->height,
+            params->scale, params->initial_area.x, params->initial_area.y
         );
     }
-}
-
-static size_t filter_rects(
-    const std::vector<cv::Rect2d> &rects,
-    const std::vector<cv::Vec4i> &hierachy, std::vector<bool> &filtered
-) {
-    filtered.assign(rects.size(), false);
-
-    for (size_t i = 0; i < rects.size(); i++) {
-        const auto &rect = rects[i];
 
-        if (rect.height >= 50 || rect.width >= 500 || rect.height <= 3 ||
-            rect.width <= 7) {
-            filtered[i] = true;
-            continue;
-        }
-    }
+    filter_targets(comps, rects.data(), count, filtered);
 
-    std::vector<int> to_explore;
-    for (size_t i = 0; i < rects.size(); i++) {
-        if (hierachy[i][3] >= 0) {
-            to_explore.push_back(i);
+    for (int i = 0; i < count; i++) {
+        const struct rect *box   = &comps[i].box;
+        const int          start = params->rotated ? box->x : box->y;
+        if (!filtered[i] && start >= band->start && start < band->end) {
+            result->targets.push_back(rects[i]);
         }
     }
 
-    while (!to_explore.empty()) {
-        int i = to_explore.back();
-        to_explore.pop_back();
-
-        if (!filtered[i]) {
-            int parent_i = hierachy[i][3];
-            if (filtered[parent_i]) {
-                goto filtered;
-            }
-
-            const auto &rect = rects[i];
-
-            // Inner targets that are flat are most likely lines forming an
-            // icon, e.g. a hamburger menu.
-            if (rect.height <= 6) {
-                filtered[i] = true;
-                goto filtered;
-            }
-
-            const auto &parent_rect = rects[parent_i];
-
-            const double center_x = rect.x + rect.width / 2.;
-            const double center_y = rect.y + rect.height / 2.;
-            const double parent_center_x =
-                parent_rect.x + parent_rect.width / 2.;
-            const double parent_center_y =
-                parent_rect.y + parent_rect.height / 2.;
-
-            // There's not much reasons to keep inner targets that have the same
-            // center as this is where the user is going to click most likely.
-            if (abs(center_x - parent_center_x) < 8 &&
-                abs(center_y - parent_center_y) < 8) {
-                filtered[i] = true;
-                goto filtered;
-            }
-
-            // If the parent target is a square, it's most likely a button with
-            // a single option or an icon.
-            if (abs(parent_rect.height - parent_rect.width) < 5 &&
-                parent_rect.height < 40 && parent_rect.width < 40) {
-                filtered[i] = true;
-                goto filtered;
-            }
-        }
+    free(filtered);
+    free(comps);
 
-    filtered:
-        int child = hierachy[i][0];
-        while (child >= 0) {
-            to_explore.push_back(child);
-            child = hierachy[child][2];
-        }
-    }
+    result->filter_time = seconds_since(stage_start);
+}
 
-    size_t not_filtered_count = 0;
-    for (const auto &curr : filtered) {
-        if (!curr) {
-            not_filtered_count += 1;
-        }
+/**
+ * `split_bands` splits `axis_len` pixels into up to one band per CPU.
+ */
+static std::vector<struct band> split_bands(int axis_len, int margin) {
+    int num_bands = std::min<int>(
+        std::thread::hardware_concurrency(),
+        axis_len / (margin * MIN_BAND_TO_MARGIN_RATIO)
+    );
+    num_bands = std::max(num_bands, 1);
+
+    std::vector<struct band> bands(num_bands);
+    for (int i = 0; i < num_bands; i++) {
+        struct band *band = &bands[i];
+        band->start       = (int64_t)axis_len * i / num_bands;
+        band->end         = (int64_t)axis_len * (i + 1) / num_bands;
+        band->ext_start   = std::max(band->start - margin, 0);
+        band->ext_end     = std::min(band->end + margin, axis_len);
     }
 
-    return not_filtered_count;
+    return bands;
 }
 
 int compute_target_from_img_buffer(
     void *data, uint32_t height, uint32_t width, uint32_t stride,
     enum wl_shm_format format, enum wl_output_transform transform,
-    struct rect initial_area, struct rect **areas
+    struct rect initial_area, uint32_t cut_edges, uint64_t max_pixels,
+    struct rect **areas, struct target_detection_stats *stats
 ) {
-    cv::Mat m1 =
-        get_gray_scale_from_buffer(data, height, width, stride, format);
-    apply_transform(m1, transform, width, height);
+    struct target_detection_stats local_stats;
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The detection runs on the buffer as it is and only the resulting
+    // rectangles are transformed. The dilation kernel and the scale are
+    // expressed in the buffer's orientation.
+    cv::Mat m1;
+    if (get_gray_scale_from_buffer(data, height, width, stride, format, m1)) {
+        *areas = NULL;
+        return 0;
+    }
 
-    double scale = ((double)height) / ((double)initial_area.h);
+    stats->gray = seconds_since(start);
+
+    // Everything below works on the downsampled frame. The scale accounts for
+    // it so the dilation kernel and the targets stay in logical pixels.
+    start = std::chrono::steady_clock::now();
+    downsample(m1, max_pixels);
+    width         = m1.cols;
+    height        = m1.rows;
+    stats->resize = seconds_since(start);
+
+    const bool     rotated          = is_transform_rotated(transform);
+    const uint32_t displayed_height = rotated ? width : height;
+    double scale = ((double)displayed_height) / ((double)initial_area.h);
+
+    int kernel_height = std::max<int>(round(2.5 * scale), 1);
+    int kernel_width  = std::max<int>(round(3.5 * scale), 1);
+    if (rotated) {
+        std::swap(kernel_height, kernel_width);
+    }
 
     cv::Mat m2;
-    cv::Mat kernel =
-        cv::Mat::ones(round(2.5 * scale), round(3.5 * scale), CV_8U);
+    cv::Mat kernel = cv::Mat::ones(kernel_height, kernel_width, CV_8U);
 
+    // OpenCV already spreads these over its own threads.
+    start = std::chrono::steady_clock::now();
     cv::Canny(m1, m2, 70, 220);
+    stats->canny = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
     cv::dilate(m2, m1, kernel);
+    stats->dilate = seconds_since(start);
+
+    struct band_params params;
+    params.edges        = &m1;
+    params.rotated      = rotated;
+    params.transform    = transform;
+    params.width        = width;
+    params.height       = height;
+    params.scale        = scale;
+    params.initial_area = initial_area;
+    params.cut_edges    = cut_edges;
+
+    const int margin = ceil(MAX_TARGET_HEIGHT * scale) + 2;
+    std::vector<struct band> bands = split_bands(displayed_height, margin);
+    std::vector<struct band_result> results(bands.size());
+
+    // The components are searched on a single thread so the bands are
+    // processed in parallel, the first one on this thread. The bands that
+    // couldn't get a thread are processed here too.
+    std::vector<std::thread> workers;
+    size_t                   num_threaded = 1;
+    try {
+        for (; num_threaded < bands.size(); num_threaded++) {
+            workers.emplace_back(
+                detect_band_targets, &params, &bands[num_threaded],
+                &results[num_threaded]
+            );
+        }
+    } catch (const std::system_error &e) {
+        LOG_WARN(
+            "Could not start detection thread: %s. Processing %zu bands "
+            "serially.",
+            e.what(), bands.size() - num_threaded
+        );
+    }
 
-    std::vector<std::vector<cv::Point>> contours;
-    std::vector<cv::Vec4i>              hierachy;
-    cv::findContours(
-        m1, contours, hierachy, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE
-    );
+    detect_band_targets(&params, &bands[0], &results[0]);
+    for (size_t i = num_threaded; i < bands.size(); i++) {
+        detect_band_targets(&params, &bands[i], &results[i]);
+    }
 
-    std::vector<cv::Rect2d> rects;
-    std::vector<bool>       filtered;
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
 
-    compute_rects(contours, rects, scale, initial_area.x, initial_area.y);
-    int final_rect_count = filter_rects(rects, hierachy, filtered);
+    stats->contours  = 0;
+    stats->filter    = 0;
+    stats->num_bands = bands.size();
+
+    size_t final_rect_count = 0;
+    for (size_t i = 0; i < bands.size(); i++) {
+        final_rect_count += results[i].targets.size();
+        stats->contours += results[i].contours_time;
+        stats->filter += results[i].filter_time;
+    }
 
     size_t area_i = 0;
     *areas = (struct rect *)malloc(sizeof(struct rect) * final_rect_count);
-    for (size_t i = 0; i < rects.size(); i++) {
-        if (filtered[i]) {
-            continue;
+    for (const struct band_result &result : results) {
+        for (const struct target_rect &rect : result.targets) {
+            struct rect *area = &(*areas)[area_i];
+            area->x           = round(rect.x);
+            area->y           = round(rect.y);
+            area->w           = round(rect.w);
+            area->h           = round(rect.h);
+
+            area_i++;
         }
-
-        const auto   rect = rects[i];
-        struct rect *area = &(*areas)[area_i];
-        area->x           = round(rect.x);
-        area->y           = round(rect.y);
-        area->w           = round(rect.width);
-        area->h           = round(rect.height);
-
-        area_i++;
     }
 
     return final_rect_count;
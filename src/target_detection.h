@@ -9,21 +9,78 @@
 #define EXTERNC
 #endif
 
-#if OPENCV_ENABLED
-
 #include "utils.h"
 
 #include <stdint.h>
 #include <wayland-client.h>
 
+/**
+ * `target_detection_stats` holds the time spent in each stage of the detection
+ * in seconds. With OpenCV, components are searched and filtered in parallel
+ * bands so these two are summed over all the bands.
+ */
+struct target_detection_stats {
+    double gray;
+    double resize;
+    double canny;
+    double dilate;
+    double contours;
+    double filter;
+    int    num_bands;
+};
+
+/**
+ * `detection_edge` flags are edges of a buffer. Components touching the edges
+ * along which a buffer was cut out of a larger capture are partial: they are
+ * neither targets nor compared with their children.
+ */
+enum detection_edge {
+    DETECTION_EDGE_TOP    = 1 << 0,
+    DETECTION_EDGE_BOTTOM = 1 << 1,
+    DETECTION_EDGE_LEFT   = 1 << 2,
+    DETECTION_EDGE_RIGHT  = 1 << 3,
+};
+
+/**
+ * A `target_detector_t` finds the targets in a screen capture and returns how
+ * many were stored in `areas`. `cut_edges` are the `detection_edge` flags of
+ * the edges along which the capture was cut, 0 for a whole capture. The
+ * capture is downsampled to at most `max_pixels` pixels first unless it's 0.
+ * `stats` is filled when not NULL.
+ */
+typedef int (*target_detector_t)(
+    void *data, uint32_t height, uint32_t width, uint32_t stride,
+    enum wl_shm_format format, enum wl_output_transform transform,
+    struct rect initial_area, uint32_t cut_edges, uint64_t max_pixels,
+    struct rect **areas, struct target_detection_stats *stats
+);
+
+#if OPENCV_ENABLED
+
+/**
+ * `compute_target_from_img_buffer` is the OpenCV `target_detector_t`.
+ */
 EXTERNC int compute_target_from_img_buffer(
     void *data, uint32_t height, uint32_t width, uint32_t stride,
     enum wl_shm_format format, enum wl_output_transform transform,
-    struct rect initial_area, struct rect **areas
+    struct rect initial_area, uint32_t cut_edges, uint64_t max_pixels,
+    struct rect **areas, struct target_detection_stats *stats
 );
 
 #endif
 
+/**
+ * `detect_targets_native` is a `target_detector_t` that doesn't need OpenCV.
+ * Edges are found with a Sobel filter and hysteresis thresholds, like Canny.
+ * Only the formats supported by `grayscale_convert` can be read.
+ */
+EXTERNC int detect_targets_native(
+    void *data, uint32_t height, uint32_t width, uint32_t stride,
+    enum wl_shm_format format, enum wl_output_transform transform,
+    struct rect initial_area, uint32_t cut_edges, uint64_t max_pixels,
+    struct rect **areas, struct target_detection_stats *stats
+);
+
 #undef EXTERNC
 
 #endif
@@ -0,0 +1,433 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "components.h"
+#include "grayscale.h"
+#include "log.h"
+#include "target_detection.h"
+#include "target_filter.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Same hysteresis thresholds as the OpenCV detector's Canny.
+#define EDGE_LOW_THRESHOLD  70
+#define EDGE_HIGH_THRESHOLD 220
+
+// tan(22.5°) in 15-bit fixed point, used to quantize gradient directions.
+#define TAN_22_5_Q15 13573
+
+enum gradient_direction {
+    GRADIENT_HORIZONTAL,
+    GRADIENT_VERTICAL,
+    GRADIENT_DIAGONAL,
+    GRADIENT_ANTI_DIAGONAL,
+};
+
+enum edge_state {
+    EDGE_NONE,
+    EDGE_WEAK,
+    EDGE_STRONG,
+};
+
+/**
+ * A `gray_image` is an 8-bit image whose rows are `width` bytes apart.
+ */
+struct gray_image {
+    uint8_t *data;
+    int      width;
+    int      height;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * `downsample` shrinks `img` by averaging square blocks of pixels so that it
+ * has at most `max_pixels` pixels. It's done in place.
+ */
+static void downsample(struct gray_image *img, uint64_t max_pixels) {
+    const uint64_t pixels = (uint64_t)img->width * img->height;
+    if (max_pixels == 0 || pixels <= max_pixels) {
+        return;
+    }
+
+    int k = ceil(sqrt((double)pixels / max_pixels));
+    while ((uint64_t)(img->width / k) * (img->height / k) > max_pixels) {
+        k++;
+    }
+
+    const int width  = max(img->width / k, 1);
+    const int height = max(img->height / k, 1);
+    const int area   = k * k;
+
+    LOG_DEBUG(
+        "Downsampling detection input from %dx%d to %dx%d.", img->width,
+        img->height, width, height
+    );
+
+    uint32_t *sums = calloc(width, sizeof(uint32_t));
+    for (int y = 0; y < height; y++) {
+        for (int dy = 0; dy < k && y * k + dy < img->height; dy++) {
+            const uint8_t *row = img->data + (size_t)(y * k + dy) * img->width;
+            for (int x = 0; x < width; x++) {
+                for (int dx = 0; dx < k; dx++) {
+                    sums[x] += row[x * k + dx];
+                }
+            }
+        }
+
+        // The output row is before the input rows it's made of.
+        uint8_t *out = img->data + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            out[x]  = (sums[x] + area / 2) / area;
+            sums[x] = 0;
+        }
+    }
+    free(sums);
+
+    img->width  = width;
+    img->height = height;
+}
+
+/**
+ * `compute_gradients` computes the L1 magnitude of the Sobel gradient of
+ * `img` in `mag` and its direction, rounded to 45°, in `dir`. The loops work
+ * on whole rows of 16-bit values so that they're vectorized by the compiler.
+ * The border pixels have no gradient.
+ */
+static void compute_gradients(
+    const struct gray_image *img, uint16_t *mag, uint8_t *dir
+) {
+    const int w = img->width;
+    const int h = img->height;
+
+    memset(mag, 0, sizeof(uint16_t) * w * h);
+    memset(dir, 0, w * h);
+    if (w < 3 || h < 3) {
+        return;
+    }
+
+    int16_t *smooth = malloc(sizeof(int16_t) * w);
+    int16_t *diff   = malloc(sizeof(int16_t) * w);
+    int16_t *gx     = malloc(sizeof(int16_t) * w);
+    int16_t *gy     = malloc(sizeof(int16_t) * w);
+
+    for (int y = 1; y < h - 1; y++) {
+        const uint8_t *above = img->data + (size_t)(y - 1) * w;
+        const uint8_t *row   = img->data + (size_t)y * w;
+        const uint8_t *below = img->data + (size_t)(y + 1) * w;
+
+        for (int x = 0; x < w; x++) {
+            smooth[x] = above[x] + 2 * row[x] + below[x];
+            diff[x]   = below[x] - above[x];
+        }
+
+        for (int x = 1; x < w - 1; x++) {
+            gx[x] = smooth[x + 1] - smooth[x - 1];
+            gy[x] = diff[x - 1] + 2 * diff[x] + diff[x + 1];
+        }
+
+        uint16_t *mag_row = mag + (size_t)y * w;
+        for (int x = 1; x < w - 1; x++) {
+            mag_row[x] = abs(gx[x]) + abs(gy[x]);
+        }
+
+        uint8_t *dir_row = dir + (size_t)y * w;
+        for (int x = 1; x < w - 1; x++) {
+            int32_t ax    = abs(gx[x]);
+            int32_t ay    = abs(gy[x]) << 15;
+            int32_t tg22x = ax * TAN_22_5_Q15;
+            int32_t tg67x = tg22x + (ax << 16);
+
+            if (ay < tg22x) {
+                dir_row[x] = GRADIENT_HORIZONTAL;
+            } else if (ay > tg67x) {
+                dir_row[x] = GRADIENT_VERTICAL;
+            } else if ((gx[x] < 0) != (gy[x] < 0)) {
+                dir_row[x] = GRADIENT_ANTI_DIAGONAL;
+            } else {
+                dir_row[x] = GRADIENT_DIAGONAL;
+            }
+        }
+    }
+
+    free(smooth);
+    free(diff);
+    free(gx);
+    free(gy);
+}
+
+/**
+ * `find_edges` sets `edges` to 1 where there is an edge like Canny does:
+ * gradients that aren't local maxima along their direction are dropped and
+ * weak edges are only kept when connected to strong ones.
+ */
+static int find_edges(const struct gray_image *img, uint8_t *edges) {
+    const int w = img->width;
+    const int h = img->height;
+
+    uint16_t *mag   = malloc(sizeof(uint16_t) * w * h);
+    uint8_t  *dir   = malloc(w * h);
+    int32_t  *stack = malloc(sizeof(int32_t) * w * h);
+    if (mag == NULL || dir == NULL || stack == NULL) {
+        free(mag);
+        free(dir);
+        free(stack);
+        return 1;
+    }
+
+    compute_gradients(img, mag, dir);
+
+    // Offsets of the neighbors to compare with for each gradient direction.
+    const int before[] = {
+        [GRADIENT_HORIZONTAL]    = -1,
+        [GRADIENT_VERTICAL]      = -w,
+        [GRADIENT_DIAGONAL]      = -w - 1,
+        [GRADIENT_ANTI_DIAGONAL] = -w + 1,
+    };
+    const int after[] = {
+        [GRADIENT_HORIZONTAL]    = 1,
+        [GRADIENT_VERTICAL]      = w,
+        [GRADIENT_DIAGONAL]      = w + 1,
+        [GRADIENT_ANTI_DIAGONAL] = w - 1,
+    };
+
+    size_t stack_len = 0;
+    memset(edges, EDGE_NONE, w * h);
+    for (int y = 1; y < h - 1; y++) {
+        for (int x = 1; x < w - 1; x++) {
+            int32_t  i = y * w + x;
+            uint16_t m = mag[i];
+            if (m <= EDGE_LOW_THRESHOLD) {
+                continue;
+            }
+
+            uint8_t d = dir[i];
+            if (m <= mag[i + before[d]] || m < mag[i + after[d]]) {
+                continue;
+            }
+
+            if (m > EDGE_HIGH_THRESHOLD) {
+                edges[i]           = EDGE_STRONG;
+                stack[stack_len++] = i;
+            } else {
+                edges[i] = EDGE_WEAK;
+            }
+        }
+    }
+
+    const int neighbors[8] = {-w - 1, -w, -w + 1, -1, 1, w - 1, w, w + 1};
+    while (stack_len > 0) {
+        int32_t i = stack[--stack_len];
+        for (int n = 0; n < 8; n++) {
+            int32_t j = i + neighbors[n];
+            if (edges[j] == EDGE_WEAK) {
+                edges[j]           = EDGE_STRONG;
+                stack[stack_len++] = j;
+            }
+        }
+    }
+
+    for (int32_t i = 0; i < w * h; i++) {
+        edges[i] = edges[i] == EDGE_STRONG;
+    }
+
+    free(mag);
+    free(dir);
+    free(stack);
+    return 0;
+}
+
+/**
+ * `dilate` sets the pixels of `out` that are within a `kernel_width` x
+ * `kernel_height` rectangle centered on a set pixel of `in`. The rectangle is
+ * applied as a horizontal then a vertical pass with running counts.
+ */
+static void dilate(
+    const uint8_t *in, uint8_t *out, int w, int h, int kernel_width,
+    int kernel_height
+) {
+    const int anchor_x = kernel_width / 2;
+    const int anchor_y = kernel_height / 2;
+
+    for (int y = 0; y < h; y++) {
+        const uint8_t *row     = in + (size_t)y * w;
+        uint8_t       *out_row = out + (size_t)y * w;
+
+        int count = 0;
+        for (int x = 0; x < kernel_width - 1 - anchor_x && x < w; x++) {
+            count += row[x];
+        }
+
+        for (int x = 0; x < w; x++) {
+            int last = x - anchor_x + kernel_width - 1;
+            if (last >= 0 && last < w) {
+                count += row[last];
+            }
+
+            out_row[x] = count > 0;
+
+            int first = x - anchor_x;
+            if (first >= 0) {
+                count -= row[first];
+            }
+        }
+    }
+
+    // The vertical pass runs on the rows of the horizontal one, in place.
+    uint16_t *counts = calloc(w, sizeof(uint16_t));
+    uint8_t  *window = malloc((size_t)kernel_height * w);
+
+    for (int y = 0; y < kernel_height - 1 - anchor_y && y < h; y++) {
+        uint8_t *slot = window + (size_t)(y % kernel_height) * w;
+        memcpy(slot, out + (size_t)y * w, w);
+        for (int x = 0; x < w; x++) {
+            counts[x] += slot[x];
+        }
+    }
+
+    for (int y = 0; y < h; y++) {
+        int last = y - anchor_y + kernel_height - 1;
+        if (last >= 0 && last < h) {
+            uint8_t *slot = window + (size_t)(last % kernel_height) * w;
+            memcpy(slot, out + (size_t)last * w, w);
+            for (int x = 0; x < w; x++) {
+                counts[x] += slot[x];
+            }
+        }
+
+        uint8_t *out_row = out + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            out_row[x] = counts[x] > 0;
+        }
+
+        int first = y - anchor_y;
+        if (first >= 0) {
+            uint8_t *slot = window + (size_t)(first % kernel_height) * w;
+            for (int x = 0; x < w; x++) {
+                counts[x] -= slot[x];
+            }
+        }
+    }
+
+    free(counts);
+    free(window);
+}
+
+int detect_targets_native(
+    void *data, uint32_t height, uint32_t width, uint32_t stride,
+    enum wl_shm_format format, enum wl_output_transform transform,
+    struct rect initial_area, uint32_t cut_edges, uint64_t max_pixels,
+    struct rect **areas, struct target_detection_stats *stats
+) {
+    struct target_detection_stats local_stats;
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->num_bands = 1;
+
+    *areas = NULL;
+
+    if (!grayscale_is_format_supported(format)) {
+        LOG_ERR("Unsupported format 0x%08x.", format);
+        return 0;
+    }
+
+    double start = now();
+
+    struct gray_image img = {
+        .data   = malloc((size_t)width * height),
+        .width  = width,
+        .height = height,
+    };
+    grayscale_convert(data, width, height, stride, format, img.data, width);
+    stats->gray = now() - start;
+
+    start = now();
+    downsample(&img, max_pixels);
+    stats->resize = now() - start;
+
+    // The detection runs on the buffer as it is and only the resulting
+    // rectangles are transformed. The dilation kernel and the scale are
+    // expressed in the buffer's orientation.
+    const bool   rotated          = is_transform_rotated(transform);
+    const int    displayed_height = rotated ? img.width : img.height;
+    const double scale = (double)displayed_height / initial_area.h;
+
+    int kernel_height = max(round(2.5 * scale), 1);
+    int kernel_width  = max(round(3.5 * scale), 1);
+    if (rotated) {
+        int tmp       = kernel_height;
+        kernel_height = kernel_width;
+        kernel_width  = tmp;
+    }
+
+    start          = now();
+    uint8_t *edges = malloc((size_t)img.width * img.height);
+    if (find_edges(&img, edges)) {
+        LOG_ERR("Could not allocate edge detection buffers.");
+        free(edges);
+        free(img.data);
+        return 0;
+    }
+    stats->canny = now() - start;
+
+    // The gray plane isn't needed anymore and gets the dilated edges.
+    start = now();
+    dilate(edges, img.data, img.width, img.height, kernel_width, kernel_height);
+    free(edges);
+    stats->dilate = now() - start;
+
+    start = now();
+    struct component *comps;
+    int               count =
+        find_components(img.data, img.width, img.height, img.width, &comps);
+    stats->contours = now() - start;
+    if (count < 0) {
+        free(img.data);
+        return 0;
+    }
+
+    start                     = now();
+    struct target_rect *rects = malloc(sizeof(struct target_rect) * count);
+    bool               *filtered = malloc(sizeof(bool) * count);
+    for (int i = 0; i < count; i++) {
+        filtered[i] =
+            is_box_cut(comps[i].box, cut_edges, img.width, img.height);
+        rects[i] = to_target_rect(
+            comps[i].box, transform, img.width, img.height, scale,
+            initial_area.x, initial_area.y
+        );
+    }
+
+    int num_targets = filter_targets(comps, rects, count, filtered);
+
+    *areas     = malloc(sizeof(struct rect) * num_targets);
+    int area_i = 0;
+    for (int i = 0; i < count; i++) {
+        if (!filtered[i]) {
+            (*areas)[area_i++] = (struct rect){
+                round(rects[i].x),
+                round(rects[i].y),
+                round(rects[i].w),
+                round(rects[i].h),
+            };
+        }
+    }
+    stats->filter = now() - start;
+
+    free(rects);
+    free(filtered);
+    free(comps);
+    free(img.data);
+
+    return num_targets;
+}
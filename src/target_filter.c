@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "target_filter.h"
+
+#include "target_detection.h"
+
+#include <math.h>
+
+bool is_transform_rotated(enum wl_output_transform transform) {
+    return transform & WL_OUTPUT_TRANSFORM_90;
+}
+
+struct rect transform_rect(
+    struct rect rect, enum wl_output_transform transform, int width, int height
+) {
+    const int right  = width - (rect.x + rect.w);
+    const int bottom = height - (rect.y + rect.h);
+
+    switch (transform) {
+    case WL_OUTPUT_TRANSFORM_NORMAL:
+        return rect;
+    case WL_OUTPUT_TRANSFORM_90:
+        return (struct rect){bottom, rect.x, rect.h, rect.w};
+    case WL_OUTPUT_TRANSFORM_180:
+        return (struct rect){right, bottom, rect.w, rect.h};
+    case WL_OUTPUT_TRANSFORM_270:
+        return (struct rect){rect.y, right, rect.h, rect.w};
+    case WL_OUTPUT_TRANSFORM_FLIPPED:
+        return (struct rect){right, rect.y, rect.w, rect.h};
+    case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+        return (struct rect){rect.y, rect.x, rect.h, rect.w};
+    case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+        return (struct rect){rect.x, bottom, rect.w, rect.h};
+    case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+        return (struct rect){bottom, right, rect.h, rect.w};
+    }
+
+    return rect;
+}
+
+struct target_rect to_target_rect(
+    struct rect box, enum wl_output_transform transform, int width, int height,
+    double scale, double x_off, double y_off
+) {
+    struct rect rect = transform_rect(box, transform, width, height);
+
+    return (struct target_rect){
+        .x = rect.x / scale + x_off,
+        .y = rect.y / scale + y_off,
+        .w = rect.w / scale,
+        .h = rect.h / scale,
+    };
+}
+
+bool is_box_cut(struct rect box, uint32_t cut_edges, int width, int height) {
+    return ((cut_edges & DETECTION_EDGE_TOP) && box.y <= 0) ||
+           ((cut_edges & DETECTION_EDGE_BOTTOM) && box.y + box.h >= height) ||
+           ((cut_edges & DETECTION_EDGE_LEFT) && box.x <= 0) ||
+           ((cut_edges & DETECTION_EDGE_RIGHT) && box.x + box.w >= width);
+}
+
+static bool has_target_size(const struct target_rect *rect) {
+    return rect->h < 50 && rect->w < 500 && rect->h > 3 && rect->w > 7;
+}
+
+/**
+ * `is_inner_noise` tells whether a target inside `parent` is most likely part
+ * of it rather than a target of its own.
+ */
+static bool is_inner_noise(
+    const struct target_rect *rect, const struct target_rect *parent
+) {
+    // Inner targets that are flat are most likely lines forming an icon, e.g.
+    // a hamburger menu.
+    if (rect->h <= 6) {
+        return true;
+    }
+
+    // There's not much reasons to keep inner targets that have the same center
+    // as this is where the user is going to click most likely.
+    if (fabs(rect->x + rect->w / 2 - (parent->x + parent->w / 2)) < 8 &&
+        fabs(rect->y + rect->h / 2 - (parent->y + parent->h / 2)) < 8) {
+        return true;
+    }
+
+    // If the parent target is a square, it's most likely a button with a
+    // single option or an icon.
+    return fabs(parent->h - parent->w) < 5 && parent->h < 40 && parent->w < 40;
+}
+
+int filter_targets(
+    const struct component *comps, const struct target_rect *rects, int count,
+    bool *filtered
+) {
+    int num_targets = 0;
+
+    // Parents come first so they're already decided when reaching children.
+    for (int i = 0; i < count; i++) {
+        int parent  = comps[i].parent;
+        filtered[i] = filtered[i] || !has_target_size(&rects[i]) ||
+                      (parent >= 0 && !filtered[parent] &&
+                       is_inner_noise(&rects[i], &rects[parent]));
+
+        if (!filtered[i]) {
+            num_targets++;
+        }
+    }
+
+    return num_targets;
+}
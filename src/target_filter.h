@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __TARGET_FILTER_H_INCLUDED__
+#define __TARGET_FILTER_H_INCLUDED__
+
+#include "components.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#ifdef __cplusplus
+#define EXTERNC extern "C"
+#else
+#define EXTERNC
+#endif
+
+/**
+ * A `target_rect` is where a component is displayed, in logical pixels. It's
+ * only rounded once the component is kept as a target.
+ */
+struct target_rect {
+    double x;
+    double y;
+    double w;
+    double h;
+};
+
+/**
+ * `is_transform_rotated` tells whether the buffer's axes are swapped on the
+ * output.
+ */
+EXTERNC bool is_transform_rotated(enum wl_output_transform transform);
+
+/**
+ * `transform_rect` maps a rectangle of a `width` x `height` buffer to where it
+ * is displayed on an output with the given transform. This is what rotating or
+ * flipping the buffer itself would do.
+ */
+EXTERNC struct rect transform_rect(
+    struct rect rect, enum wl_output_transform transform, int width, int height
+);
+
+/**
+ * `to_target_rect` maps the box of a component of a `width` x `height` buffer
+ * to logical pixels of an output whose logical area starts at `x_off` and
+ * `y_off`. `scale` is the number of buffer pixels per logical pixel.
+ */
+EXTERNC struct target_rect to_target_rect(
+    struct rect box, enum wl_output_transform transform, int width, int height,
+    double scale, double x_off, double y_off
+);
+
+/**
+ * `is_box_cut` tells whether a box of a `width` x `height` buffer touches one
+ * of the `detection_edge` flags in `cut_edges`.
+ */
+EXTERNC bool
+is_box_cut(struct rect box, uint32_t cut_edges, int width, int height);
+
+/**
+ * `filter_targets` marks the components that are unlikely to be targets in
+ * `filtered`, given their rectangles in `rects`. Components already marked
+ * stay filtered and their children aren't compared with them. Returns how
+ * many components are kept.
+ */
+EXTERNC int filter_targets(
+    const struct component *comps, const struct target_rect *rects, int count,
+    bool *filtered
+);
+
+#undef EXTERNC
+
+#endif
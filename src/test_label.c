@@ -39,6 +39,13 @@ int main() {
         }
     }
 
+    if (label_symbols_find_rune(label_symbols, 0xe9) != 4 ||
+        label_symbols_find_rune(label_symbols, 'z') != -1 ||
+        label_symbols_find_idx(label_symbols, "ab") != -1) {
+        LOG_ERR("Wrong symbol lookup by rune.");
+        return 15;
+    }
+
     label_selection_t *label_selection =
         label_selection_new(label_symbols, 100);
     int label_selection_str_buf_size =
@@ -66,6 +73,76 @@ int main() {
         }
     }
 
+    // Matches of a prefix are the labels that include it.
+    label_selection_t *prefix = label_selection_new(label_symbols, 100);
+    int                prefix_symbols[] = {1, 3, 0};
+    for (int len = 0; len <= 3; len++) {
+        label_selection_clear(prefix);
+        for (int i = 0; i < len; i++) {
+            label_selection_append(prefix, prefix_symbols[i]);
+        }
+
+        int match = label_selection_first_match(prefix);
+        for (int i = 0; i < 100; i++) {
+            label_selection_set_from_idx(label_selection, i);
+            if (!label_selection_is_included(label_selection, prefix)) {
+                continue;
+            }
+
+            if (match != i) {
+                LOG_ERR("Wrong match %d, expected %d.", match, i);
+                return 16;
+            }
+            match = label_selection_next_match(prefix, match);
+        }
+
+        if (match != -1) {
+            LOG_ERR("Unexpected match %d.", match);
+            return 16;
+        }
+    }
+    label_selection_free(prefix);
+
+    // Shortened labels are still found from their symbols and none starts
+    // like a shorter one.
+    label_selection_t *shortened = label_selection_new(label_symbols, 100);
+    label_selection_t *other     = label_selection_new(label_symbols, 100);
+    label_selection_shorten(shortened);
+    label_selection_shorten(other);
+    if (shortened->num_short != 6) {
+        LOG_ERR("Wrong number of short labels %d.", shortened->num_short);
+        return 17;
+    }
+
+    for (int i = 0; i < 100; i++) {
+        label_selection_set_from_idx(shortened, i);
+        if (shortened->next != (i < 6 ? 2 : 3) ||
+            label_selection_to_idx(shortened) != i) {
+            LOG_ERR("Wrong shortened label for index %d.", i);
+            return 17;
+        }
+
+        for (int j = 0; j < i; j++) {
+            label_selection_set_from_idx(other, j);
+            if (label_selection_is_included(shortened, other)) {
+                LOG_ERR("Label %d starts like label %d.", i, j);
+                return 17;
+            }
+        }
+    }
+    label_selection_free(other);
+    label_selection_free(shortened);
+
+    // A single label keeps its symbol.
+    label_selection_t *single = label_selection_new(label_symbols, 1);
+    label_selection_shorten(single);
+    if (label_selection_append(single, 0) != LABEL_SELECTION_APPEND_SUCCESS ||
+        label_selection_to_idx(single) != 0) {
+        LOG_ERR("Single shortened label can't be selected.");
+        return 18;
+    }
+    label_selection_free(single);
+
     label_selection_clear(label_selection);
     label_selection_append(label_selection, 4);
     label_selection_append(label_selection, 2);
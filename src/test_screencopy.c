@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// The capture is driven without a compositor: the requests are recorded by
+// replacing the `libwayland-client` functions the protocol stubs call, and the
+// events are sent by calling the listeners directly.
+
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "log.h"
+#include "screencopy.h"
+#include "state.h"
+#include "udmabuf.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Exit code for skipped tests.
+#define SKIP 77
+
+#define DRM_FORMAT_XRGB8888 0x34325258
+
+#define WIDTH  64
+#define HEIGHT 32
+
+#define MAX_PROXIES 64
+
+struct fake_proxy {
+    const struct wl_interface *interface;
+    uint32_t                   version;
+    const void                *listener;
+    void                      *data;
+    bool                       destroyed;
+};
+
+static struct {
+    struct fake_proxy proxies[MAX_PROXIES];
+    int               num_proxies;
+
+    // Last objects created by the client.
+    struct fake_proxy *frame;
+    struct fake_proxy *params;
+    int                num_frames;
+
+    // Buffer of the last copy request.
+    struct wl_buffer *copied;
+    int               num_copies;
+
+    struct scrcpy_buffer *captured;
+    bool                  handled;
+} fake;
+
+static struct fake_proxy *
+new_proxy(const struct wl_interface *interface, uint32_t version) {
+    if (fake.num_proxies == MAX_PROXIES) {
+        LOG_ERR("Too many proxies.");
+        exit(1);
+    }
+
+    struct fake_proxy *proxy = &fake.proxies[fake.num_proxies++];
+    memset(proxy, 0, sizeof(*proxy));
+    proxy->interface = interface;
+    proxy->version   = version;
+    return proxy;
+}
+
+struct wl_proxy *wl_proxy_marshal_flags(
+    struct wl_proxy *proxy, uint32_t opcode,
+    const struct wl_interface *interface, uint32_t version, uint32_t flags,
+    ...
+) {
+    struct fake_proxy *target  = (struct fake_proxy *)proxy;
+    struct fake_proxy *created = NULL;
+
+    if (interface != NULL) {
+        created = new_proxy(interface, version);
+    }
+
+    if (target->interface == &zwlr_screencopy_manager_v1_interface) {
+        fake.frame = created;
+        fake.num_frames++;
+    } else if (target->interface == &zwp_linux_dmabuf_v1_interface) {
+        fake.params = created;
+    } else if (target->interface == &zwlr_screencopy_frame_v1_interface &&
+               (opcode == ZWLR_SCREENCOPY_FRAME_V1_COPY ||
+                opcode == ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE)) {
+        va_list args;
+        va_start(args, flags);
+        fake.copied = va_arg(args, struct wl_buffer *);
+        va_end(args);
+        fake.num_copies++;
+    }
+
+    if (flags & WL_MARSHAL_FLAG_DESTROY) {
+        target->destroyed = true;
+    }
+
+    return (struct wl_proxy *)created;
+}
+
+int wl_proxy_add_listener(
+    struct wl_proxy *proxy, void (**implementation)(void), void *data
+) {
+    struct fake_proxy *target = (struct fake_proxy *)proxy;
+    target->listener          = implementation;
+    target->data              = data;
+    return 0;
+}
+
+uint32_t wl_proxy_get_version(struct wl_proxy *proxy) {
+    return ((struct fake_proxy *)proxy)->version;
+}
+
+void wl_proxy_destroy(struct wl_proxy *proxy) {
+    ((struct fake_proxy *)proxy)->destroyed = true;
+}
+
+static void handle_capture(
+    struct state *state, struct scrcpy_buffer *buffer, void *data
+) {
+    fake.captured = buffer;
+    fake.handled  = true;
+}
+
+static const struct zwlr_screencopy_frame_v1_listener *frame_listener(void) {
+    return fake.frame->listener;
+}
+
+/**
+ * `offer_buffers` sends the buffer types the compositor supports for the last
+ * frame, then `buffer_done`.
+ */
+static void offer_buffers(bool dmabuf) {
+    struct zwlr_screencopy_frame_v1 *frame = (void *)fake.frame;
+
+    frame_listener()->buffer(
+        fake.frame->data, frame, WL_SHM_FORMAT_XRGB8888, WIDTH, HEIGHT,
+        WIDTH * 4
+    );
+    if (dmabuf) {
+        frame_listener()->linux_dmabuf(
+            fake.frame->data, frame, DRM_FORMAT_XRGB8888, WIDTH, HEIGHT
+        );
+    }
+    frame_listener()->buffer_done(fake.frame->data, frame);
+}
+
+static void send_ready(void) {
+    frame_listener()->ready(fake.frame->data, (void *)fake.frame, 0, 0, 0);
+}
+
+static void import_dmabuf(bool success) {
+    const struct zwp_linux_buffer_params_v1_listener *listener =
+        fake.params->listener;
+    struct zwp_linux_buffer_params_v1 *params = (void *)fake.params;
+
+    if (success) {
+        struct fake_proxy *buffer = new_proxy(&wl_buffer_interface, 1);
+        listener->created(fake.params->data, params, (void *)buffer);
+    } else {
+        listener->failed(fake.params->data, params);
+    }
+}
+
+static struct scrcpy_request *start_capture(struct state *state) {
+    static struct output output;
+    output.wl_output = (void *)new_proxy(&wl_output_interface, 4);
+
+    fake.frame      = NULL;
+    fake.params     = NULL;
+    fake.num_frames = 0;
+    fake.copied     = NULL;
+    fake.num_copies = 0;
+    fake.captured   = NULL;
+    fake.handled    = false;
+
+    struct scrcpy_request *request =
+        request_screenshot(state, &output, (struct rect){0, 0, WIDTH, HEIGHT});
+    scrcpy_request_set_handler(request, handle_capture, NULL);
+    return request;
+}
+
+/**
+ * `has_copied_shm` tells whether the frame was copied into an SHM buffer and
+ * handed to the handler once ready.
+ */
+static bool has_copied_shm(struct scrcpy_request *request) {
+    struct scrcpy_buffer *buffer = request->scrcpy_buffer;
+    if (fake.num_copies != 1 || buffer == NULL || buffer->is_dmabuf ||
+        fake.copied != buffer->wl_buffer) {
+        return false;
+    }
+
+    send_ready();
+    return fake.handled && fake.captured == buffer;
+}
+
+static bool is_udmabuf_available(void) {
+    struct udmabuf buf;
+    if (udmabuf_create(&buf, WIDTH * HEIGHT * 4)) {
+        return false;
+    }
+
+    udmabuf_destroy(&buf);
+    return true;
+}
+
+int main() {
+    struct state state = {0};
+    state.wl_screencopy_manager =
+        (void *)new_proxy(&zwlr_screencopy_manager_v1_interface, 3);
+    state.linux_dmabuf = (void *)new_proxy(&zwp_linux_dmabuf_v1_interface, 3);
+    state.config.mode_floating.capture_buffer = CAPTURE_BUFFER_AUTO;
+
+    struct wl_shm *wl_shm = (void *)new_proxy(&wl_shm_interface, 1);
+    if (shm_pool_init(&state.shm_pool, wl_shm)) {
+        LOG_ERR("Could not create SHM pool.");
+        return 1;
+    }
+
+    // Compositors that don't offer dmabufs get SHM buffers.
+    struct scrcpy_request *request = start_capture(&state);
+    offer_buffers(false);
+    if (!has_copied_shm(request)) {
+        LOG_ERR("Expected an SHM capture without dmabuf offer.");
+        return 2;
+    }
+    destroy_scrcpy_buffer(fake.captured);
+
+    // SHM can be forced even when dmabufs are offered.
+    state.config.mode_floating.capture_buffer = CAPTURE_BUFFER_SHM;
+    request                                   = start_capture(&state);
+    offer_buffers(true);
+    if (fake.params != NULL || !has_copied_shm(request)) {
+        LOG_ERR("Expected an SHM capture when configured.");
+        return 3;
+    }
+    destroy_scrcpy_buffer(fake.captured);
+    state.config.mode_floating.capture_buffer = CAPTURE_BUFFER_AUTO;
+
+    if (!is_udmabuf_available()) {
+        LOG_WARN("udmabuf is not available, skipping dmabuf captures.");
+
+        // Without udmabuf, dmabuf offers fall back to SHM right away.
+        request = start_capture(&state);
+        offer_buffers(true);
+        if (fake.params != NULL || !has_copied_shm(request)) {
+            LOG_ERR("Expected an SHM capture without udmabuf.");
+            return 4;
+        }
+        destroy_scrcpy_buffer(fake.captured);
+
+        shm_pool_finish(&state.shm_pool);
+        return SKIP;
+    }
+
+    // Dmabufs are preferred and the copy waits for their import.
+    request = start_capture(&state);
+    offer_buffers(true);
+    if (fake.params == NULL || fake.num_copies != 0 ||
+        request->scrcpy_buffer == NULL || !request->scrcpy_buffer->is_dmabuf) {
+        LOG_ERR("Expected a dmabuf to be imported.");
+        return 5;
+    }
+
+    import_dmabuf(true);
+    if (fake.num_copies != 1 ||
+        fake.copied != request->scrcpy_buffer->wl_buffer) {
+        LOG_ERR("Expected the frame to be copied into the dmabuf.");
+        return 6;
+    }
+
+    send_ready();
+    if (!fake.handled || fake.captured == NULL || !fake.captured->is_dmabuf) {
+        LOG_ERR("Expected the dmabuf capture to be handled.");
+        return 7;
+    }
+    destroy_scrcpy_buffer(fake.captured);
+
+    // A dmabuf the compositor can't import is replaced by an SHM buffer.
+    request = start_capture(&state);
+    offer_buffers(true);
+    import_dmabuf(false);
+    if (!has_copied_shm(request)) {
+        LOG_ERR("Expected an SHM capture after a failed import.");
+        return 8;
+    }
+    destroy_scrcpy_buffer(fake.captured);
+
+    // A frame that can't be copied into a dmabuf is captured again in SHM.
+    request = start_capture(&state);
+    offer_buffers(true);
+    import_dmabuf(true);
+    struct fake_proxy *failed_frame = fake.frame;
+    frame_listener()->failed(fake.frame->data, (void *)fake.frame);
+    if (!failed_frame->destroyed || fake.num_frames != 2 || fake.handled) {
+        LOG_ERR("Expected the frame to be captured again.");
+        return 9;
+    }
+
+    fake.num_copies = 0;
+    offer_buffers(true);
+    if (!has_copied_shm(request)) {
+        LOG_ERR("Expected an SHM capture after a failed dmabuf copy.");
+        return 10;
+    }
+    destroy_scrcpy_buffer(fake.captured);
+
+    shm_pool_finish(&state.shm_pool);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "detection_cache.h"
+#include "log.h"
+#include "target_detection.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH  800
+#define HEIGHT 600
+
+// How far a target can be from the button it was found for, as the edges are
+// dilated.
+#define TOLERANCE 4
+
+static void fill_rect(uint32_t *pixels, struct rect rect, uint32_t color) {
+    for (int y = rect.y; y < min(rect.y + rect.h, HEIGHT); y++) {
+        for (int x = rect.x; x < rect.x + rect.w; x++) {
+            pixels[y * WIDTH + x] = color;
+        }
+    }
+}
+
+static int compare_rects(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(struct rect));
+}
+
+static bool is_near(struct rect target, struct rect button) {
+    return abs(target.x - button.x) <= TOLERANCE &&
+           abs(target.y - button.y) <= TOLERANCE &&
+           abs(target.x + target.w - button.x - button.w) <= TOLERANCE &&
+           abs(target.y + target.h - button.y - button.h) <= TOLERANCE;
+}
+
+int main() {
+    const struct rect buttons[] = {
+        {40, 40, 120, 30},
+        {200, 40, 80, 24},
+        {40, 300, 300, 36},
+        {500, 520, 60, 20},
+    };
+    const int num_buttons = sizeof(buttons) / sizeof(buttons[0]);
+
+    uint32_t *pixels = malloc(sizeof(uint32_t) * WIDTH * HEIGHT);
+    fill_rect(pixels, (struct rect){0, 0, WIDTH, HEIGHT}, 0xffffffff);
+
+    // Panels are too large to be targets.
+    fill_rect(pixels, (struct rect){400, 100, 350, 200}, 0xff808080);
+
+    // The holes inside the buttons have the same center and aren't targets.
+    for (int i = 0; i < num_buttons; i++) {
+        fill_rect(pixels, buttons[i], 0xff202020);
+    }
+
+    const struct rect area = {0, 0, WIDTH, HEIGHT};
+    struct rect      *targets;
+    int               num_targets = detect_targets_native(
+        pixels, HEIGHT, WIDTH, WIDTH * sizeof(uint32_t),
+        WL_SHM_FORMAT_XRGB8888, WL_OUTPUT_TRANSFORM_NORMAL, area, 0, 0,
+        &targets, NULL
+    );
+
+    if (num_targets != num_buttons) {
+        LOG_ERR("Expected %d targets, got %d.", num_buttons, num_targets);
+        return 1;
+    }
+
+    for (int i = 0; i < num_buttons; i++) {
+        bool found = false;
+        for (int j = 0; j < num_targets && !found; j++) {
+            found = is_near(targets[j], buttons[i]);
+        }
+
+        if (!found) {
+            LOG_ERR(
+                "No target found for button %dx%d+%d+%d.", buttons[i].w,
+                buttons[i].h, buttons[i].x, buttons[i].y
+            );
+            return 2;
+        }
+    }
+
+    free(targets);
+
+    // Targets are moved to the area and scaled to its logical pixels.
+    const struct rect scaled_area = {1000, 200, WIDTH / 2, HEIGHT / 2};
+    num_targets                   = detect_targets_native(
+        pixels, HEIGHT, WIDTH, WIDTH * sizeof(uint32_t),
+        WL_SHM_FORMAT_XRGB8888, WL_OUTPUT_TRANSFORM_NORMAL, scaled_area, 0,
+        0, &targets, NULL
+    );
+
+    if (num_targets != num_buttons) {
+        LOG_ERR(
+            "Expected %d targets in scaled area, got %d.", num_buttons,
+            num_targets
+        );
+        return 3;
+    }
+
+    for (int i = 0; i < num_targets; i++) {
+        struct rect *target = &targets[i];
+        if (target->x < scaled_area.x || target->y < scaled_area.y ||
+            target->x + target->w > scaled_area.x + scaled_area.w ||
+            target->y + target->h > scaled_area.y + scaled_area.h) {
+            LOG_ERR(
+                "Target %dx%d+%d+%d is outside of the area.", target->w,
+                target->h, target->x, target->y
+            );
+            return 4;
+        }
+    }
+
+    free(targets);
+
+    // Only the rows below the third button are given, which cuts it.
+    const int cut_y = buttons[2].y + 10;
+    num_targets     = detect_targets_native(
+        pixels + cut_y * WIDTH, HEIGHT - cut_y, WIDTH,
+        WIDTH * sizeof(uint32_t), WL_SHM_FORMAT_XRGB8888,
+        WL_OUTPUT_TRANSFORM_NORMAL, (struct rect){0, 0, WIDTH, HEIGHT - cut_y},
+        DETECTION_EDGE_TOP, 0, &targets, NULL
+    );
+    free(targets);
+
+    if (num_targets != 1) {
+        LOG_ERR("Expected 1 target below the cut, got %d.", num_targets);
+        return 5;
+    }
+
+    // Nested buttons and panels that cross the tiles' borders and margins,
+    // along both axes. The last list row is cut by the bottom of the capture.
+    fill_rect(pixels, (struct rect){20, 230, 360, 140}, 0xff808080);
+    fill_rect(pixels, (struct rect){30, 240, 340, 40}, 0xffffffff);
+    fill_rect(pixels, (struct rect){40, 250, 100, 20}, 0xff202020);
+    fill_rect(pixels, (struct rect){60, 285, 200, 30}, 0xff202020);
+    fill_rect(pixels, (struct rect){70, 292, 60, 16}, 0xffffffff);
+    fill_rect(pixels, (struct rect){240, 60, 60, 500}, 0xff808080);
+    fill_rect(pixels, (struct rect){250, 150, 40, 20}, 0xff202020);
+    fill_rect(pixels, (struct rect){255, 256, 30, 20}, 0xff202020);
+    fill_rect(pixels, (struct rect){500, 240, 200, 120}, 0xff202020);
+    fill_rect(pixels, (struct rect){510, 280, 180, 40}, 0xffffffff);
+    fill_rect(pixels, (struct rect){520, 290, 40, 20}, 0xff202020);
+    for (int y = 380; y < HEIGHT; y += 30) {
+        fill_rect(pixels, (struct rect){420, y, 360, 24}, 0xff808080);
+    }
+
+    // Tiles are only detected again when their content changes and must give
+    // the same targets as the whole capture.
+    for (int transform = WL_OUTPUT_TRANSFORM_NORMAL;
+         transform <= WL_OUTPUT_TRANSFORM_FLIPPED_270; transform++) {
+        const bool        rotated = transform & WL_OUTPUT_TRANSFORM_90;
+        const struct rect area    = {
+            0, 0, rotated ? HEIGHT : WIDTH, rotated ? WIDTH : HEIGHT
+        };
+
+        struct rect *expected;
+        int          num_expected = detect_targets_native(
+            pixels, HEIGHT, WIDTH, WIDTH * sizeof(uint32_t),
+            WL_SHM_FORMAT_XRGB8888, transform, area, 0, 0, &expected, NULL
+        );
+
+        struct detection_cache cache = {0};
+        num_targets                  = detection_cache_detect(
+            &cache, detect_targets_native, pixels, HEIGHT, WIDTH,
+            WIDTH * sizeof(uint32_t), WL_SHM_FORMAT_XRGB8888, transform, area,
+            0, &targets
+        );
+
+        if (cache.num_tiles < 2) {
+            LOG_ERR("Expected the capture to be cut in tiles.");
+            return 6;
+        }
+
+        qsort(expected, num_expected, sizeof(struct rect), compare_rects);
+        qsort(targets, num_targets, sizeof(struct rect), compare_rects);
+        if (num_targets != num_expected ||
+            memcmp(targets, expected, sizeof(struct rect) * num_targets)) {
+            LOG_ERR(
+                "Tiles gave %d targets instead of %d with transform %d.",
+                num_targets, num_expected, transform
+            );
+            return 7;
+        }
+
+        detection_cache_finish(&cache);
+        free(expected);
+        free(targets);
+    }
+
+    free(pixels);
+    return 0;
+}
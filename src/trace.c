@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "trace.h"
+
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event {
+    const char *name;
+    char        phase; // 'B', 'E' or 'i' as in the trace event format.
+    int         tid;
+    uint64_t    ts_ns;
+};
+
+static struct {
+    bool                enabled;
+    char               *file_name;
+    struct trace_event *events;
+    size_t              num_events;
+    size_t              events_cap;
+    size_t              num_written;
+} trace = {0};
+
+// Events are appended to the file by writing over the footer that closes the
+// event array.
+#define TRACE_HEADER "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+#define TRACE_FOOTER "\n]}\n"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int trace_init(const char *file_name) {
+    FILE *f = fopen(file_name, "w");
+    if (f == NULL) {
+        LOG_ERR("Could not open trace file '%s'.", file_name);
+        return 1;
+    }
+    fputs(TRACE_HEADER TRACE_FOOTER, f);
+    fclose(f);
+
+    trace.file_name = strdup(file_name);
+    trace.enabled   = true;
+
+    trace.events_cap = 256;
+    trace.events     = malloc(sizeof(struct trace_event) * trace.events_cap);
+    trace.num_events  = 0;
+    trace.num_written = 0;
+
+    LOG_INFO("Writing trace to '%s'.", file_name);
+    return 0;
+}
+
+static void record(const char *name, char phase) {
+    if (!trace.enabled) {
+        return;
+    }
+
+    if (trace.num_events >= trace.events_cap) {
+        trace.events_cap *= 2;
+        trace.events      = realloc(
+            trace.events, sizeof(struct trace_event) * trace.events_cap
+        );
+    }
+
+    trace.events[trace.num_events++] = (struct trace_event){
+        .name  = name,
+        .phase = phase,
+        .tid   = gettid(),
+        .ts_ns = now_ns(),
+    };
+}
+
+void trace_begin(const char *name) {
+    record(name, 'B');
+}
+
+void trace_end(const char *name) {
+    record(name, 'E');
+}
+
+void trace_instant(const char *name) {
+    record(name, 'i');
+}
+
+void trace_flush(void) {
+    if (!trace.enabled || trace.num_events == 0) {
+        return;
+    }
+
+    FILE *f = fopen(trace.file_name, "r+");
+    if (f == NULL) {
+        LOG_ERR("Could not open trace file '%s'.", trace.file_name);
+        return;
+    }
+
+    if (fseek(f, -(long)strlen(TRACE_FOOTER), SEEK_END) != 0) {
+        LOG_ERR("Could not append to trace file '%s'.", trace.file_name);
+        fclose(f);
+        return;
+    }
+
+    int pid = getpid();
+
+    for (size_t i = 0; i < trace.num_events; i++) {
+        struct trace_event *event = &trace.events[i];
+        fprintf(
+            f,
+            "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,"
+            "\"tid\":%d%s}",
+            trace.num_written + i > 0 ? "," : "", event->name, event->phase,
+            event->ts_ns / 1000., pid, event->tid,
+            event->phase == 'i' ? ",\"s\":\"p\"" : ""
+        );
+    }
+    fputs(TRACE_FOOTER, f);
+
+    fclose(f);
+
+    // The events are only kept until they're written so that a daemon
+    // doesn't accumulate them over its sessions.
+    trace.num_written += trace.num_events;
+    trace.num_events   = 0;
+}
+
+void trace_finish(void) {
+    trace_flush();
+
+    free(trace.events);
+    free(trace.file_name);
+    memset(&trace, 0, sizeof(trace));
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __TRACE_H_INCLUDED__
+#define __TRACE_H_INCLUDED__
+
+#define TRACE_ENV_VAR "WL_KBPTR_TRACE"
+
+/**
+ * `trace_init` enables tracing. Events are recorded in memory and written to
+ * `file_name` as Chrome trace events JSON by `trace_flush`. The file is
+ * truncated. Returns 0 on success.
+ */
+int trace_init(const char *file_name);
+
+/**
+ * `trace_begin` and `trace_end` record the start and the end of a phase.
+ * `name` must be a static string. These are no-ops when tracing is disabled.
+ */
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+/**
+ * `trace_instant` records an event without duration.
+ */
+void trace_instant(const char *name);
+
+/**
+ * `trace_flush` appends the events recorded since the last flush to the trace
+ * file and forgets them.
+ */
+void trace_flush(void);
+
+/**
+ * `trace_finish` writes the trace file and releases the resources.
+ */
+void trace_finish(void);
+
+#endif
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "udmabuf.h"
+
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if HAVE_UDMABUF
+
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#include <stdint.h>
+
+#define UDMABUF_DEVICE "/dev/udmabuf"
+
+static size_t page_align(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+int udmabuf_create(struct udmabuf *buf, size_t size) {
+    memset(buf, 0, sizeof(*buf));
+    buf->memfd     = -1;
+    buf->dmabuf_fd = -1;
+    buf->size      = page_align(size);
+
+    struct udmabuf_create create = {
+        .flags  = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size   = buf->size,
+    };
+
+    int dev_fd = open(UDMABUF_DEVICE, O_RDWR | O_CLOEXEC);
+    if (dev_fd < 0) {
+        LOG_DEBUG("Could not open " UDMABUF_DEVICE ".");
+        return 1;
+    }
+
+    // The kernel requires the memfd to be sealed against shrinking.
+    buf->memfd =
+        memfd_create("wl-kbptr-udmabuf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (buf->memfd < 0 || ftruncate(buf->memfd, buf->size) != 0 ||
+        fcntl(buf->memfd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        goto error;
+    }
+
+    create.memfd   = buf->memfd;
+    buf->dmabuf_fd = ioctl(dev_fd, UDMABUF_CREATE, &create);
+    if (buf->dmabuf_fd < 0) {
+        goto error;
+    }
+
+    buf->data = mmap(
+        NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->memfd, 0
+    );
+    if (buf->data == MAP_FAILED) {
+        buf->data = NULL;
+        goto error;
+    }
+
+    close(dev_fd);
+    return 0;
+
+error:
+    LOG_DEBUG("Could not create udmabuf: %s.", strerror(errno));
+    close(dev_fd);
+    udmabuf_destroy(buf);
+    return 1;
+}
+
+static void sync_buffer(struct udmabuf *buf, uint64_t flags) {
+    struct dma_buf_sync sync = {.flags = flags};
+    while (ioctl(buf->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) != 0 &&
+           errno == EINTR) {}
+}
+
+void udmabuf_begin_read(struct udmabuf *buf) {
+    sync_buffer(buf, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+}
+
+void udmabuf_end_read(struct udmabuf *buf) {
+    sync_buffer(buf, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+}
+
+#else
+
+int udmabuf_create(struct udmabuf *buf, size_t size) {
+    memset(buf, 0, sizeof(*buf));
+    buf->memfd     = -1;
+    buf->dmabuf_fd = -1;
+
+    LOG_DEBUG("Built without udmabuf support.");
+    return 1;
+}
+
+void udmabuf_begin_read(struct udmabuf *buf) {}
+
+void udmabuf_end_read(struct udmabuf *buf) {}
+
+#endif
+
+void udmabuf_destroy(struct udmabuf *buf) {
+    if (buf->data != NULL) {
+        munmap(buf->data, buf->size);
+    }
+
+    if (buf->dmabuf_fd >= 0) {
+        close(buf->dmabuf_fd);
+    }
+
+    if (buf->memfd >= 0) {
+        close(buf->memfd);
+    }
+
+    memset(buf, 0, sizeof(*buf));
+    buf->memfd     = -1;
+    buf->dmabuf_fd = -1;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef __UDMABUF_H_INCLUDED__
+#define __UDMABUF_H_INCLUDED__
+
+#include <stddef.h>
+
+/**
+ * A `udmabuf` is a dmabuf made from a memfd with `/dev/udmabuf`. The
+ * compositor can render into it like into a GPU buffer while it can be read
+ * directly from its linear mapping.
+ */
+struct udmabuf {
+    int    memfd;
+    int    dmabuf_fd;
+    void  *data;
+    size_t size;
+};
+
+/**
+ * `udmabuf_create` allocates and maps a buffer of at least `size` bytes.
+ * Returns 0 on success. It always fails when built without udmabuf support.
+ */
+int udmabuf_create(struct udmabuf *buf, size_t size);
+
+void udmabuf_destroy(struct udmabuf *buf);
+
+/**
+ * `udmabuf_begin_read` and `udmabuf_end_read` surround the CPU reads of the
+ * buffer so that the device writes are visible.
+ */
+void udmabuf_begin_read(struct udmabuf *buf);
+void udmabuf_end_read(struct udmabuf *buf);
+
+#endif